@@ -0,0 +1,487 @@
+// Parser micro-benchmarks and correctness checks, built by `make bench` and `make parser-check`.
+//
+//   parser_bench [--lines=N]              ns and allocations per line of each line parser on synthetic input
+//   parser_bench --check [file.obj...]    every loader against LoadMode::Stream on the files (BENCH_CORPUS by
+//                                         default), then on generated files
+#define SCOP_NO_MAIN
+#include "../main.cpp"
+
+#include <new>
+#include <random>
+
+// Every operator new goes through here, so that a benchmark can count the allocations it does
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *memory = malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+    free(memory);
+}
+
+// Least time spent on each benchmark, the lines are parsed again and again until then
+constexpr double BENCH_MIN_SECONDS = 0.2;
+
+// What the benchmarks parsed goes here, so that it is not optimized away
+static volatile size_t benchSink;
+
+struct BenchInput
+{
+    const char *name;
+    std::vector<std::string> lines;
+};
+
+std::string formatNumber(std::mt19937 &random, bool scientific)
+{
+    std::uniform_real_distribution<double> value(-1000.0, 1000.0);
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), scientific ? "%.6e" : "%.6f", value(random));
+    return buffer;
+}
+
+std::vector<std::string> makeVertices(size_t count, bool scientific)
+{
+    std::mt19937 random(42);
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < count; i++)
+        lines.push_back("v " + formatNumber(random, scientific) + " " + formatNumber(random, scientific) + " "
+            + formatNumber(random, scientific));
+    return lines;
+}
+
+// form is printf'd with the index once per corner, negative faces count back from the last vertex
+std::vector<std::string> makeFaces(size_t count, size_t corners, const char *form, bool negative)
+{
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> index(1, 100000);
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < count; i++)
+    {
+        std::string line = "f";
+        for (size_t c = 0; c < corners; c++)
+        {
+            int value = negative ? -(int)(c + 1) : index(random);
+            char buffer[64];
+            snprintf(buffer, sizeof(buffer), form, value, value, value);
+            line += " ";
+            line += buffer;
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+// Runs parse over all the lines until BENCH_MIN_SECONDS went by, prints the time and allocations per line
+template <typename Fn>
+void bench(const char *function, const BenchInput &input, Fn parse)
+{
+    size_t lines = 0;
+    size_t allocated = 0;
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    while (elapsed < BENCH_MIN_SECONDS)
+    {
+        size_t before = allocations.load(std::memory_order_relaxed);
+        for (const std::string &line: input.lines)
+            sink += parse(line);
+        allocated += allocations.load(std::memory_order_relaxed) - before;
+        lines += input.lines.size();
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    benchSink = sink;
+
+    printf("%-22s %-20s %10.1f %10.2f\n", function, input.name, elapsed * 1e9 / lines, (double)allocated / lines);
+    fflush(stdout);
+}
+
+int runBenchmarks(size_t count)
+{
+    std::vector<BenchInput> vertices = {
+        {"v fixed", makeVertices(count, false)},
+        {"v scientific", makeVertices(count, true)},
+    };
+    std::vector<BenchInput> faces = {
+        {"f v (3)", makeFaces(count, 3, "%d", false)},
+        {"f v/vt/vn (4)", makeFaces(count, 4, "%d/%d/%d", false)},
+        {"f v//vn (4)", makeFaces(count, 4, "%d//%d", false)},
+        {"f negative (4)", makeFaces(count, 4, "%d/%d/%d", true)},
+        {"f long (64)", makeFaces(count / 16, 64, "%d/%d/%d", false)},
+    };
+
+    printf("%-22s %-20s %10s %10s\n", "function", "input", "ns/line", "allocs");
+    for (const BenchInput &input: vertices)
+    {
+        bench("parseVertex", input, [](const std::string &line) {
+            return (size_t)parseVertex(line).value.x;
+        });
+        bench("scanVertex", input, [](const std::string &line) {
+            return (size_t)scanVertex(line, 1).value.x;
+        });
+        // the first coordinate only, the token outlives the calls so that its copy doesn't allocate
+        bench("toDouble", input, [](const std::string &line) {
+            static std::string token;
+            size_t pos = 1;
+            token = nextToken(line, pos);
+            double value = 0.0;
+            toDouble(token, value);
+            return (size_t)value;
+        });
+        bench("parseNumber", input, [](const std::string &line) {
+            size_t pos = 1;
+            double value = 0.0;
+            parseNumber(nextToken(line, pos), value);
+            return (size_t)value;
+        });
+    }
+
+    ObjRawFaces rawFaces;
+    for (const BenchInput &input: faces)
+    {
+        bench("parseFace", input, [](const std::string &line) {
+            return parseFace(line).value.vertices.size();
+        });
+        bench("scanFace", input, [&rawFaces](const std::string &line) {
+            // kept small, the corners list growing is not what is measured
+            if (rawFaces.size() >= 1024)
+                rawFaces = ObjRawFaces();
+            return (size_t)scanFace(line, 1, rawFaces);
+        });
+        bench("split", input, [](const std::string &line) {
+            return split(line, ' ').size();
+        });
+        bench("split_on_blanks", input, [](const std::string &line) {
+            return split_on_blanks(line).size();
+        });
+        bench("nextToken", input, [](const std::string &line) {
+            size_t pos = 0, tokens = 0;
+            while (!nextToken(line, pos).empty())
+                tokens++;
+            return tokens;
+        });
+    }
+    return EXIT_SUCCESS;
+}
+
+template <typename T>
+bool sameArray(const std::vector<T> &a, const std::vector<T> &b)
+{
+    return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+template <typename Index, Index Absent>
+bool sameFaces(const ObjFaceList<Index, Absent> &a, const ObjFaceList<Index, Absent> &b)
+{
+    return sameArray(a.offsets, b.offsets) && sameArray(a.vertexIndices, b.vertexIndices)
+        && sameArray(a.texcoordIndices, b.texcoordIndices) && sameArray(a.normalIndices, b.normalIndices);
+}
+
+// What a load produced, or the message it failed with
+struct LoadOutcome
+{
+    std::unique_ptr<ObjectFile> object;
+    std::string error;
+};
+
+LoadOutcome load(const std::string &filename, LoadMode mode, bool lenient)
+{
+    LoadOptions options;
+    options.mode = mode;
+    options.useCache = false;
+    options.verbose = false;
+    options.buildLods = false;
+    options.lenient = lenient;
+
+    LoadOutcome outcome;
+    try {
+        outcome.object = std::make_unique<ObjectFile>(filename.c_str(), options);
+    } catch (std::exception &e) {
+        outcome.error = e.what();
+    }
+    return outcome;
+}
+
+// The first difference between the two loads, empty if there is none
+std::string compare(const LoadOutcome &reference, const LoadOutcome &other)
+{
+    if (reference.object && !other.object)
+        return "fails with \"" + other.error + "\"";
+    if (!reference.object && other.object)
+        return "loads, the reference fails with \"" + reference.error + "\"";
+    if (!reference.object)
+        return reference.error == other.error ? "" : "fails with \"" + other.error + "\" instead of \"" + reference.error + "\"";
+
+    const ObjectFile &a = *reference.object, &b = *other.object;
+    const ObjAttributes &attributesA = a._attributes, &attributesB = b._attributes;
+    if (!sameArray(attributesA.positionsX, attributesB.positionsX) || !sameArray(attributesA.positionsY, attributesB.positionsY)
+        || !sameArray(attributesA.positionsZ, attributesB.positionsZ) || !sameArray(attributesA.positionsW, attributesB.positionsW))
+        return "positions differ";
+    if (!sameArray(attributesA.texcoords, attributesB.texcoords) || !sameArray(attributesA.texcoordsW, attributesB.texcoordsW))
+        return "texture coordinates differ";
+    if (!sameArray(attributesA.normals, attributesB.normals))
+        return "normals differ";
+    if (!sameArray(attributesA.paramSpaceVertices, attributesB.paramSpaceVertices))
+        return "parameter space vertices differ";
+    if (!sameFaces(a._faces, b._faces))
+        return "faces differ";
+    if (!sameFaces(a._lineElements, b._lineElements))
+        return "line elements differ";
+    if (a._skippedLines != b._skippedLines)
+        return std::to_string(b._skippedLines) + " skipped lines instead of " + std::to_string(a._skippedLines);
+    if (!sameArray(a._renderVertices, b._renderVertices) || !sameArray(a._renderIndices, b._renderIndices))
+        return "render buffers differ";
+    return "";
+}
+
+constexpr LoadMode CHECKED_MODES[] = {LoadMode::Mapped, LoadMode::Parallel};
+constexpr const char *CHECKED_MODE_NAMES[] = {"mapped", "parallel"};
+
+// Loads filename with every mode, strict then lenient, and prints what differs from LoadMode::Stream.
+// Returns the number of mismatches
+size_t checkFile(const std::string &filename, bool quiet)
+{
+    size_t mismatches = 0;
+    for (bool lenient: {false, true})
+    {
+        LoadOutcome reference = load(filename, LoadMode::Stream, lenient);
+        for (size_t mode = 0; mode < std::size(CHECKED_MODES); mode++)
+        {
+            std::string difference = compare(reference, load(filename, CHECKED_MODES[mode], lenient));
+            if (!difference.empty())
+            {
+                printf("MISMATCH %s (%s%s): %s\n", filename.c_str(), CHECKED_MODE_NAMES[mode], lenient ? ", lenient" : "",
+                    difference.c_str());
+                mismatches++;
+            }
+        }
+        if (!quiet && !lenient)
+            printf("%-8s %s%s\n", mismatches ? "FAIL" : "OK", filename.c_str(), reference.object ? "" : " (rejected)");
+    }
+    return mismatches;
+}
+
+// Invalid lines the broken files pick from: keywords that only start like a known one, too few values and bad numbers
+constexpr const char *FUZZ_INVALID_LINES[] = {
+    "f 1 2", "v 1 x 3", "v 1x 2", "f 1x 2", "vtx 1", "vnx 0 0 1", "vpx 1", "fx 1 2 3", "vertex 1 2 3", "v1 2 3", "x"
+};
+
+// A small random file. Tokens are apart by spaces and tabs, numbers may have a leading '+', lines may end with
+// blanks and some files are CRLF. A third of the files are broken on purpose: besides FUZZ_INVALID_LINES they
+// have lines starting with blanks, garbage after numbers ("1x", "2e", "+-3") and indices out of bounds (0 included)
+std::string makeFuzzFile(std::mt19937 &random)
+{
+    std::uniform_int_distribution<int> percent(0, 99);
+    bool broken = percent(random) < 33;
+    std::string text;
+    int vertices = 0, texcoords = 0, normals = 0;
+    int lines = 5 + percent(random);
+    bool crlf = percent(random) < 20;
+
+    // mostly a single space
+    auto blank = [&]() -> std::string {
+        int kind = percent(random);
+        return kind < 80 ? " " : kind < 90 ? "\t" : kind < 95 ? "  " : " \t";
+    };
+
+    // sometimes with a leading '+', or not quite a number in broken files
+    auto mangle = [&](std::string number) {
+        int kind = percent(random);
+        if (broken && kind < 3)
+            return kind == 0 ? number + "x" : kind == 1 ? number + "e" : "+-" + number;
+        if (kind < 8 && number[0] != '-')
+            return "+" + number;
+        return number;
+    };
+    auto number = [&](bool scientific) {
+        return mangle(formatNumber(random, scientific));
+    };
+
+    // 1 to count or -count to -1, sometimes one past the end or 0 in broken files
+    auto index = [&](int count) {
+        if (broken && percent(random) < 5)
+            return mangle(std::to_string(percent(random) % 2 ? count + 1 : 0));
+        int i = std::uniform_int_distribution<int>(1, count)(random);
+        return mangle(std::to_string(percent(random) % 2 ? i : -i));
+    };
+
+    for (int i = 0; i < lines; i++)
+    {
+        if (broken && percent(random) < 3)
+            text += blank();
+        int kind = percent(random);
+        if (kind < 30 || vertices == 0) {
+            text += "v" + blank() + number(kind % 2);
+            text += blank() + number(false);
+            text += blank() + number(true);
+            if (kind < 3)
+                text += blank() + "0.5";
+            vertices++;
+        } else if (kind < 40) {
+            text += "vt" + blank() + number(false);
+            text += blank() + number(kind % 2);
+            texcoords++;
+        } else if (kind < 50) {
+            text += "vn" + blank() + number(true);
+            text += blank() + number(false);
+            text += blank() + number(false);
+            normals++;
+        } else if (kind < 80) {
+            int form = percent(random) % 4;
+            if ((form & 1) && texcoords == 0)
+                form &= ~1;
+            if ((form & 2) && normals == 0)
+                form &= ~2;
+            int corners = 3 + percent(random) % 4;
+            text += "f";
+            for (int c = 0; c < corners; c++)
+            {
+                text += blank() + index(vertices);
+                if (form == 1)
+                    text += "/" + index(texcoords);
+                else if (form == 2)
+                    text += "//" + index(normals);
+                else if (form == 3)
+                    text += "/" + index(texcoords) + "/" + index(normals);
+            }
+        } else if (kind < 85) {
+            text += "l" + blank() + index(vertices);
+            text += blank() + index(vertices);
+        } else if (kind < 90) {
+            text += (kind % 2 ? "g" : "s") + blank() + (kind % 2 ? "part" + std::to_string(kind) : std::to_string(kind % 3));
+        } else if (kind < 93 || !broken) {
+            text += "# comment";
+        } else {
+            text += FUZZ_INVALID_LINES[percent(random) % std::size(FUZZ_INVALID_LINES)];
+        }
+
+        int ending = percent(random);
+        if (ending < 10)
+            text += blank();
+        text += crlf ? "\r\n" : "\n";
+    }
+    return text;
+}
+
+// Lines the tokenizers of the two loaders once disagreed on, each one in a file of its own after a texture coordinate
+// that the next face refers to (-1), so that a placeholder added by one loader only shows. loads is what the strict
+// loads must do with it
+struct CheckCase
+{
+    const char *line;
+    bool loads;
+};
+
+constexpr CheckCase CHECK_CASES[] = {
+    {"v 1 2 3", true}, {"  v 1 2 3", false}, {"\tf 1 2 3", false}, {" # indented comment", false}, {"x", false},
+    {"v 1x 2 3", false}, {"v 1 2 3x", false}, {"v 1x 2", false}, {"f 1x 2 3", false}, {"f 1x 2", false},
+    {"v +1 2 3", true}, {"v +-1 2 3", false}, {"v 1 2 3 4 5", false},
+    {"vtx 1", false}, {"vnx 0 0 1", false}, {"vpx 1", false}, {"fx 1 2 3", false}, {"vt", false}, {"v", false},
+    {"g", true}, {"usemtl", true}, {"vt 0.5", true},
+};
+
+// Checks every case of CHECK_CASES in path, returns the number of mismatches (a wrong outcome counts as one)
+size_t checkCases(const char *path)
+{
+    size_t mismatches = 0;
+    for (const CheckCase &check: CHECK_CASES)
+    {
+        std::string text = std::string("v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0.25 0.75\n") + check.line + "\nf 1/-1 2/-1 3/-1\n";
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << text;
+        size_t found = checkFile(path, true);
+        bool loads = (bool)load(path, LoadMode::Stream, false).object;
+        if (loads != check.loads)
+        {
+            printf("MISMATCH \"%s\": %s instead of %s\n", check.line, loads ? "loads" : "fails", check.loads ? "loading" : "failing");
+            found++;
+        }
+        else if (found)
+            printf("with the line \"%s\"\n", check.line);
+        mismatches += found;
+    }
+    return mismatches;
+}
+
+int runChecks(std::vector<std::string> filenames, size_t fuzzFiles)
+{
+    if (filenames.empty())
+        for (const char *filename: BENCH_CORPUS)
+            if (access(filename, R_OK) == 0)
+                filenames.push_back(filename);
+
+    size_t mismatches = 0;
+    for (const std::string &filename: filenames)
+        mismatches += checkFile(filename, false);
+
+    char path[] = "/tmp/scop_fuzz_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        std::cerr << "Cannot create a temporary file: " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    // lenient loads say how many lines they skipped, which would drown the mismatches
+    std::streambuf *errors = std::cerr.rdbuf(nullptr);
+    mismatches += checkCases(path);
+    std::mt19937 random(42);
+    size_t rejected = 0;
+    for (size_t i = 0; i < fuzzFiles; i++)
+    {
+        std::string text = makeFuzzFile(random);
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << text;
+        size_t found = checkFile(path, true);
+        if (found)
+            printf("file %zu was:\n%s\n", i, text.c_str());
+        mismatches += found;
+        rejected += !load(path, LoadMode::Stream, false).object;
+    }
+    unlink(path);
+    std::cerr.rdbuf(errors);
+    std::cerr.clear();
+
+    printf("%zu cases and %zu generated files (%zu rejected by the strict load), %zu mismatches\n", std::size(CHECK_CASES),
+        fuzzFiles, rejected, mismatches);
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    bool check = false;
+    size_t lines = 10000;
+    size_t fuzzFiles = 500;
+    std::vector<std::string> filenames;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--check")
+            check = true;
+        else if (arg.rfind("--lines=", 0) == 0)
+            lines = std::max(1, atoi(arg.c_str() + 8));
+        else if (arg.rfind("--fuzz=", 0) == 0)
+            fuzzFiles = std::max(0, atoi(arg.c_str() + 7));
+        else if (arg.rfind("--", 0) == 0)
+        {
+            std::cerr << "usage: parser_bench [--lines=N] | --check [--fuzz=files] [file.obj...]" << std::endl;
+            return EXIT_FAILURE;
+        }
+        else
+            filenames.push_back(arg);
+    }
+
+    if (check)
+        return runChecks(filenames, fuzzFiles);
+    return runBenchmarks(lines);
+}
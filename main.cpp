@@ -1,7 +1,14 @@
 #include <GLFW/glfw3.h>
 #include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+// the entry points of the core profile contexts, see hintGlContext()
+#define GL_DO_NOT_WARN_IF_MULTI_GL_VERSION_HEADERS_INCLUDED
+#include <OpenGL/gl3.h>
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
 
 #include <stdlib.h>
 #include <iostream>
@@ -12,9 +19,51 @@
 #include <optional>
 #include <chrono>
 #include <thread>
+#include <cstddef>
+#include <string_view>
+#include <unordered_map>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <climits>
+#include <cerrno>
+
+#include <cstring>
+#include <cctype>
+#include <cstdio>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <tuple>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#include <sys/event.h>
+#define HAS_KQUEUE
+#endif
 
 
 #define TARGET_FPS 60
+// Per second speeds, the same as the former per frame steps at TARGET_FPS
+#define SPIN_SPEED 45.0 // degrees around y, always applied
+#define MOVE_SPEED 1.5
+#define ROTATION_SPEED 90.0 // degrees
 
 struct FileNotFoundException : public std::exception
 {
@@ -76,536 +125,7996 @@ struct ObjFace
     std::vector<Vertex> vertices;
 };
 
-// l
+// l, a polyline through the vertices (the texture coordinates they may have are not drawn)
 struct ObjLine
 {
-    std::vector<std::size_t> vertexIndices;
+    std::vector<int> vertexIndices;
 };
 
-// split("a/b/c//d", '/') -> {"a", "b", "c", "", "d"}
-std::vector<std::string> split(const std::string& s, char delimiter)
-{
-    std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(s);
-    while (std::getline(tokenStream, token, delimiter))
-        tokens.push_back(token);
-    return tokens;
-}
+// Corner without a texture coordinate or normal once indices are resolved
+constexpr uint32_t NO_INDEX = UINT32_MAX;
 
-// split_without_empty("a/b/c//d", '/') -> {"a", "b", "c", "d"}
-std::vector<std::string> split_without_empty(const std::string& s, char delimiter)
+// v/vt/vn/vp records as floats, positions as a structure of arrays.
+// w of v and vt almost always keep their default, so they only get a stream once a record doesn't
+struct ObjAttributes
 {
-    std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(s);
-    while (std::getline(tokenStream, token, delimiter))
-        if (!token.empty())
-            tokens.push_back(token);
-    return tokens;
-}
+    std::vector<float> positionsX, positionsY, positionsZ;
+    std::vector<float> positionsW;
+    std::vector<glm::vec2> texcoords;
+    std::vector<float> texcoordsW;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec3> paramSpaceVertices;
 
-// Rotate a vertex around a given point
-glm::vec3 rotateVertex(const ObjVertex &vertex, const glm::vec3 &center, float angleX, float angleY, float angleZ)
-{
-    angleX = glm::radians(angleX);
-    angleY = glm::radians(angleY);
-    angleZ = glm::radians(angleZ);
-    
-    // change the origin to the center
-    glm::vec3 v = {vertex.x - center.x, vertex.y - center.y, vertex.z - center.z};
+    size_t verticesCount() const { return positionsX.size(); }
 
-    // rotate around x
-    glm::vec3 v2 = {v.x, v.y * cos(angleX) - v.z * sin(angleX), v.y * sin(angleX) + v.z * cos(angleX)};
-    // rotate around y
-    glm::vec3 v3 = {v2.x * cos(angleY) + v2.z * sin(angleY), v2.y, -v2.x * sin(angleY) + v2.z * cos(angleY)};
-    // rotate around z
-    glm::vec3 v4 = {v3.x * cos(angleZ) - v3.y * sin(angleZ), v3.x * sin(angleZ) + v3.y * cos(angleZ), v3.z};
+    void addVertex(const ObjVertex &vertex)
+    {
+        if (vertex.w != 1.0 || !positionsW.empty())
+        {
+            positionsW.resize(positionsX.size(), 1.0f);
+            positionsW.push_back(vertex.w);
+        }
 
-    // change the origin back
-    return {v4.x + center.x, v4.y + center.y, v4.z + center.z};
-}
+        positionsX.push_back(vertex.x);
+        positionsY.push_back(vertex.y);
+        positionsZ.push_back(vertex.z);
+    }
 
-ObjVertex parseVertex(const std::string &line)
-{
-    auto tokens = split_without_empty(line, ' ');
+    void addTextureCoordinate(const ObjTextureCoordinate &textureCoordinate)
+    {
+        if (textureCoordinate.w != 0.0 || !texcoordsW.empty())
+        {
+            texcoordsW.resize(texcoords.size(), 0.0f);
+            texcoordsW.push_back(textureCoordinate.w);
+        }
 
-    if (tokens.size() < 4 || tokens.size() > 5 || tokens.at(0) != "v")
-        throw InvalidObjFileException("Invalid vertex line: " + line);
+        texcoords.push_back(glm::vec2(textureCoordinate.u, textureCoordinate.v));
+    }
 
-    ObjVertex vertex;
+    void addNormal(const ObjNormal &normal)
+    {
+        normals.push_back(glm::vec3(normal.x, normal.y, normal.z));
+    }
 
-    try {
-        vertex.x = std::stod(tokens.at(1));
-        vertex.y = std::stod(tokens.at(2));
-        vertex.z = std::stod(tokens.at(3));
-        if (tokens.size() >= 5)
-            vertex.w = std::stod(tokens.at(4));
-    } catch (std::invalid_argument &e) {
-        throw InvalidObjFileException("Invalid vertex line (invalid values): " + line);
+    void addParameterSpaceVertex(const ObjParameterSpaceVertex &parameterSpaceVertex)
+    {
+        paramSpaceVertices.push_back(glm::vec3(parameterSpaceVertex.u, parameterSpaceVertex.v, parameterSpaceVertex.w));
     }
 
-    return vertex;
-}
+    void reserve(size_t verticesCount, size_t texcoordsCount, size_t normalsCount)
+    {
+        positionsX.reserve(verticesCount);
+        positionsY.reserve(verticesCount);
+        positionsZ.reserve(verticesCount);
+        texcoords.reserve(texcoordsCount);
+        normals.reserve(normalsCount);
+    }
 
-ObjTextureCoordinate parseTextureCoordinate(const std::string &line)
-{
-    auto tokens = split_without_empty(line, ' ');
+    // Appends the records of other after ours
+    void append(const ObjAttributes &other)
+    {
+        if (!other.positionsW.empty() && positionsW.empty())
+            positionsW.assign(verticesCount(), 1.0f);
+        if (!positionsW.empty() && other.positionsW.empty())
+            positionsW.insert(positionsW.end(), other.verticesCount(), 1.0f);
+        else
+            positionsW.insert(positionsW.end(), other.positionsW.begin(), other.positionsW.end());
 
-    if (tokens.size() < 2 || tokens.size() > 4 || tokens.at(0) != "vt")
-        throw InvalidObjFileException("Invalid texture coordinate line: " + line);
+        if (!other.texcoordsW.empty() && texcoordsW.empty())
+            texcoordsW.assign(texcoords.size(), 0.0f);
+        if (!texcoordsW.empty() && other.texcoordsW.empty())
+            texcoordsW.insert(texcoordsW.end(), other.texcoords.size(), 0.0f);
+        else
+            texcoordsW.insert(texcoordsW.end(), other.texcoordsW.begin(), other.texcoordsW.end());
 
-    ObjTextureCoordinate textureCoordinate;
-    try {
-        textureCoordinate.u = std::stod(tokens.at(1));
-        if (tokens.size() >= 3)
-            textureCoordinate.v = std::stod(tokens.at(2));
-        if (tokens.size() >= 4)
-            textureCoordinate.w = std::stod(tokens.at(3));
-        return textureCoordinate;
-    } catch (std::invalid_argument &e) {
-        throw InvalidObjFileException("Invalid texture coordinate line (invalid values): " + line);
+        positionsX.insert(positionsX.end(), other.positionsX.begin(), other.positionsX.end());
+        positionsY.insert(positionsY.end(), other.positionsY.begin(), other.positionsY.end());
+        positionsZ.insert(positionsZ.end(), other.positionsZ.begin(), other.positionsZ.end());
+        texcoords.insert(texcoords.end(), other.texcoords.begin(), other.texcoords.end());
+        normals.insert(normals.end(), other.normals.begin(), other.normals.end());
+        paramSpaceVertices.insert(paramSpaceVertices.end(), other.paramSpaceVertices.begin(), other.paramSpaceVertices.end());
     }
+};
 
-    return textureCoordinate;
-}
-
-ObjNormal parseNormal(const std::string &line)
+// f records as one flat corner list, face i uses the corners [offsets[i], offsets[i + 1]).
+// The texcoord and normal streams are empty when no corner has one, otherwise corners without one hold Absent
+template <typename Index, Index Absent>
+struct ObjFaceList
 {
-    auto tokens = split_without_empty(line, ' ');
-
-    if (tokens.size() != 4 || tokens.at(0) != "vn")
-        throw InvalidObjFileException("Invalid normal line: " + line);
-
-    ObjNormal normal;
-    try {
-        normal.x = std::stod(tokens.at(1));
-        normal.y = std::stod(tokens.at(2));
-        normal.z = std::stod(tokens.at(3));
-        return normal;
-    } catch (std::invalid_argument &e) {
-        throw InvalidObjFileException("Invalid normal line (invalid values): " + line);
-    }
+    std::vector<uint32_t> offsets = {0};
+    std::vector<Index> vertexIndices;
+    std::vector<Index> texcoordIndices;
+    std::vector<Index> normalIndices;
 
-    return normal;
-}
+    size_t size() const { return offsets.size() - 1; }
+    size_t cornersCount() const { return vertexIndices.size(); }
+    bool hasTexcoords() const { return !texcoordIndices.empty(); }
+    bool hasNormals() const { return !normalIndices.empty(); }
 
-ObjParameterSpaceVertex parseParameterSpaceVertex(const std::string &line)
-{
-    auto tokens = split_without_empty(line, ' ');
+    void addCorner(Index vertex, Index texcoord, Index normal)
+    {
+        if (texcoord != Absent || !texcoordIndices.empty())
+        {
+            texcoordIndices.resize(vertexIndices.size(), Absent);
+            texcoordIndices.push_back(texcoord);
+        }
 
-    if (tokens.size() < 2 || tokens.size() > 4 || tokens.at(0) != "vp")
-        throw InvalidObjFileException("Invalid parameter space vertex line: " + line);
+        if (normal != Absent || !normalIndices.empty())
+        {
+            normalIndices.resize(vertexIndices.size(), Absent);
+            normalIndices.push_back(normal);
+        }
 
-    ObjParameterSpaceVertex parameterSpaceVertex;
-    try {
-        parameterSpaceVertex.u = std::stod(tokens.at(1));
-        if (tokens.size() >= 3)
-            parameterSpaceVertex.v = std::stod(tokens.at(2));
-        if (tokens.size() >= 4)
-            parameterSpaceVertex.w = std::stod(tokens.at(3));
-        return parameterSpaceVertex;
-    } catch (std::invalid_argument &e) {
-        throw InvalidObjFileException("Invalid parameter space vertex line (invalid values): " + line);
+        vertexIndices.push_back(vertex);
     }
 
-    return parameterSpaceVertex;
-}
-
-ObjFace parseFace(const std::string &line)
-{
-    auto tokens = split_without_empty(line, ' ');
+    // The corners added since the previous call make a face
+    void endFace()
+    {
+        offsets.push_back(vertexIndices.size());
+    }
 
-    if (tokens.size() < 4 || tokens.at(0) != "f")
-        throw InvalidObjFileException("Invalid face line: " + line);
+    // Drops the corners added since the previous endFace(), the texcoord and normal streams go back to empty
+    // if they were before them
+    void discardFace(bool keepTexcoords, bool keepNormals)
+    {
+        size_t kept = offsets.back();
+        vertexIndices.resize(kept);
+        texcoordIndices.resize(keepTexcoords ? std::min(kept, texcoordIndices.size()) : 0);
+        normalIndices.resize(keepNormals ? std::min(kept, normalIndices.size()) : 0);
+    }
 
-    ObjFace face;
-    try
+    // Removes the faces listed in faces (in increasing order) and their corners
+    void removeFaces(const std::vector<size_t> &faces)
     {
-        for (int i = 1; i < tokens.size(); i++)
+        size_t removed = 0, face = 0, corner = 0;
+        for (size_t f = 0; f < size(); f++)
         {
-            auto subtokens = split(tokens.at(i), '/');
-            if (subtokens.size() < 1 || subtokens.size() > 3)
-                throw InvalidObjFileException("Invalid face line: " + line);
-
-            ObjFace::Vertex vertex;
-            vertex.vertexIndex = std::stoi(subtokens.at(0));
-            // vertex normal without texture coordinate is f v1//vn1
-            if (subtokens.size() >= 2 && subtokens.at(1) != "")
-                vertex.textureCoordinateIndex = std::stoi(subtokens.at(1));
-            if (subtokens.size() >= 3)
-                vertex.normalIndex = std::stoi(subtokens.at(2));
-
-            face.vertices.push_back(vertex);
+            if (removed < faces.size() && faces[removed] == f)
+            {
+                removed++;
+                continue;
+            }
+            uint32_t first = offsets[f], last = offsets[f + 1];
+            offsets[face++] = corner;
+            for (uint32_t c = first; c < last; c++, corner++)
+            {
+                vertexIndices[corner] = vertexIndices[c];
+                if (hasTexcoords())
+                    texcoordIndices[corner] = texcoordIndices[c];
+                if (hasNormals())
+                    normalIndices[corner] = normalIndices[c];
+            }
         }
+        offsets.resize(face + 1);
+        offsets[face] = corner;
+        vertexIndices.resize(corner);
+        if (hasTexcoords())
+            texcoordIndices.resize(corner);
+        if (hasNormals())
+            normalIndices.resize(corner);
     }
-    catch (std::invalid_argument &e)
-    {
-        throw InvalidObjFileException("Invalid face line (invalid values): " + line);
-    }
+};
 
-    return face;
-}
+// Indices as written in the file, with 0 for an absent texcoord/normal.
+// A 0 actually written in the file is kept as INT32_MIN, which is out of bounds just the same
+using ObjRawFaces = ObjFaceList<int32_t, 0>;
+using ObjFaces = ObjFaceList<uint32_t, NO_INDEX>;
 
-// https://www.cs.cmu.edu/~mbz/personal/graphics/obj.html
-// https://en.wikipedia.org/wiki/Wavefront_.obj_file#File_format
-// http://paulbourke.net/dataformats/obj/
-class ObjectFile
+inline int32_t rawIndex(int index)
 {
-    public:
-        std::string _filename;
+    return index == 0 ? INT32_MIN : index;
+}
 
-        std::vector<ObjVertex> _vertices;
-        std::vector<ObjTextureCoordinate> _texcoords;
-        std::vector<ObjNormal> _normals;
-        std::vector<ObjParameterSpaceVertex> _paramSpaceVertices;
-        std::vector<ObjFace> _faces;
-        std::vector<ObjLine> _lines;
+// Converts index to 0-based indexes + if negative it means it's relative to the end of the array (eg. -1 is the last element).
+// count is the number of elements declared before the face, returns false if out of bounds
+inline bool resolveIndex(int32_t raw, size_t count, uint32_t &index)
+{
+    long long resolved = raw < 0 ? (long long)count + raw : (long long)raw - 1;
+    if (resolved < 0 || resolved >= (long long)count)
+        return false;
+    index = resolved;
+    return true;
+}
 
-        size_t _verticesCount = 0;
-        size_t _texcoordsCount = 0;
-        size_t _normalsCount = 0;
+// Open addressing (linear probing) hash map from a corner's (vertex, texcoord, normal) index triple
+// to the welded render vertex it became, so shared corners are only uploaded once
+class CornerWelder
+{
+    private:
+        struct Slot
+        {
+            uint32_t vertex;
+            uint32_t texcoord;
+            uint32_t normal;
+            uint32_t welded; // NO_INDEX while the slot is empty
+        };
 
-        double _scale = 1.0;
+        std::vector<Slot> _slots;
+        size_t _mask = 0;
+        size_t _count = 0;
 
-    public:
-        ObjectFile() {}
+        static size_t hash(uint32_t vertex, uint32_t texcoord, uint32_t normal)
+        {
+            uint64_t h = vertex * 0x9E3779B97F4A7C15ull;
+            h ^= (texcoord + 0x7F4A7C15ull) * 0xC2B2AE3D27D4EB4Full;
+            h ^= (normal + 0x165667B1ull) * 0x165667B19E3779F9ull;
+            return h ^ (h >> 29);
+        }
 
-        ObjectFile(const char* filename): _filename(filename)
+        void grow()
         {
-            load(filename);
-            normalize();
+            std::vector<Slot> old = std::move(_slots);
+            _slots.assign(old.size() * 2, {0, 0, 0, NO_INDEX});
+            _mask = _slots.size() - 1;
+            for (const auto &slot: old)
+            {
+                if (slot.welded == NO_INDEX)
+                    continue;
+                size_t i = hash(slot.vertex, slot.texcoord, slot.normal) & _mask;
+                while (_slots[i].welded != NO_INDEX)
+                    i = (i + 1) & _mask;
+                _slots[i] = slot;
+            }
         }
 
-        void load(const char* filename)
+    public:
+        CornerWelder(size_t expectedCount)
         {
-            std::cout << "Loading " << filename << std::endl;
+            size_t capacity = 16;
+            while (capacity < expectedCount * 2)
+                capacity *= 2;
+            _slots.assign(capacity, {0, 0, 0, NO_INDEX});
+            _mask = capacity - 1;
+        }
 
-            std::ifstream file(filename);
-            if (!file.is_open())
-                throw FileNotFoundException("file " + _filename + " not found");
+        // Welded index of the triple, which becomes next (and inserted is set) the first time it is seen
+        uint32_t weld(uint32_t vertex, uint32_t texcoord, uint32_t normal, uint32_t next, bool &inserted)
+        {
+            if ((_count + 1) * 10 > _slots.size() * 7)
+                grow();
 
-            std::string line;
-            size_t lineNum = 0;
-            while (std::getline(file, line))
+            size_t i = hash(vertex, texcoord, normal) & _mask;
+            while (_slots[i].welded != NO_INDEX)
             {
-                lineNum++;
-
-                if (line.size() == 0 || line.at(0) == '#')
-                    continue;
+                const Slot &slot = _slots[i];
+                if (slot.vertex == vertex && slot.texcoord == texcoord && slot.normal == normal)
+                {
+                    inserted = false;
+                    return slot.welded;
+                }
+                i = (i + 1) & _mask;
+            }
 
-                if (line.size() < 2)
-                    throw InvalidObjFileException("line " + std::to_string(lineNum) + " is invalid (too short)");
+            _slots[i] = {vertex, texcoord, normal, next};
+            _count++;
+            inserted = true;
+            return next;
+        }
+};
 
-                std::string identifier = line.substr(0, 2);
-                if (identifier == "v ") {
-                    _vertices.push_back(parseVertex(line));
-                     _verticesCount++;
-                } else if (identifier == "vt") {
-                    _texcoords.push_back(parseTextureCoordinate(line));
-                    _texcoordsCount++;
-                } else if (identifier == "vn") {
-                    _normals.push_back(parseNormal(line));
-                    _normalsCount++;
-                } else if (identifier == "vp") {
-                    _paramSpaceVertices.push_back(parseParameterSpaceVertex(line));
-                }  else if (identifier == "f ") {
-                    ObjFace face = parseFace(line);
+// Triangulates a polygon given by its corner positions, appending triangles as corner numbers (0 to n - 1).
+// Convex polygons are fanned like before, concave ones are ear clipped in the plane of their Newell normal
+void triangulatePolygon(const std::vector<glm::vec3> &points, std::vector<uint32_t> &triangles)
+{
+    size_t n = points.size();
 
+    glm::vec3 normal(0.0f, 0.0f, 0.0f);
+    for (size_t i = 0; i < n; i++)
+    {
+        const glm::vec3 &a = points[i];
+        const glm::vec3 &b = points[(i + 1) % n];
+        normal.x += (a.y - b.y) * (a.z + b.z);
+        normal.y += (a.z - b.z) * (a.x + b.x);
+        normal.z += (a.x - b.x) * (a.y + b.y);
+    }
 
-                    // Converts index to 0-based indexes + if negative it means it's relative to the end of the array (eg. -1 is the last element)
-                    for (auto &vertex: face.vertices)
-                    {
-                        if (vertex.vertexIndex < 0)
-                            vertex.vertexIndex = _verticesCount + vertex.vertexIndex;
-                        else
-                            vertex.vertexIndex--;
-
-                        if (vertex.textureCoordinateIndex.has_value() && vertex.textureCoordinateIndex.value() < 0)
-                            vertex.textureCoordinateIndex = _texcoordsCount + vertex.textureCoordinateIndex.value();
-                        else if (vertex.textureCoordinateIndex.has_value())
-                            vertex.textureCoordinateIndex.value()--;
-
-                        if (vertex.normalIndex.has_value() && vertex.normalIndex.value() < 0)
-                            vertex.normalIndex = _normalsCount + vertex.normalIndex.value();
-                        else if (vertex.normalIndex.has_value())
-                            vertex.normalIndex.value()--;
-
-                        if (vertex.vertexIndex < 0 || vertex.vertexIndex >= _verticesCount)
-                            throw InvalidObjFileException("line " + std::to_string(lineNum) + " is invalid (vertex index out of bounds)");
-                        else if (vertex.textureCoordinateIndex.has_value() && (vertex.textureCoordinateIndex.value() < 0 || vertex.textureCoordinateIndex.value() >= _texcoordsCount))
-                            throw InvalidObjFileException("line " + std::to_string(lineNum) + " is invalid (texture coordinate index out of bounds)");
-                        else if (vertex.normalIndex.has_value() && (vertex.normalIndex.value() < 0 || vertex.normalIndex.value() >= _normalsCount))
-                            throw InvalidObjFileException("line " + std::to_string(lineNum) + " is invalid (normal index out of bounds)");
-                    }
+    bool convex = true;
+    for (size_t i = 0; n > 3 && i < n && convex; i++)
+    {
+        const glm::vec3 &previous = points[(i + n - 1) % n];
+        const glm::vec3 &next = points[(i + 1) % n];
+        convex = glm::dot(glm::cross(points[i] - previous, next - points[i]), normal) >= 0.0f;
+    }
 
-                    _faces.push_back(face);
-                } /* else if (identifier == "l ") {
-                    _lines.push_back(parseLine(line));
-                } */ else {
-                    throw InvalidObjFileException("unknown token " + identifier + " on line " + std::to_string(lineNum));
-                }
+    std::vector<uint32_t> remaining;
+    for (uint32_t i = 0; i < n; i++)
+        remaining.push_back(i);
 
-            }
+    if (!convex)
+    {
+        // Drop the dominant axis of the normal, the polygon is then counter clockwise in (u, v) if orientation is positive
+        glm::vec3 absNormal = glm::abs(normal);
+        int axis = absNormal.x > absNormal.y ? (absNormal.x > absNormal.z ? 0 : 2) : (absNormal.y > absNormal.z ? 1 : 2);
+        float orientation = normal[axis] < 0.0f ? -1.0f : 1.0f;
+        std::vector<glm::vec2> flat;
+        for (const auto &point: points)
+            flat.push_back(glm::vec2(point[(axis + 1) % 3], point[(axis + 2) % 3]));
 
-            std::cout << "Successfully loaded and parsed " << filename << std::endl;
-        }
+        auto cross2 = [](const glm::vec2 &a, const glm::vec2 &b, const glm::vec2 &c) {
+            return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+        };
 
-        void display()
+        while (remaining.size() > 3)
         {
-            size_t currentFace = 0;
-            for (auto &face: _faces)
+            size_t m = remaining.size();
+            bool clipped = false;
+            for (size_t i = 0; i < m && !clipped; i++)
             {
-                currentFace++;
-                
-                glBegin(GL_POLYGON);
-                for (auto &objVertex: face.vertices)
-                {
-                    float r = (currentFace * 0.1f);
-                    if (r > 1.0f)
-                        r -= (int)r;
-                    float g = (currentFace * 0.2f);
-                    if (g > 1.0f)
-                        g -= (int)g;
-                    float b = (currentFace * 0.3f);
-                    if (b > 1.0f)
-                        b -= (int)b;
-
-                    // glColor3f(r, g, b);
-                    glColor3f(0.8f, 0.3f, 0.4f);
-
-                    if (objVertex.normalIndex.has_value())
-                        glNormal3f(_normals.at(objVertex.normalIndex.value()).x, _normals.at(objVertex.normalIndex.value()).y, _normals.at(objVertex.normalIndex.value()).z);
-                    if (objVertex.textureCoordinateIndex.has_value())
-                        glTexCoord2f(_texcoords.at(objVertex.textureCoordinateIndex.value()).u, _texcoords.at(objVertex.textureCoordinateIndex.value()).v);
+                uint32_t a = remaining[(i + m - 1) % m];
+                uint32_t b = remaining[i];
+                uint32_t c = remaining[(i + 1) % m];
+                if (cross2(flat[a], flat[b], flat[c]) * orientation <= 0.0f)
+                    continue;
 
-                    glm::vec3 vertex = glm::vec3(_vertices.at(objVertex.vertexIndex).x, _vertices.at(objVertex.vertexIndex).y, _vertices.at(objVertex.vertexIndex).z);
-                    glVertex3f(vertex.x, vertex.y, vertex.z);
+                // an ear has no other corner inside (or on the edges of) its triangle
+                bool ear = true;
+                for (size_t j = 0; j < m && ear; j++)
+                {
+                    uint32_t p = remaining[j];
+                    if (p == a || p == b || p == c || flat[p] == flat[a] || flat[p] == flat[b] || flat[p] == flat[c])
+                        continue;
+                    ear = !(cross2(flat[a], flat[b], flat[p]) * orientation >= 0.0f
+                        && cross2(flat[b], flat[c], flat[p]) * orientation >= 0.0f
+                        && cross2(flat[c], flat[a], flat[p]) * orientation >= 0.0f);
                 }
-                glEnd();
+                if (!ear)
+                    continue;
 
+                triangles.push_back(a);
+                triangles.push_back(b);
+                triangles.push_back(c);
+                remaining.erase(remaining.begin() + i);
+                clipped = true;
             }
-            glFlush();
+
+            // degenerate polygon (self intersecting, collinear corners...), fan whatever is left
+            if (!clipped)
+                break;
         }
+    }
 
-        glm::vec3 getCenterPoint()
-        {
-            float x = 0.0f;
-            float y = 0.0f;
-            float z = 0.0f;
+    for (size_t i = 1; i + 1 < remaining.size(); i++)
+    {
+        triangles.push_back(remaining[0]);
+        triangles.push_back(remaining[i]);
+        triangles.push_back(remaining[i + 1]);
+    }
+}
 
-            for (const auto &vertex: _vertices)
-            {
-                x += vertex.x;
-                y += vertex.y;
-                z += vertex.z;
-            }
+// Average number of vertex shader invocations per triangle with a FIFO post-transform cache of cacheSize entries (ACMR)
+float averageCacheMissRatio(const std::vector<GLuint> &indices, size_t verticesCount, size_t cacheSize = 32)
+{
+    if (indices.empty())
+        return 0.0f;
 
-            return glm::vec3(x / _vertices.size(), y / _vertices.size(), z / _vertices.size());
+    std::vector<size_t> insertedAt(verticesCount, SIZE_MAX);
+    size_t misses = 0;
+    for (GLuint v: indices)
+    {
+        if (insertedAt[v] == SIZE_MAX || misses - insertedAt[v] >= cacheSize)
+        {
+            insertedAt[v] = misses;
+            misses++;
         }
+    }
+    return float(misses) / (indices.size() / 3);
+}
 
-        void rotate(float angleXDeg, float angleYDeg, float angleZDeg)
-        {
-            glm::vec3 centerPoint = getCenterPoint();
+// Reorders triangles so that they reuse the vertices still in the post-transform cache
+// (Tom Forsyth's linear-speed vertex cache optimisation, https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html)
+void optimizeVertexCache(std::vector<GLuint> &indices, size_t verticesCount)
+{
+    const int cacheSize = 32;
+    const uint32_t maxValence = 32;
+    size_t trianglesCount = indices.size() / 3;
+    if (trianglesCount == 0)
+        return;
 
-            for (auto &vertex: _vertices)
-            {
-                glm::vec3 rotatedVertex = rotateVertex(vertex, centerPoint, angleXDeg, angleYDeg, angleZDeg);
-                vertex.x = rotatedVertex.x;
-                vertex.y = rotatedVertex.y;
-                vertex.z = rotatedVertex.z;
-            }
-        }
+    float cacheScores[cacheSize];
+    for (int i = 0; i < cacheSize; i++)
+        cacheScores[i] = i < 3 ? 0.75f : std::pow(1.0f - float(i - 3) / (cacheSize - 3), 1.5f);
+    float valenceScores[maxValence + 1];
+    valenceScores[0] = 0.0f;
+    for (uint32_t i = 1; i <= maxValence; i++)
+        valenceScores[i] = 2.0f / std::sqrt(float(i));
 
-        void translate(float x, float y, float z)
+    // Triangles using each vertex, the ones not emitted yet are kept first
+    std::vector<uint32_t> adjacencyOffsets(verticesCount + 1, 0);
+    for (GLuint index: indices)
+        adjacencyOffsets[index + 1]++;
+    for (size_t v = 0; v < verticesCount; v++)
+        adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> activeCount(verticesCount, 0);
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        GLuint v = indices[i];
+        adjacency[adjacencyOffsets[v] + activeCount[v]++] = i / 3;
+    }
+
+    std::vector<int> cachePosition(verticesCount, -1);
+    auto vertexScore = [&](GLuint v) {
+        if (activeCount[v] == 0)
+            return -1.0f;
+        float score = cachePosition[v] >= 0 ? cacheScores[cachePosition[v]] : 0.0f;
+        return score + valenceScores[std::min(activeCount[v], maxValence)];
+    };
+
+    std::vector<float> vertexScores(verticesCount);
+    for (size_t v = 0; v < verticesCount; v++)
+        vertexScores[v] = vertexScore(v);
+    std::vector<float> triangleScores(trianglesCount);
+    for (size_t t = 0; t < trianglesCount; t++)
+        triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+    std::vector<bool> emitted(trianglesCount, false);
+    std::vector<GLuint> output;
+    output.reserve(indices.size());
+    std::vector<GLuint> cache, nextCache;
+    size_t cursor = 0;
+    size_t best = std::max_element(triangleScores.begin(), triangleScores.end()) - triangleScores.begin();
+
+    while (output.size() < indices.size())
+    {
+        if (best == SIZE_MAX)
         {
-            for (auto &vertex: _vertices)
-            {
-                vertex.x += x;
-                vertex.y += y;
-                vertex.z += z;
-            }
+            // nothing left around the cache, continue at the next triangle in input order
+            while (emitted[cursor])
+                cursor++;
+            best = cursor;
         }
 
-        void scale(float factor)
+        emitted[best] = true;
+        nextCache.clear();
+        for (int k = 0; k < 3; k++)
         {
-            if (factor == 0.0f || _scale * factor < 0.01f || _scale * factor > 2.0f)
-                return;
-                
-            _scale *= factor;
-            glm::vec3 centerPoint = getCenterPoint();
+            GLuint v = indices[best * 3 + k];
+            output.push_back(v);
+            nextCache.push_back(v);
 
-            for (auto &vertex: _vertices)
+            uint32_t *triangles = &adjacency[adjacencyOffsets[v]];
+            for (uint32_t i = 0; i < activeCount[v]; i++)
             {
-                vertex.x = centerPoint.x + (vertex.x - centerPoint.x) * factor;
-                vertex.y = centerPoint.y + (vertex.y - centerPoint.y) * factor;
-                vertex.z = centerPoint.z + (vertex.z - centerPoint.z) * factor;
+                if (triangles[i] == best)
+                {
+                    std::swap(triangles[i], triangles[activeCount[v] - 1]);
+                    activeCount[v]--;
+                    break;
+                }
             }
         }
+        for (GLuint v: cache)
+            if (v != nextCache[0] && v != nextCache[1] && v != nextCache[2])
+                nextCache.push_back(v);
+        std::swap(cache, nextCache);
 
-        void center()
+        // Update the vertices that moved in (or fell out of) the cache, then pick the best triangle around them
+        for (size_t i = 0; i < cache.size(); i++)
         {
-            glm::vec3 centerPoint = getCenterPoint();
+            GLuint v = cache[i];
+            cachePosition[v] = i < (size_t)cacheSize ? (int)i : -1;
+            float score = vertexScore(v);
+            float delta = score - vertexScores[v];
+            vertexScores[v] = score;
+            for (uint32_t j = 0; j < activeCount[v]; j++)
+                triangleScores[adjacency[adjacencyOffsets[v] + j]] += delta;
+        }
+        if (cache.size() > (size_t)cacheSize)
+            cache.resize(cacheSize);
 
-            for (auto &vertex: _vertices)
+        best = SIZE_MAX;
+        float bestScore = -1.0f;
+        for (GLuint v: cache)
+        {
+            for (uint32_t j = 0; j < activeCount[v]; j++)
             {
-                vertex.x -= centerPoint.x;
-                vertex.y -= centerPoint.y;
-                vertex.z -= centerPoint.z;
+                uint32_t t = adjacency[adjacencyOffsets[v] + j];
+                if (triangleScores[t] > bestScore)
+                {
+                    bestScore = triangleScores[t];
+                    best = t;
+                }
             }
         }
+    }
 
-        // Make all vertices coordinates between -1 and 1
-        void normalize()
-        {
-            glm::vec3 centerPoint = getCenterPoint();
+    // the model is only an approximation of the hardware cache, keep the input order when it was already better
+    if (averageCacheMissRatio(output, verticesCount) < averageCacheMissRatio(indices, verticesCount))
+        indices = std::move(output);
+}
 
-            float max = 0.0f;
-            for (const auto &vertex: _vertices)
-            {
-                if (std::abs(vertex.x) > max)
-                    max = std::abs(vertex.x);
-                if (std::abs(vertex.y) > max)
-                    max = std::abs(vertex.y);
-                if (std::abs(vertex.z) > max)
-                    max = std::abs(vertex.z);
-            }
+// 4 float lanes: SSE2 and NEON are part of the x86_64 and arm64 baselines so they need no compiler flag,
+// other targets take the scalar paths
+#if defined(__SSE2__)
+#define HAS_FLOAT4 1
+typedef __m128 Float4;
+inline Float4 load4(const float *p) { return _mm_loadu_ps(p); }
+inline void store4(float *p, Float4 v) { _mm_storeu_ps(p, v); }
+inline Float4 splat4(float v) { return _mm_set1_ps(v); }
+inline Float4 add4(Float4 a, Float4 b) { return _mm_add_ps(a, b); }
+inline Float4 mul4(Float4 a, Float4 b) { return _mm_mul_ps(a, b); }
+inline Float4 min4(Float4 a, Float4 b) { return _mm_min_ps(a, b); }
+inline Float4 max4(Float4 a, Float4 b) { return _mm_max_ps(a, b); }
+#elif defined(__ARM_NEON)
+#define HAS_FLOAT4 1
+typedef float32x4_t Float4;
+inline Float4 load4(const float *p) { return vld1q_f32(p); }
+inline void store4(float *p, Float4 v) { vst1q_f32(p, v); }
+inline Float4 splat4(float v) { return vdupq_n_f32(v); }
+inline Float4 add4(Float4 a, Float4 b) { return vaddq_f32(a, b); }
+inline Float4 mul4(Float4 a, Float4 b) { return vmulq_f32(a, b); }
+inline Float4 min4(Float4 a, Float4 b) { return vminq_f32(a, b); }
+inline Float4 max4(Float4 a, Float4 b) { return vmaxq_f32(a, b); }
+#endif
 
-            for (auto &vertex: _vertices)
-            {
-                vertex.x = (vertex.x - centerPoint.x) / max;
-                vertex.y = (vertex.y - centerPoint.y) / max;
-                vertex.z = (vertex.z - centerPoint.z) / max;
-            }
-        }
+// Centroid and axis aligned bounding box of a set of points
+struct Bounds
+{
+    glm::vec3 center = glm::vec3(0.0f, 0.0f, 0.0f);
+    glm::vec3 min = glm::vec3(0.0f, 0.0f, 0.0f);
+    glm::vec3 max = glm::vec3(0.0f, 0.0f, 0.0f);
 };
 
+// Positions summed in float by each SIMD lane before being added to the double totals
+constexpr size_t BOUNDS_BLOCK = 4096;
 
-void usage()
+// Centroid and bounds of SoA positions in a single pass. Sums stay in float only for blocks of BOUNDS_BLOCK positions,
+// the totals are double so the centroid of millions of vertices does not drift like with one float accumulator
+Bounds computeBounds(const float *xs, const float *ys, const float *zs, size_t count)
 {
-    std::cerr << "fuck you and use a file.obj" << std::endl;
-}
+    Bounds bounds;
+    if (count == 0)
+        return bounds;
 
-int main(int argc, char** argv)
-{
-    if (argc < 2)
+    double sum[3] = {0.0, 0.0, 0.0};
+    float low[3] = {xs[0], ys[0], zs[0]};
+    float high[3] = {xs[0], ys[0], zs[0]};
+    size_t i = 0;
+
+#ifdef HAS_FLOAT4
+    size_t vectorCount = count & ~size_t(3);
+    if (vectorCount)
     {
-        usage();
-        return EXIT_FAILURE;
-    }
+        const float *streams[3] = {xs, ys, zs};
+        Float4 lowLanes[3], highLanes[3];
+        for (int axis = 0; axis < 3; axis++)
+            lowLanes[axis] = highLanes[axis] = splat4(streams[axis][0]);
 
-    // std::unique_ptr<ObjectFile[]> objs = std::make_unique<ObjectFile[]>(argc);
-    ObjectFile** objs = new ObjectFile*[argc];
-    // objs[0] = NULL;
+        while (i < vectorCount)
+        {
+            size_t blockEnd = std::min(vectorCount, i + BOUNDS_BLOCK);
+            Float4 sumX = splat4(0.0f), sumY = splat4(0.0f), sumZ = splat4(0.0f);
+            for (; i < blockEnd; i += 4)
+            {
+                Float4 x = load4(xs + i), y = load4(ys + i), z = load4(zs + i);
+                sumX = add4(sumX, x);
+                sumY = add4(sumY, y);
+                sumZ = add4(sumZ, z);
+                lowLanes[0] = min4(lowLanes[0], x);
+                lowLanes[1] = min4(lowLanes[1], y);
+                lowLanes[2] = min4(lowLanes[2], z);
+                highLanes[0] = max4(highLanes[0], x);
+                highLanes[1] = max4(highLanes[1], y);
+                highLanes[2] = max4(highLanes[2], z);
+            }
 
-    for (int i = 1; i < argc; i++)
-    {
-        std::string filename = argv[i];
+            Float4 sums[3] = {sumX, sumY, sumZ};
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float lanes[4];
+                store4(lanes, sums[axis]);
+                sum[axis] += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            }
+        }
 
-        // check if .obj
-        if (filename.length() < 4 || filename.substr(filename.length() - 4) != ".obj")
+        for (int axis = 0; axis < 3; axis++)
         {
-            usage();
-            return EXIT_FAILURE;
+            float lows[4], highs[4];
+            store4(lows, lowLanes[axis]);
+            store4(highs, highLanes[axis]);
+            low[axis] = std::min({lows[0], lows[1], lows[2], lows[3]});
+            high[axis] = std::max({highs[0], highs[1], highs[2], highs[3]});
         }
+    }
+#endif
 
-        try {
-            objs[i - 1] = new ObjectFile(filename.c_str());
-        } catch (std::exception &e) {
-            std::cerr << "Cannot parse file " << filename << ": " << e.what() << std::endl;
-            return EXIT_FAILURE;
+    for (; i < count; i++)
+    {
+        const float point[3] = {xs[i], ys[i], zs[i]};
+        for (int axis = 0; axis < 3; axis++)
+        {
+            sum[axis] += point[axis];
+            low[axis] = std::min(low[axis], point[axis]);
+            high[axis] = std::max(high[axis], point[axis]);
         }
     }
-    objs[argc - 1] = nullptr;
 
+    bounds.center = glm::vec3(sum[0] / count, sum[1] / count, sum[2] / count);
+    bounds.min = glm::vec3(low[0], low[1], low[2]);
+    bounds.max = glm::vec3(high[0], high[1], high[2]);
+    return bounds;
+}
 
-    // create window using glfw
-    GLFWwindow* window;
-    if (!glfwInit())
-        return -1;
+// One welded vertex as uploaded to the vertex buffer
+struct RenderVertex
+{
+    float position[3];
+    float normal[3];
+    float texcoord[2];
+};
 
+// out[i] gets the position of in[i] transformed by model and its normal by normalMatrix, texcoords are copied.
+// Both matrices are set up once for the whole range, they are column major like glm's
+void transformVertices(const glm::mat4 &model, const glm::mat3 &normalMatrix, const RenderVertex *in, RenderVertex *out, size_t count)
+{
+#ifdef HAS_FLOAT4
+    Float4 columns[4], normalColumns[3];
+    for (int c = 0; c < 4; c++)
+        columns[c] = load4(glm::value_ptr(model) + c * 4);
+    for (int c = 0; c < 3; c++)
+    {
+        float column[4] = {normalMatrix[c][0], normalMatrix[c][1], normalMatrix[c][2], 0.0f};
+        normalColumns[c] = load4(column);
+    }
 
-    window = glfwCreateWindow(640, 640, "Hello World", NULL, NULL);
-    if (!window)
+    // the members only hold 3 floats, the 4 lane stores go to lanes and the first 3 are copied out
+    float lanes[4];
+    for (size_t i = 0; i < count; i++)
     {
-        glfwTerminate();
-        return -1;
+        const RenderVertex &vertex = in[i];
+        Float4 position = add4(add4(mul4(columns[0], splat4(vertex.position[0])), mul4(columns[1], splat4(vertex.position[1]))),
+            add4(mul4(columns[2], splat4(vertex.position[2])), columns[3]));
+        Float4 normal = add4(add4(mul4(normalColumns[0], splat4(vertex.normal[0])), mul4(normalColumns[1], splat4(vertex.normal[1]))),
+            mul4(normalColumns[2], splat4(vertex.normal[2])));
+        store4(lanes, position);
+        std::memcpy(out[i].position, lanes, sizeof(out[i].position));
+        store4(lanes, normal);
+        std::memcpy(out[i].normal, lanes, sizeof(out[i].normal));
+        out[i].texcoord[0] = vertex.texcoord[0];
+        out[i].texcoord[1] = vertex.texcoord[1];
+    }
+#else
+    for (size_t i = 0; i < count; i++)
+    {
+        const RenderVertex &vertex = in[i];
+        glm::vec4 position = model * glm::vec4(vertex.position[0], vertex.position[1], vertex.position[2], 1.0f);
+        glm::vec3 normal = normalMatrix * glm::vec3(vertex.normal[0], vertex.normal[1], vertex.normal[2]);
+        out[i] = {{position.x, position.y, position.z}, {normal.x, normal.y, normal.z}, {vertex.texcoord[0], vertex.texcoord[1]}};
     }
+#endif
+}
 
-    glfwMakeContextCurrent(window);
-    glEnable(GL_DEPTH_TEST);
-    // lightning
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
-    glEnable(GL_COLOR_MATERIAL);
-    glEnable(GL_NORMALIZE);
-    glShadeModel(GL_SMOOTH);
-    
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 0.0f);
-    float specular = 0.0f;
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, &specular);
-    float ambient = 0.0f;
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, &ambient);
-    float diffuse = 0.0f;
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, &diffuse);
+// RenderVertex quantized for the compressed cache and the GPU, half its size: positions are 16 bit fractions of the box
+// of VertexQuantization, normals are octahedral and texture coordinates 16 bit fractions of their range
+struct PackedVertex
+{
+    uint16_t position[4]; // the last one is padding, the normal stays 4 bytes aligned
+    int16_t normal[2];
+    uint16_t texcoord[2];
+};
 
+// What the PackedVertex fractions are relative to, a value is min + fraction * scale
+struct VertexQuantization
+{
+    float positionMin[3] = {0.0f, 0.0f, 0.0f};
+    float positionScale[3] = {0.0f, 0.0f, 0.0f};
+    float texcoordMin[2] = {0.0f, 0.0f};
+    float texcoordScale[2] = {0.0f, 0.0f};
+};
 
-    glDepthFunc(GL_LESS);
+constexpr float QUANTIZED_UNORM_MAX = 65535.0f;
+constexpr float QUANTIZED_SNORM_MAX = 32767.0f;
 
-    glfwSetWindowUserPointer(window, objs);
+inline uint16_t quantizeFraction(float value, float min, float scale)
+{
+    float fraction = scale > 0.0f ? (value - min) / scale : 0.0f;
+    return (uint16_t)std::lround(std::min(std::max(fraction, 0.0f), 1.0f) * QUANTIZED_UNORM_MAX);
+}
 
+// Unit vector to a point of the [-1, 1] square, the octahedron |x| + |y| + |z| = 1 unfolded on the z = 0 plane
+// (https://jcgt.org/published/0003/02/01/). A null normal comes back as (0, 0, 1), the default one
+inline void encodeOctahedral(const float *normal, int16_t *out)
+{
+    float sum = std::abs(normal[0]) + std::abs(normal[1]) + std::abs(normal[2]);
+    float x = sum > 0.0f ? normal[0] / sum : 0.0f;
+    float y = sum > 0.0f ? normal[1] / sum : 0.0f;
+    if (normal[2] < 0.0f)
+    {
+        float foldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    out[0] = (int16_t)std::lround(x * QUANTIZED_SNORM_MAX);
+    out[1] = (int16_t)std::lround(y * QUANTIZED_SNORM_MAX);
+}
 
-    // hide cursor
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+// Same as octahedralDecode() in MESH_VERTEX_SHADER
+inline void decodeOctahedral(const int16_t *in, float *normal)
+{
+    float x = std::max(in[0] / QUANTIZED_SNORM_MAX, -1.0f);
+    float y = std::max(in[1] / QUANTIZED_SNORM_MAX, -1.0f);
+    float z = 1.0f - std::abs(x) - std::abs(y);
+    if (z < 0.0f)
+    {
+        float unfoldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float unfoldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = unfoldedX;
+        y = unfoldedY;
+    }
+    float length = std::sqrt(x * x + y * y + z * z);
+    normal[0] = x / length;
+    normal[1] = y / length;
+    normal[2] = z / length;
+}
+
+void packVertices(const RenderVertex *in, size_t count, const VertexQuantization &quantization, PackedVertex *out)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        for (int c = 0; c < 3; c++)
+            out[i].position[c] = quantizeFraction(in[i].position[c], quantization.positionMin[c], quantization.positionScale[c]);
+        out[i].position[3] = 0;
+        encodeOctahedral(in[i].normal, out[i].normal);
+        for (int c = 0; c < 2; c++)
+            out[i].texcoord[c] = quantizeFraction(in[i].texcoord[c], quantization.texcoordMin[c], quantization.texcoordScale[c]);
+    }
+}
+
+// For what still needs floats once loaded from a compressed cache: the fixed function pipeline and the CPU transform
+void unpackVertices(const PackedVertex *in, size_t count, const VertexQuantization &quantization, RenderVertex *out)
+{
+    float positionStep[3], texcoordStep[2];
+    for (int c = 0; c < 3; c++)
+        positionStep[c] = quantization.positionScale[c] / QUANTIZED_UNORM_MAX;
+    for (int c = 0; c < 2; c++)
+        texcoordStep[c] = quantization.texcoordScale[c] / QUANTIZED_UNORM_MAX;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        for (int c = 0; c < 3; c++)
+            out[i].position[c] = quantization.positionMin[c] + in[i].position[c] * positionStep[c];
+        decodeOctahedral(in[i].normal, out[i].normal);
+        for (int c = 0; c < 2; c++)
+            out[i].texcoord[c] = quantization.texcoordMin[c] + in[i].texcoord[c] * texcoordStep[c];
+    }
+}
+
+// Index buffers of the compressed cache: each index minus the previous one (small once the triangles are in vertex
+// cache order) is zigzag and LEB128 encoded, then those bytes are entropy coded with rANS (https://arxiv.org/abs/1311.2540).
+// The stream is an EncodedIndicesHeader, the frequencies of the 256 byte values then the rANS output
+constexpr uint32_t RANS_SCALE_BITS = 12; // the frequencies add up to 1 << RANS_SCALE_BITS
+constexpr uint32_t RANS_LOW = 1u << 23; // the state stays in [RANS_LOW, RANS_LOW << 8) between symbols
+
+struct EncodedIndicesHeader
+{
+    uint64_t indicesCount;
+    uint64_t bytesCount; // of the LEB128 stream
+    uint32_t state; // where the decoder starts
+    uint32_t reserved;
+};
+
+std::vector<uint8_t> encodeIndices(const GLuint *indices, size_t count)
+{
+    std::vector<uint8_t> bytes;
+    bytes.reserve(count * 2);
+    GLuint previous = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        int32_t delta = (int32_t)(indices[i] - previous);
+        uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+        previous = indices[i];
+        for (; zigzag >= 0x80; zigzag >>= 7)
+            bytes.push_back(uint8_t(zigzag | 0x80));
+        bytes.push_back(uint8_t(zigzag));
+    }
+
+    // every byte value that occurs keeps a frequency of at least 1, the rounding is taken from the most frequent ones
+    const uint32_t scale = 1u << RANS_SCALE_BITS;
+    uint32_t counts[256] = {};
+    for (uint8_t byte: bytes)
+        counts[byte]++;
+    uint16_t frequencies[256] = {};
+    uint32_t total = 0;
+    for (int s = 0; s < 256; s++)
+    {
+        if (counts[s])
+            frequencies[s] = std::max<uint64_t>(1, (uint64_t)counts[s] * scale / bytes.size());
+        total += frequencies[s];
+    }
+    while (!bytes.empty() && total != scale)
+    {
+        uint16_t &largest = *std::max_element(frequencies, frequencies + 256);
+        if (total < scale)
+        {
+            largest++;
+            total++;
+        }
+        else
+        {
+            largest--;
+            total--;
+        }
+    }
+    uint32_t starts[256];
+    for (uint32_t s = 0, start = 0; s < 256; start += frequencies[s++])
+        starts[s] = start;
+
+    // the decoder reads the symbols forwards, so they are encoded backwards and the output reversed
+    std::vector<uint8_t> coded;
+    uint32_t state = RANS_LOW;
+    for (size_t i = bytes.size(); i-- > 0; )
+    {
+        uint32_t frequency = frequencies[bytes[i]];
+        uint32_t limit = ((RANS_LOW >> RANS_SCALE_BITS) << 8) * frequency;
+        for (; state >= limit; state >>= 8)
+            coded.push_back(uint8_t(state));
+        state = ((state / frequency) << RANS_SCALE_BITS) + state % frequency + starts[bytes[i]];
+    }
+
+    EncodedIndicesHeader header = {count, bytes.size(), state, 0};
+    std::vector<uint8_t> encoded(sizeof(header) + sizeof(frequencies));
+    std::memcpy(encoded.data(), &header, sizeof(header));
+    std::memcpy(encoded.data() + sizeof(header), frequencies, sizeof(frequencies));
+    encoded.insert(encoded.end(), coded.rbegin(), coded.rend());
+    return encoded;
+}
+
+// false when data is not a stream of encodeIndices() or an index is not below verticesCount
+bool decodeIndices(std::string_view data, size_t verticesCount, std::vector<GLuint> &indices)
+{
+    EncodedIndicesHeader header;
+    uint16_t frequencies[256];
+    if (data.size() < sizeof(header) + sizeof(frequencies))
+        return false;
+    std::memcpy(&header, data.data(), sizeof(header));
+    std::memcpy(frequencies, data.data() + sizeof(header), sizeof(frequencies));
+    const uint8_t *in = reinterpret_cast<const uint8_t*>(data.data()) + sizeof(header) + sizeof(frequencies);
+    const uint8_t *inEnd = reinterpret_cast<const uint8_t*>(data.data()) + data.size();
+    // an index takes 1 to 5 bytes
+    if (header.bytesCount < header.indicesCount || header.bytesCount > header.indicesCount * 5)
+        return false;
+
+    const uint32_t scale = 1u << RANS_SCALE_BITS;
+    uint32_t starts[256];
+    uint8_t symbols[scale];
+    uint32_t total = 0;
+    for (uint32_t s = 0; s < 256; s++)
+    {
+        if (frequencies[s] > scale - total)
+            return false;
+        starts[s] = total;
+        std::memset(symbols + total, s, frequencies[s]);
+        total += frequencies[s];
+    }
+    if (header.bytesCount > 0 && total != scale)
+        return false;
+
+    indices.resize(header.indicesCount);
+    uint32_t state = header.state;
+    GLuint previous = 0;
+    uint32_t value = 0;
+    int shift = 0;
+    size_t decoded = 0;
+    for (uint64_t i = 0; i < header.bytesCount; i++)
+    {
+        uint32_t slot = state & (scale - 1);
+        uint8_t byte = symbols[slot];
+        state = frequencies[byte] * (state >> RANS_SCALE_BITS) + slot - starts[byte];
+        while (state < RANS_LOW)
+        {
+            if (in == inEnd)
+                return false;
+            state = state << 8 | *in++;
+        }
+
+        if (shift > 28)
+            return false;
+        value |= uint32_t(byte & 0x7f) << shift;
+        shift += 7;
+        if (byte & 0x80)
+            continue;
+        if (decoded == indices.size())
+            return false;
+        previous += (GLuint)((value >> 1) ^ (0u - (value & 1)));
+        if (previous >= verticesCount)
+            return false;
+        indices[decoded++] = previous;
+        value = 0;
+        shift = 0;
+    }
+    return decoded == indices.size() && shift == 0;
+}
+
+// Sum of squared distances to a set of planes, weighted by the area of the triangles they come from
+struct Quadric
+{
+    double xx = 0.0, xy = 0.0, xz = 0.0, xw = 0.0;
+    double yy = 0.0, yz = 0.0, yw = 0.0;
+    double zz = 0.0, zw = 0.0;
+    double ww = 0.0;
+    double weight = 0.0;
+
+    // Plane ax + by + cz + d = 0 with (a, b, c) normalized
+    void addPlane(double a, double b, double c, double d, double area)
+    {
+        xx += area * a * a; xy += area * a * b; xz += area * a * c; xw += area * a * d;
+        yy += area * b * b; yz += area * b * c; yw += area * b * d;
+        zz += area * c * c; zw += area * c * d;
+        ww += area * d * d;
+        weight += area;
+    }
+
+    void add(const Quadric &other)
+    {
+        xx += other.xx; xy += other.xy; xz += other.xz; xw += other.xw;
+        yy += other.yy; yz += other.yz; yw += other.yw;
+        zz += other.zz; zw += other.zw;
+        ww += other.ww;
+        weight += other.weight;
+    }
+
+    // Mean squared distance of p to the planes
+    double error(const float *p) const
+    {
+        double x = p[0], y = p[1], z = p[2];
+        double sum = xx * x * x + 2.0 * (xy * x * y + xz * x * z + xw * x) + yy * y * y + 2.0 * (yz * y * z + yw * y)
+            + zz * z * z + 2.0 * zw * z + ww;
+        return weight > 0.0 ? std::max(sum, 0.0) / weight : 0.0;
+    }
+};
+
+// Levels of detail below this many triangles are not worth it
+constexpr size_t LOD_MIN_TRIANGLES = 4096;
+constexpr size_t LOD_LEVELS = 4; // including the full mesh
+constexpr size_t LOD_REDUCTION = 4; // each level aims for a quarter of the triangles of the previous one
+// Coarsest allowed simplification error once projected on screen
+constexpr float LOD_MAX_PIXEL_ERROR = 0.5f;
+
+// Range of the index buffer drawing one level of detail, all levels share the vertex buffer
+struct LodLevel
+{
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float error; // in model units, see MeshSimplifier::error()
+    uint32_t rootNode; // of the cluster tree of the level, in ObjectFile::_clusterNodes
+};
+
+// In pixels, for picking the levels of detail. Queried once per frame rather than once per instance,
+// glGetIntegerv can wait for the GL driver
+int viewportHeight()
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    return viewport[3];
+}
+
+// No material, for the faces before the first usemtl and the meshes without any
+constexpr uint32_t NO_MATERIAL = UINT32_MAX;
+// Group of the elements before the first o/g, and of the o/g without a name
+constexpr const char *DEFAULT_GROUP = "default";
+// Smoothing group of the faces before the first s, only the crease angle keeps them from being smoothed together
+constexpr uint32_t SMOOTHING_UNSET = UINT32_MAX;
+
+// Range of the index buffer drawn with the same material, in the same sub-mesh. Each level of detail has its own ranges
+struct MaterialRange
+{
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    uint32_t material; // in ObjectFile::_materials, or NO_MATERIAL
+    uint32_t group; // in ObjectFile::_subMeshes
+};
+
+// Named o/g part of a mesh, its triangles are the material ranges of its group and its l records a range of the
+// line index buffer. Hidden sub-meshes and the ones out of the view are not drawn
+struct SubMesh
+{
+    uint32_t indexOffset = 0; // of level 0, in the index buffer
+    uint32_t indexCount = 0;
+    uint32_t lineOffset = 0; // in the line index buffer
+    uint32_t lineCount = 0;
+    float center[3] = {0.0f, 0.0f, 0.0f};
+    float radius = -1.0f; // negative when empty
+    uint32_t visible = 1;
+};
+
+// Quadric error metric edge collapse simplification (Garland and Heckbert 1997). Every vertex is collapsed onto one of its
+// neighbours instead of a new position, so the simplified indices keep using the original vertex buffer.
+// Vertices on open or non manifold edges (which includes the seams where the welder split vertices) never move,
+// so the levels are crack free. simplify() can be called again with lower targets to build coarser levels
+class MeshSimplifier
+{
+    public:
+        MeshSimplifier(const std::vector<GLuint> &indices, const RenderVertex *vertices, size_t verticesCount)
+            : _vertices(vertices), _indices(indices), _quadrics(verticesCount), _locked(verticesCount, false), _remap(verticesCount)
+        {
+            std::vector<uint64_t> edges;
+            for (size_t t = 0; t + 2 < indices.size(); t += 3)
+            {
+                glm::dvec3 p0 = position(indices[t]), p1 = position(indices[t + 1]), p2 = position(indices[t + 2]);
+                glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+                double length = glm::length(normal);
+                if (length > 0.0)
+                {
+                    normal /= length;
+                    for (int k = 0; k < 3; k++)
+                        _quadrics[indices[t + k]].addPlane(normal.x, normal.y, normal.z, -glm::dot(normal, p0), length * 0.5);
+                }
+
+                for (int k = 0; k < 3; k++)
+                {
+                    uint64_t a = indices[t + k], b = indices[t + (k + 1) % 3];
+                    edges.push_back(std::min(a, b) << 32 | std::max(a, b));
+                }
+            }
+
+            // manifold edges are shared by exactly two triangles
+            std::sort(edges.begin(), edges.end());
+            for (size_t i = 0; i < edges.size();)
+            {
+                size_t j = i;
+                while (j < edges.size() && edges[j] == edges[i])
+                    j++;
+                if (j - i != 2)
+                {
+                    _locked[edges[i] >> 32] = true;
+                    _locked[edges[i] & UINT32_MAX] = true;
+                }
+                i = j;
+            }
+        }
+
+        // Collapses edges by increasing error until at most targetTriangles are left or nothing can collapse anymore.
+        // Returns false when no edge could be collapsed
+        bool simplify(size_t targetTriangles)
+        {
+            bool collapsedAny = false;
+            while (_indices.size() / 3 > targetTriangles)
+            {
+                size_t collapses = collapsePass(targetTriangles);
+                if (collapses == 0)
+                    break;
+                collapsedAny = true;
+            }
+            return collapsedAny;
+        }
+
+        const std::vector<GLuint> &indices() const { return _indices; }
+
+        // Largest distance (square root of the mean squared distance to the original planes) among the collapses made
+        float error() const { return std::sqrt(_maxError); }
+
+    private:
+        struct Collapse
+        {
+            float cost;
+            GLuint from;
+            GLuint to;
+        };
+
+        const RenderVertex *_vertices;
+        std::vector<GLuint> _indices;
+        std::vector<Quadric> _quadrics;
+        std::vector<bool> _locked;
+        std::vector<GLuint> _remap;
+        double _maxError = 0.0;
+
+        glm::dvec3 position(GLuint v) const
+        {
+            return glm::dvec3(_vertices[v].position[0], _vertices[v].position[1], _vertices[v].position[2]);
+        }
+
+        // Moving from onto to must not flip, or make degenerate, the triangles that keep both
+        bool keepsOrientation(GLuint from, GLuint to, const uint32_t *triangles, uint32_t count) const
+        {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                const GLuint *corners = &_indices[triangles[i] * 3];
+                if (corners[0] == to || corners[1] == to || corners[2] == to)
+                    continue;
+
+                glm::dvec3 before[3], after[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    before[k] = position(corners[k]);
+                    after[k] = corners[k] == from ? position(to) : before[k];
+                }
+                glm::dvec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::dvec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                if (glm::dot(normalBefore, normalAfter) <= 0.25 * glm::length(normalBefore) * glm::length(normalAfter))
+                    return false;
+            }
+            return true;
+        }
+
+        // Costs are positive so their bits sort like them, a counting sort on the top 16 bits (within 1%) is close enough
+        static std::vector<Collapse> sortByCost(const std::vector<Collapse> &collapses)
+        {
+            std::vector<uint32_t> offsets((1 << 16) + 1, 0);
+            auto bucket = [](float cost) {
+                uint32_t bits;
+                std::memcpy(&bits, &cost, sizeof(bits));
+                return bits >> 16;
+            };
+            for (const Collapse &collapse: collapses)
+                offsets[bucket(collapse.cost) + 1]++;
+            for (size_t i = 1; i < offsets.size(); i++)
+                offsets[i] += offsets[i - 1];
+
+            std::vector<Collapse> sorted(collapses.size());
+            for (const Collapse &collapse: collapses)
+                sorted[offsets[bucket(collapse.cost)]++] = collapse;
+            return sorted;
+        }
+
+        // Collapses a set of independent edges (no two touch the same triangles) and rewrites the indices
+        size_t collapsePass(size_t targetTriangles)
+        {
+            size_t verticesCount = _quadrics.size();
+            size_t trianglesCount = _indices.size() / 3;
+
+            std::vector<uint32_t> offsets(verticesCount + 1, 0);
+            for (GLuint v: _indices)
+                offsets[v + 1]++;
+            for (size_t v = 0; v < verticesCount; v++)
+                offsets[v + 1] += offsets[v];
+            std::vector<uint32_t> adjacency(_indices.size());
+            {
+                std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+                for (size_t i = 0; i < _indices.size(); i++)
+                    adjacency[fill[_indices[i]]++] = i / 3;
+            }
+
+            // Each interior edge is seen from its two triangles, the one where it goes up is enough
+            std::vector<Collapse> collapses;
+            for (size_t i = 0; i < _indices.size(); i++)
+            {
+                GLuint a = _indices[i];
+                GLuint b = _indices[i - i % 3 + (i + 1) % 3];
+                if (a >= b || (_locked[a] && _locked[b]))
+                    continue;
+
+                Quadric merged = _quadrics[a];
+                merged.add(_quadrics[b]);
+                float costAB = _locked[a] ? HUGE_VALF : merged.error(_vertices[b].position);
+                float costBA = _locked[b] ? HUGE_VALF : merged.error(_vertices[a].position);
+                if (costAB <= costBA)
+                    collapses.push_back({costAB, a, b});
+                else
+                    collapses.push_back({costBA, b, a});
+            }
+            collapses = sortByCost(collapses);
+
+            // An interior collapse removes two triangles
+            std::vector<bool> touched(verticesCount, false);
+            for (size_t v = 0; v < verticesCount; v++)
+                _remap[v] = v;
+            size_t done = 0;
+            for (const Collapse &collapse: collapses)
+            {
+                if (trianglesCount <= targetTriangles + done * 2)
+                    break;
+                if (touched[collapse.from] || touched[collapse.to])
+                    continue;
+
+                const uint32_t *triangles = &adjacency[offsets[collapse.from]];
+                uint32_t count = offsets[collapse.from + 1] - offsets[collapse.from];
+                if (!keepsOrientation(collapse.from, collapse.to, triangles, count))
+                    continue;
+
+                // everything around from changes, nothing there can collapse again in this pass
+                for (uint32_t i = 0; i < count; i++)
+                    for (int k = 0; k < 3; k++)
+                        touched[_indices[triangles[i] * 3 + k]] = true;
+                touched[collapse.to] = true;
+
+                _remap[collapse.from] = collapse.to;
+                _quadrics[collapse.to].add(_quadrics[collapse.from]);
+                _maxError = std::max(_maxError, (double)collapse.cost);
+                done++;
+            }
+            if (done == 0)
+                return 0;
+
+            size_t kept = 0;
+            for (size_t t = 0; t < trianglesCount; t++)
+            {
+                GLuint a = _remap[_indices[t * 3]], b = _remap[_indices[t * 3 + 1]], c = _remap[_indices[t * 3 + 2]];
+                if (a == b || b == c || c == a)
+                    continue;
+                _indices[kept++] = a;
+                _indices[kept++] = b;
+                _indices[kept++] = c;
+            }
+            _indices.resize(kept);
+            return done;
+        }
+};
+
+// Triangles per cluster: small enough to cull a good part of a zoomed in mesh, large enough to keep the tree walk
+// and the number of ranges drawn low
+constexpr size_t CLUSTER_TRIANGLES = 128;
+// Cone cutoff of clusters whose normals are too spread to ever be all back facing
+constexpr float CONE_NEVER_CULLED = 2.0f;
+
+// Triangles contiguous in the index buffer, culled as a whole
+struct MeshCluster
+{
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float center[3]; // bounding sphere
+    float radius;
+    float coneAxis[3]; // every triangle normal is within the cone around coneAxis,
+    float coneCutoff;  // whose half angle has this sine
+};
+
+// Bounding volume hierarchy over the clusters of a level of detail, stored depth first: the children of a node follow it,
+// and its subtree covers the clusters firstCluster to firstCluster + clustersCount - 1, so the index range of a whole
+// subtree is contiguous too
+struct ClusterNode
+{
+    float center[3]; // bounding sphere
+    float radius;
+    uint32_t firstCluster;
+    uint32_t clustersCount;
+    uint32_t skip; // next node once this subtree is done with (or culled)
+    uint32_t reserved;
+};
+
+// What the cluster tree walk leaves out. Back faces are only hidden for closed meshes whose faces are wound the same way,
+// so culling them is opt-in, and also turns on GL_CULL_FACE for the triangles of the clusters that are kept
+struct CullingOptions
+{
+    bool frustum = true;
+    bool backfaces = false;
+};
+
+// Grows the sphere (center, radius) to contain the other one
+void mergeSpheres(float *center, float &radius, const float *otherCenter, float otherRadius)
+{
+    glm::vec3 a(center[0], center[1], center[2]);
+    glm::vec3 b(otherCenter[0], otherCenter[1], otherCenter[2]);
+    float distance = glm::length(b - a);
+    if (distance + otherRadius <= radius)
+        return;
+    if (distance + radius <= otherRadius)
+    {
+        std::memcpy(center, otherCenter, 3 * sizeof(float));
+        radius = otherRadius;
+        return;
+    }
+
+    float merged = (distance + radius + otherRadius) * 0.5f;
+    glm::vec3 c = a + (b - a) * ((merged - radius) / distance);
+    center[0] = c.x;
+    center[1] = c.y;
+    center[2] = c.z;
+    radius = merged;
+}
+
+// Splits the triangles of indices in clusters of at most CLUSTER_TRIANGLES, cutting the longest axis of their centroids
+// around the median, and reorders indices so that every cluster is a contiguous range. Triangles keep their relative order
+// on each side of a cut, so the vertex cache order mostly survives. cuts (increasing triangle numbers) are cut first and
+// triangles never move across them, which keeps the material ranges whole (see ObjectFile::groupTriangles()).
+// indexBase is where indices starts in the index buffer. The clusters and nodes are appended, returns the root node
+uint32_t buildClusterTree(std::vector<GLuint> &indices, size_t indexBase, const RenderVertex *vertices,
+    std::vector<MeshCluster> &clusters, std::vector<ClusterNode> &nodes, const std::vector<size_t> &cuts = {})
+{
+    size_t trianglesCount = indices.size() / 3;
+    auto position = [&](GLuint v) {
+        return glm::vec3(vertices[v].position[0], vertices[v].position[1], vertices[v].position[2]);
+    };
+
+    std::vector<glm::vec3> centroids(trianglesCount);
+    for (size_t t = 0; t < trianglesCount; t++)
+        centroids[t] = (position(indices[t * 3]) + position(indices[t * 3 + 1]) + position(indices[t * 3 + 2])) / 3.0f;
+
+    std::vector<uint32_t> order(trianglesCount);
+    for (size_t t = 0; t < trianglesCount; t++)
+        order[t] = t;
+    std::vector<uint32_t> sorted;
+    std::vector<bool> left(trianglesCount);
+
+    auto addCluster = [&](size_t begin, size_t end) {
+        MeshCluster cluster = {};
+        cluster.indexOffset = indexBase + begin * 3;
+        cluster.indexCount = (end - begin) * 3;
+
+        glm::vec3 min(INFINITY), max(-INFINITY);
+        glm::vec3 normalsSum(0.0f);
+        std::vector<glm::vec3> normals;
+        for (size_t i = begin; i < end; i++)
+        {
+            const GLuint *triangle = &indices[order[i] * 3];
+            glm::vec3 p0 = position(triangle[0]), p1 = position(triangle[1]), p2 = position(triangle[2]);
+            for (const glm::vec3 &p: {p0, p1, p2})
+            {
+                min = glm::min(min, p);
+                max = glm::max(max, p);
+            }
+
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float length = glm::length(normal);
+            if (length > 0.0f)
+            {
+                normals.push_back(normal / length);
+                normalsSum += normals.back();
+            }
+        }
+
+        glm::vec3 center = (min + max) * 0.5f;
+        float radius = 0.0f;
+        for (size_t i = begin; i < end; i++)
+            for (int k = 0; k < 3; k++)
+                radius = std::max(radius, glm::length(position(indices[order[i] * 3 + k]) - center));
+
+        // degenerate triangles are never rasterized, they can be left out of the cone
+        cluster.coneCutoff = CONE_NEVER_CULLED;
+        float sumLength = glm::length(normalsSum);
+        glm::vec3 axis = sumLength > 0.0f ? normalsSum / sumLength : glm::vec3(0.0f, 0.0f, 1.0f);
+        if (sumLength > 0.0f)
+        {
+            float minDot = 1.0f;
+            for (const glm::vec3 &normal: normals)
+                minDot = std::min(minDot, glm::dot(axis, normal));
+            if (minDot > 0.0f)
+                cluster.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+        }
+
+        for (int k = 0; k < 3; k++)
+        {
+            cluster.center[k] = center[k];
+            cluster.coneAxis[k] = axis[k];
+        }
+        cluster.radius = radius;
+        clusters.push_back(cluster);
+    };
+
+    std::function<void(size_t, size_t)> build = [&](size_t begin, size_t end) {
+        size_t node = nodes.size();
+        nodes.push_back(ClusterNode{});
+        nodes[node].firstCluster = clusters.size();
+
+        auto firstCut = std::upper_bound(cuts.begin(), cuts.end(), begin);
+        auto lastCut = std::lower_bound(firstCut, cuts.end(), end);
+        if (firstCut != lastCut)
+        {
+            // the cut nearest to the middle keeps the tree balanced
+            size_t half = begin + (end - begin) / 2;
+            auto cut = std::lower_bound(firstCut, lastCut, half);
+            if (cut == lastCut || (cut != firstCut && half - *(cut - 1) < *cut - half))
+                cut--;
+            size_t middle = *cut;
+            build(begin, middle);
+            build(middle, end);
+        }
+        else if (end - begin <= CLUSTER_TRIANGLES)
+        {
+            if (end > begin)
+                addCluster(begin, end);
+        }
+        else
+        {
+            glm::vec3 min(INFINITY), max(-INFINITY);
+            for (size_t i = begin; i < end; i++)
+            {
+                min = glm::min(min, centroids[order[i]]);
+                max = glm::max(max, centroids[order[i]]);
+            }
+            glm::vec3 extent = max - min;
+            int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+            // whole clusters on the left, so that they all get CLUSTER_TRIANGLES but the last one
+            size_t leaves = (end - begin + CLUSTER_TRIANGLES - 1) / CLUSTER_TRIANGLES;
+            size_t middle = begin + leaves / 2 * CLUSTER_TRIANGLES;
+            sorted.assign(order.begin() + begin, order.begin() + end);
+            std::nth_element(sorted.begin(), sorted.begin() + (middle - begin), sorted.end(), [&](uint32_t a, uint32_t b) {
+                return centroids[a][axis] < centroids[b][axis];
+            });
+            for (size_t i = 0; i < sorted.size(); i++)
+                left[sorted[i]] = i < middle - begin;
+            std::stable_partition(order.begin() + begin, order.begin() + end, [&](uint32_t t) { return left[t]; });
+
+            build(begin, middle);
+            build(middle, end);
+        }
+
+        ClusterNode &current = nodes[node];
+        current.clustersCount = clusters.size() - current.firstCluster;
+        current.skip = nodes.size();
+        if (current.clustersCount > 0)
+        {
+            const MeshCluster &first = clusters[current.firstCluster];
+            std::memcpy(current.center, first.center, sizeof(current.center));
+            current.radius = first.radius;
+            for (uint32_t c = 1; c < current.clustersCount; c++)
+                mergeSpheres(current.center, current.radius, clusters[current.firstCluster + c].center, clusters[current.firstCluster + c].radius);
+        }
+    };
+
+    uint32_t root = nodes.size();
+    size_t firstCluster = clusters.size();
+    build(0, trianglesCount);
+
+    std::vector<GLuint> reordered(indices.size());
+    for (size_t i = 0; i < trianglesCount; i++)
+        std::memcpy(&reordered[i * 3], &indices[order[i] * 3], 3 * sizeof(GLuint));
+    indices = std::move(reordered);
+
+    // The cuts break up the strips of the vertex cache order, optimize it again inside every cluster,
+    // on local indices so that it only costs the size of the cluster
+    std::vector<GLuint> local, clusterVertices;
+    for (size_t c = firstCluster; c < clusters.size(); c++)
+    {
+        auto first = indices.begin() + (clusters[c].indexOffset - indexBase);
+        local.assign(first, first + clusters[c].indexCount);
+        clusterVertices = local;
+        std::sort(clusterVertices.begin(), clusterVertices.end());
+        clusterVertices.erase(std::unique(clusterVertices.begin(), clusterVertices.end()), clusterVertices.end());
+        for (GLuint &v: local)
+            v = std::lower_bound(clusterVertices.begin(), clusterVertices.end(), v) - clusterVertices.begin();
+
+        optimizeVertexCache(local, clusterVertices.size());
+        for (size_t i = 0; i < local.size(); i++)
+            first[i] = clusterVertices[local[i]];
+    }
+    return root;
+}
+
+// split("a/b/c//d", '/') -> {"a", "b", "c", "", "d"}
+std::vector<std::string> split(const std::string& s, char delimiter)
+{
+    std::vector<std::string> tokens;
+    std::string token;
+    std::istringstream tokenStream(s);
+    while (std::getline(tokenStream, token, delimiter))
+        tokens.push_back(token);
+    return tokens;
+}
+
+// Separates the tokens of a line for both loaders, a CRLF file leaves a '\r' at the end of its lines
+inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// nextToken("  vt 0.5 1", pos = 0) -> "vt", pos is left right after the token
+std::string_view nextToken(std::string_view line, size_t &pos)
+{
+    while (pos < line.size() && isBlank(line[pos]))
+        pos++;
+    size_t start = pos;
+    while (pos < line.size() && !isBlank(line[pos]))
+        pos++;
+    return line.substr(start, pos - start);
+}
+
+// split_on_blanks("f 1\t2  3 \r") -> {"f", "1", "2", "3"}
+std::vector<std::string> split_on_blanks(const std::string& s)
+{
+    std::vector<std::string> tokens;
+    size_t pos = 0;
+    for (std::string_view token = nextToken(s, pos); !token.empty(); token = nextToken(s, pos))
+        tokens.emplace_back(token);
+    return tokens;
+}
+
+// The keyword of a line is its first token and must start the line, for both loaders: leading blanks are kept in it
+// so that "  v 1 2 3" is the unknown token "  v". keywordEnd("vt 0.5 1") -> 2
+inline size_t keywordEnd(std::string_view line)
+{
+    size_t pos = 0;
+    while (pos < line.size() && isBlank(line[pos]))
+        pos++;
+    while (pos < line.size() && !isBlank(line[pos]))
+        pos++;
+    return pos;
+}
+
+// startsWithKeyword("v\t1 2 3", "v") -> true, the keyword must be the whole first token ("vtx 1" is not a vt line)
+inline bool startsWithKeyword(std::string_view line, std::string_view keyword)
+{
+    return keywordEnd(line) == keyword.size() && line.substr(0, keyword.size()) == keyword;
+}
+
+// Why a line was rejected, the message itself is only built by ParseFailure::message() once it is reported
+enum class ParseError : uint8_t
+{
+    None,
+    InvalidVertex,
+    InvalidVertexValues,
+    InvalidTextureCoordinate,
+    InvalidTextureCoordinateValues,
+    InvalidNormal,
+    InvalidNormalValues,
+    InvalidParameterSpaceVertex,
+    InvalidParameterSpaceVertexValues,
+    InvalidFace,
+    InvalidFaceValues,
+    InvalidLine,
+    InvalidLineValues,
+    InvalidSmoothingGroup,
+    UnknownToken,
+    VertexIndexOutOfBounds,
+    TextureCoordinateIndexOutOfBounds,
+    NormalIndexOutOfBounds,
+};
+
+// The value parsed out of a line, or why there is none (value is then T{})
+template <typename T>
+struct ParseResult
+{
+    T value{};
+    ParseError error = ParseError::None;
+
+    ParseResult(const T &value): value(value) {}
+    ParseResult(ParseError error): error(error) {}
+
+    explicit operator bool() const { return error == ParseError::None; }
+};
+
+// First rejected line of a file (or of a chunk of it). text is the line, or the token for UnknownToken,
+// and points into the parsed data so it must not outlive it
+struct ParseFailure
+{
+    ParseError error = ParseError::None;
+    size_t lineNum = 0;
+    std::string_view text;
+
+    explicit operator bool() const { return error != ParseError::None; }
+
+    std::string message() const
+    {
+        std::string line(text);
+        switch (error)
+        {
+            case ParseError::None: return "no error";
+            case ParseError::InvalidVertex: return "Invalid vertex line: " + line;
+            case ParseError::InvalidVertexValues: return "Invalid vertex line (invalid values): " + line;
+            case ParseError::InvalidTextureCoordinate: return "Invalid texture coordinate line: " + line;
+            case ParseError::InvalidTextureCoordinateValues: return "Invalid texture coordinate line (invalid values): " + line;
+            case ParseError::InvalidNormal: return "Invalid normal line: " + line;
+            case ParseError::InvalidNormalValues: return "Invalid normal line (invalid values): " + line;
+            case ParseError::InvalidParameterSpaceVertex: return "Invalid parameter space vertex line: " + line;
+            case ParseError::InvalidParameterSpaceVertexValues: return "Invalid parameter space vertex line (invalid values): " + line;
+            case ParseError::InvalidFace: return "Invalid face line: " + line;
+            case ParseError::InvalidFaceValues: return "Invalid face line (invalid values): " + line;
+            case ParseError::InvalidLine: return "Invalid line element: " + line;
+            case ParseError::InvalidLineValues: return "Invalid line element (invalid values): " + line;
+            case ParseError::InvalidSmoothingGroup: return "Invalid smoothing group line: " + line;
+            case ParseError::UnknownToken: return "unknown token " + line + " on line " + std::to_string(lineNum);
+            case ParseError::VertexIndexOutOfBounds: return "line " + std::to_string(lineNum) + " is invalid (vertex index out of bounds)";
+            case ParseError::TextureCoordinateIndexOutOfBounds: return "line " + std::to_string(lineNum) + " is invalid (texture coordinate index out of bounds)";
+            case ParseError::NormalIndexOutOfBounds: return "line " + std::to_string(lineNum) + " is invalid (normal index out of bounds)";
+        }
+        return "unknown error";
+    }
+};
+
+// The failure on the earlier line, any failure comes before none
+inline ParseFailure firstFailure(const ParseFailure &a, const ParseFailure &b)
+{
+    if (!a || (b && b.lineNum < a.lineNum))
+        return b;
+    return a;
+}
+
+// std::stod and std::stoi without the exceptions: the whole token must be a number that fits, like parseNumber()
+bool toDouble(const std::string &token, double &value)
+{
+    char *end;
+    errno = 0;
+    value = std::strtod(token.c_str(), &end);
+    return !token.empty() && end == token.c_str() + token.size() && errno != ERANGE;
+}
+
+bool toInt(const std::string &token, int &value)
+{
+    char *end;
+    errno = 0;
+    long result = std::strtol(token.c_str(), &end, 10);
+    if (token.empty() || end != token.c_str() + token.size() || errno == ERANGE || result < INT_MIN || result > INT_MAX)
+        return false;
+    value = result;
+    return true;
+}
+
+ParseResult<ObjVertex> parseVertex(const std::string &line)
+{
+    auto tokens = split_on_blanks(line);
+
+    if (tokens.size() < 4 || tokens.size() > 5 || tokens.at(0) != "v")
+        return ParseError::InvalidVertex;
+
+    ObjVertex vertex;
+    if (!toDouble(tokens.at(1), vertex.x) || !toDouble(tokens.at(2), vertex.y) || !toDouble(tokens.at(3), vertex.z)
+        || (tokens.size() >= 5 && !toDouble(tokens.at(4), vertex.w)))
+        return ParseError::InvalidVertexValues;
+
+    return vertex;
+}
+
+ParseResult<ObjTextureCoordinate> parseTextureCoordinate(const std::string &line)
+{
+    auto tokens = split_on_blanks(line);
+
+    if (tokens.size() < 2 || tokens.size() > 4 || tokens.at(0) != "vt")
+        return ParseError::InvalidTextureCoordinate;
+
+    ObjTextureCoordinate textureCoordinate;
+    if (!toDouble(tokens.at(1), textureCoordinate.u)
+        || (tokens.size() >= 3 && !toDouble(tokens.at(2), textureCoordinate.v))
+        || (tokens.size() >= 4 && !toDouble(tokens.at(3), textureCoordinate.w)))
+        return ParseError::InvalidTextureCoordinateValues;
+
+    return textureCoordinate;
+}
+
+ParseResult<ObjNormal> parseNormal(const std::string &line)
+{
+    auto tokens = split_on_blanks(line);
+
+    if (tokens.size() != 4 || tokens.at(0) != "vn")
+        return ParseError::InvalidNormal;
+
+    ObjNormal normal;
+    if (!toDouble(tokens.at(1), normal.x) || !toDouble(tokens.at(2), normal.y) || !toDouble(tokens.at(3), normal.z))
+        return ParseError::InvalidNormalValues;
+
+    return normal;
+}
+
+ParseResult<ObjParameterSpaceVertex> parseParameterSpaceVertex(const std::string &line)
+{
+    auto tokens = split_on_blanks(line);
+
+    if (tokens.size() < 2 || tokens.size() > 4 || tokens.at(0) != "vp")
+        return ParseError::InvalidParameterSpaceVertex;
+
+    ObjParameterSpaceVertex parameterSpaceVertex;
+    if (!toDouble(tokens.at(1), parameterSpaceVertex.u)
+        || (tokens.size() >= 3 && !toDouble(tokens.at(2), parameterSpaceVertex.v))
+        || (tokens.size() >= 4 && !toDouble(tokens.at(3), parameterSpaceVertex.w)))
+        return ParseError::InvalidParameterSpaceVertexValues;
+
+    return parameterSpaceVertex;
+}
+
+ParseResult<ObjFace> parseFace(const std::string &line)
+{
+    auto tokens = split_on_blanks(line);
+
+    if (tokens.size() < 4 || tokens.at(0) != "f")
+        return ParseError::InvalidFace;
+
+    ObjFace face;
+    for (size_t i = 1; i < tokens.size(); i++)
+    {
+        auto subtokens = split(tokens.at(i), '/');
+        if (subtokens.size() < 1 || subtokens.size() > 3)
+            return ParseError::InvalidFace;
+
+        ObjFace::Vertex vertex;
+        int index;
+        if (!toInt(subtokens.at(0), vertex.vertexIndex))
+            return ParseError::InvalidFaceValues;
+        // vertex normal without texture coordinate is f v1//vn1
+        if (subtokens.size() >= 2 && subtokens.at(1) != "")
+        {
+            if (!toInt(subtokens.at(1), index))
+                return ParseError::InvalidFaceValues;
+            vertex.textureCoordinateIndex = index;
+        }
+        if (subtokens.size() >= 3)
+        {
+            if (!toInt(subtokens.at(2), index))
+                return ParseError::InvalidFaceValues;
+            vertex.normalIndex = index;
+        }
+
+        face.vertices.push_back(std::move(vertex));
+    }
+
+    return face;
+}
+
+ParseResult<ObjLine> parseLine(const std::string &line)
+{
+    auto tokens = split_on_blanks(line);
+
+    if (tokens.size() < 3 || tokens.at(0) != "l")
+        return ParseError::InvalidLine;
+
+    ObjLine objLine;
+    for (size_t i = 1; i < tokens.size(); i++)
+    {
+        // v or v/vt
+        auto subtokens = split(tokens.at(i), '/');
+        if (subtokens.size() < 1 || subtokens.size() > 2)
+            return ParseError::InvalidLine;
+
+        int index, textureCoordinateIndex;
+        if (!toInt(subtokens.at(0), index) || (subtokens.size() == 2 && !toInt(subtokens.at(1), textureCoordinateIndex)))
+            return ParseError::InvalidLineValues;
+        objLine.vertexIndices.push_back(index);
+    }
+
+    return objLine;
+}
+
+// Fast path tokenizer, works in place on a line of a mapped file with nextToken() and allocates nothing
+// (errors are codes, the message is only built if the load fails)
+
+// restOfLine("usemtl  red wood \r", pos = 6) -> "red wood", names may have blanks in them
+std::string_view restOfLine(std::string_view line, size_t pos)
+{
+    while (pos < line.size() && isBlank(line[pos]))
+        pos++;
+    size_t end = line.size();
+    while (end > pos && isBlank(line[end - 1]))
+        end--;
+    return line.substr(pos, end - pos);
+}
+
+// The whole token must be a number, std::from_chars does not accept a leading '+' so skip it (but not in "+-1",
+// which strtod rejects too)
+template <typename T>
+bool parseNumber(std::string_view token, T &value)
+{
+    const char *first = token.data();
+    const char *last = token.data() + token.size();
+    if (first != last && *first == '+')
+        first++;
+    if (first == last || (first != token.data() && *first == '-'))
+        return false;
+    auto [ptr, ec] = std::from_chars(first, last, value);
+    return ec == std::errc() && ptr == last;
+}
+
+// Parses up to maxValues numbers after pos, returns the number of tokens found (which may be more than maxValues).
+// valid is false if one of the parsed ones is not a number, which only matters once the count is right: the
+// getline loader checks the count first
+int scanNumbers(std::string_view line, size_t pos, double *values, int maxValues, bool &valid)
+{
+    int count = 0;
+    valid = true;
+    for (std::string_view token = nextToken(line, pos); !token.empty(); token = nextToken(line, pos))
+    {
+        if (count < maxValues && valid && !parseNumber(token, values[count]))
+            valid = false;
+        count++;
+    }
+    return count;
+}
+
+ParseResult<ObjVertex> scanVertex(std::string_view line, size_t pos)
+{
+    double values[4] = {0.0, 0.0, 0.0, 1.0};
+    bool valid;
+    int count = scanNumbers(line, pos, values, 4, valid);
+
+    if (count < 3 || count > 4)
+        return ParseError::InvalidVertex;
+    if (!valid)
+        return ParseError::InvalidVertexValues;
+
+    return ObjVertex{values[0], values[1], values[2], values[3]};
+}
+
+ParseResult<ObjTextureCoordinate> scanTextureCoordinate(std::string_view line, size_t pos)
+{
+    double values[3] = {0.0, 0.0, 0.0};
+    bool valid;
+    int count = scanNumbers(line, pos, values, 3, valid);
+
+    if (count < 1 || count > 3)
+        return ParseError::InvalidTextureCoordinate;
+    if (!valid)
+        return ParseError::InvalidTextureCoordinateValues;
+
+    return ObjTextureCoordinate{values[0], values[1], values[2]};
+}
+
+ParseResult<ObjNormal> scanNormal(std::string_view line, size_t pos)
+{
+    double values[3];
+    bool valid;
+    int count = scanNumbers(line, pos, values, 3, valid);
+
+    if (count != 3)
+        return ParseError::InvalidNormal;
+    if (!valid)
+        return ParseError::InvalidNormalValues;
+
+    return ObjNormal{values[0], values[1], values[2]};
+}
+
+ParseResult<ObjParameterSpaceVertex> scanParameterSpaceVertex(std::string_view line, size_t pos)
+{
+    double values[3] = {0.0, 0.0, 1.0};
+    bool valid;
+    int count = scanNumbers(line, pos, values, 3, valid);
+
+    if (count < 1 || count > 3)
+        return ParseError::InvalidParameterSpaceVertex;
+    if (!valid)
+        return ParseError::InvalidParameterSpaceVertexValues;
+
+    return ObjParameterSpaceVertex{values[0], values[1], values[2]};
+}
+
+// Same forms as parseFace: v, v/vt, v//vn and v/vt/vn, the indices are stored as in ObjRawFaces
+bool scanFaceVertex(std::string_view token, int32_t &vertexIndex, int32_t &texcoordIndex, int32_t &normalIndex)
+{
+    int index;
+    size_t firstSlash = token.find('/');
+    if (!parseNumber(token.substr(0, firstSlash), index))
+        return false;
+    vertexIndex = rawIndex(index);
+    if (firstSlash == std::string_view::npos)
+        return true;
+
+    std::string_view rest = token.substr(firstSlash + 1);
+    size_t secondSlash = rest.find('/');
+    std::string_view texcoord = rest.substr(0, secondSlash);
+    if (!texcoord.empty())
+    {
+        if (!parseNumber(texcoord, index))
+            return false;
+        texcoordIndex = rawIndex(index);
+    }
+    if (secondSlash == std::string_view::npos)
+        return true;
+
+    std::string_view normal = rest.substr(secondSlash + 1);
+    if (!normal.empty())
+    {
+        if (!parseNumber(normal, index))
+            return false;
+        normalIndex = rawIndex(index);
+    }
+    return true;
+}
+
+// The corners are added as they are read, a rejected face takes them back out. Like parseFace(), too few corners
+// is reported before invalid values
+ParseError scanFace(std::string_view line, size_t pos, ObjRawFaces &faces)
+{
+    bool hadTexcoords = faces.hasTexcoords();
+    bool hadNormals = faces.hasNormals();
+    ParseError error = ParseError::None;
+    size_t count = 0;
+    for (std::string_view token = nextToken(line, pos); !token.empty(); token = nextToken(line, pos), count++)
+    {
+        if (error != ParseError::None)
+            continue;
+        int32_t vertexIndex, texcoordIndex = 0, normalIndex = 0;
+        if (!scanFaceVertex(token, vertexIndex, texcoordIndex, normalIndex))
+            error = ParseError::InvalidFaceValues;
+        else
+            faces.addCorner(vertexIndex, texcoordIndex, normalIndex);
+    }
+
+    if (count < 3)
+        error = ParseError::InvalidFace;
+    if (error != ParseError::None)
+    {
+        faces.discardFace(hadTexcoords, hadNormals);
+        return error;
+    }
+    faces.endFace();
+    return ParseError::None;
+}
+
+// l, like scanFace() with at least two corners and no normals. Errors are the ones of parseLine(), which checks
+// the number of vertices before their values
+ParseError scanLineElement(std::string_view line, size_t pos, ObjRawFaces &lines)
+{
+    ParseError error = ParseError::None;
+    size_t count = 0;
+    for (std::string_view token = nextToken(line, pos); !token.empty(); token = nextToken(line, pos), count++)
+    {
+        if (error != ParseError::None)
+            continue;
+        int32_t vertexIndex, texcoordIndex = 0, normalIndex = 0;
+        if (std::count(token.begin(), token.end(), '/') > 1)
+            error = ParseError::InvalidLine;
+        else if (!scanFaceVertex(token, vertexIndex, texcoordIndex, normalIndex) || (token.back() == '/' && token.size() > 1))
+            error = ParseError::InvalidLineValues;
+        else
+            lines.addCorner(vertexIndex, 0, 0);
+    }
+
+    if (count < 2)
+        error = ParseError::InvalidLine;
+    if (error != ParseError::None)
+    {
+        lines.discardFace(false, false);
+        return error;
+    }
+    lines.endFace();
+    return ParseError::None;
+}
+
+// s: "off" and 0 turn smoothing off, the faces of any other group are only smoothed with the faces of the same group
+bool scanSmoothingGroup(std::string_view line, size_t pos, uint32_t &group)
+{
+    std::string_view token = nextToken(line, pos);
+    if (!nextToken(line, pos).empty())
+        return false;
+    if (token == "off")
+    {
+        group = 0;
+        return true;
+    }
+    return parseNumber(token, group);
+}
+
+// A newline aligned part of a mapped file and what was parsed out of it, face indices are
+// kept as written in the file until the chunks are stitched back together
+struct ObjChunk
+{
+    // v/vt/vn seen in the chunk before a face, the relative indices of the face are resolved from them once the chunk offsets are known
+    struct FaceContext
+    {
+        size_t lineNum;
+        size_t verticesCount;
+        size_t texcoordsCount;
+        size_t normalsCount;
+    };
+
+    std::string_view text;
+    size_t lineCount = 0;
+
+    ObjAttributes attributes;
+    ObjRawFaces faces;
+    std::vector<FaceContext> faceContexts;
+
+    // l records, like the faces
+    ObjRawFaces lines;
+    std::vector<FaceContext> lineContexts;
+
+    // usemtl, o/g and s apply to the faces and lines after them, up to the next record of the same kind
+    struct StateChange
+    {
+        enum Kind { Material, Group, Smoothing };
+
+        Kind kind;
+        size_t firstFace;
+        size_t firstLine;
+        std::string name; // of the material or group
+        uint32_t smoothingGroup;
+    };
+    std::vector<StateChange> stateChanges;
+    std::vector<std::string> materialLibraries;
+
+    void changeState(StateChange::Kind kind, std::string_view name, uint32_t smoothingGroup = 0)
+    {
+        stateChanges.push_back({kind, faces.size(), lines.size(), std::string(name), smoothingGroup});
+    }
+
+    // First rejected line, its number is relative to the chunk. Parsing stops there unless lenient,
+    // then every rejected line is skipped and counted
+    ParseFailure failure;
+    size_t skippedLines = 0;
+
+    // Returns whether to go on parsing
+    bool reject(ParseError error, std::string_view text, bool lenient)
+    {
+        if (!failure)
+            failure = {error, lineCount, text};
+        skippedLines++;
+        return lenient;
+    }
+};
+
+void parseChunk(ObjChunk &chunk, bool lenient = false)
+{
+    std::string_view data = chunk.text;
+    size_t offset = 0;
+
+    while (offset < data.size())
+    {
+        size_t end = data.find('\n', offset);
+        if (end == std::string_view::npos)
+            end = data.size();
+        std::string_view line = data.substr(offset, end - offset);
+        offset = end + 1;
+        chunk.lineCount++;
+
+        // blank lines are only blanks, so is their keyword
+        size_t pos = keywordEnd(line);
+        std::string_view identifier = line.substr(0, pos);
+        if (restOfLine(identifier, 0).empty() || identifier.at(0) == '#')
+            continue;
+
+        // a rejected v/vt/vn/vp still takes its index (with default values), so that the faces after it refer to the right ones
+        ParseError error = ParseError::None;
+        if (identifier == "v") {
+            auto vertex = scanVertex(line, pos);
+            error = vertex.error;
+            chunk.attributes.addVertex(vertex.value);
+        } else if (identifier == "vt") {
+            auto textureCoordinate = scanTextureCoordinate(line, pos);
+            error = textureCoordinate.error;
+            chunk.attributes.addTextureCoordinate(textureCoordinate.value);
+        } else if (identifier == "vn") {
+            auto normal = scanNormal(line, pos);
+            error = normal.error;
+            chunk.attributes.addNormal(normal.value);
+        } else if (identifier == "vp") {
+            auto parameterSpaceVertex = scanParameterSpaceVertex(line, pos);
+            error = parameterSpaceVertex.error;
+            chunk.attributes.addParameterSpaceVertex(parameterSpaceVertex.value);
+        } else if (identifier == "f") {
+            error = scanFace(line, pos, chunk.faces);
+            if (error == ParseError::None)
+                chunk.faceContexts.push_back({chunk.lineCount, chunk.attributes.verticesCount(), chunk.attributes.texcoords.size(), chunk.attributes.normals.size()});
+        } else if (identifier == "l") {
+            error = scanLineElement(line, pos, chunk.lines);
+            if (error == ParseError::None)
+                chunk.lineContexts.push_back({chunk.lineCount, chunk.attributes.verticesCount(), 0, 0});
+        } else if (identifier == "o" || identifier == "g") {
+            chunk.changeState(ObjChunk::StateChange::Group, restOfLine(line, pos));
+            continue;
+        } else if (identifier == "s") {
+            uint32_t smoothingGroup;
+            if (!scanSmoothingGroup(line, pos, smoothingGroup))
+                error = ParseError::InvalidSmoothingGroup;
+            else
+                chunk.changeState(ObjChunk::StateChange::Smoothing, "", smoothingGroup);
+        } else if (identifier == "usemtl") {
+            chunk.changeState(ObjChunk::StateChange::Material, restOfLine(line, pos));
+            continue;
+        } else if (identifier == "mtllib") {
+            for (std::string_view library = nextToken(line, pos); !library.empty(); library = nextToken(line, pos))
+                chunk.materialLibraries.emplace_back(library);
+            continue;
+        } else {
+            if (!chunk.reject(ParseError::UnknownToken, identifier, lenient))
+                return;
+            continue;
+        }
+
+        if (error != ParseError::None && !chunk.reject(error, line, lenient))
+            return;
+    }
+}
+
+// Cuts data in at most maxChunks parts of at least minChunkSize bytes, each ending right after a '\n'
+std::vector<ObjChunk> splitChunks(std::string_view data, size_t maxChunks, size_t minChunkSize = 1 << 20)
+{
+    size_t chunkCount = std::max<size_t>(1, std::min(maxChunks, data.size() / minChunkSize));
+    size_t chunkSize = data.size() / chunkCount + 1;
+
+    std::vector<ObjChunk> chunks;
+    size_t start = 0;
+    while (start < data.size())
+    {
+        size_t end = start + chunkSize;
+        if (end >= data.size())
+            end = data.size();
+        else
+        {
+            end = data.find('\n', end);
+            end = end == std::string_view::npos ? data.size() : end + 1;
+        }
+
+        chunks.emplace_back();
+        chunks.back().text = data.substr(start, end - start);
+        start = end;
+    }
+    return chunks;
+}
+
+// Runs fn(0) .. fn(count - 1), each on its own thread (fn(0) on the calling one)
+template <typename Fn>
+void runParallel(size_t count, Fn fn)
+{
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < count; i++)
+        workers.emplace_back(fn, i);
+    if (count > 0)
+        fn(0);
+    for (auto &worker: workers)
+        worker.join();
+}
+
+// Fixed set of worker threads running submitted tasks in submission order.
+// Tasks not started yet when the pool is destroyed are dropped, running ones are waited for
+class ThreadPool
+{
+    public:
+        ThreadPool(unsigned threads)
+        {
+            for (unsigned i = 0; i < std::max(threads, 1u); i++)
+                _workers.emplace_back([this]() { work(); });
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stopping = true;
+            }
+            _wakeUp.notify_all();
+            for (auto &worker: _workers)
+                worker.join();
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        void submit(std::function<void()> task)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _tasks.push_back(std::move(task));
+            }
+            _wakeUp.notify_one();
+        }
+
+        // Cuts [0, count) in ranges of at least minRange items, one per worker and one for the calling thread, runs
+        // fn(begin, end) on each and returns once they are all done. The ranges wait behind the tasks already queued,
+        // so a pool meant for this should not be running anything else
+        template <typename Fn>
+        void parallelFor(size_t count, size_t minRange, Fn fn)
+        {
+            size_t ranges = std::max<size_t>(1, std::min(_workers.size() + 1, count / std::max<size_t>(minRange, 1)));
+            std::mutex doneMutex;
+            std::condition_variable done;
+            size_t remaining = ranges - 1;
+            for (size_t i = 1; i < ranges; i++)
+            {
+                submit([&, i]() {
+                    fn(count * i / ranges, count * (i + 1) / ranges);
+                    // notified with the lock held, the waiter can't return and destroy done before
+                    std::lock_guard<std::mutex> lock(doneMutex);
+                    if (--remaining == 0)
+                        done.notify_one();
+                });
+            }
+            fn(0, count / ranges);
+
+            std::unique_lock<std::mutex> lock(doneMutex);
+            done.wait(lock, [&remaining]() { return remaining == 0; });
+        }
+
+    private:
+        std::vector<std::thread> _workers;
+        std::deque<std::function<void()>> _tasks;
+        std::mutex _mutex;
+        std::condition_variable _wakeUp;
+        bool _stopping = false;
+
+        void work()
+        {
+            for (;;)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _wakeUp.wait(lock, [this]() { return _stopping || !_tasks.empty(); });
+                    if (_stopping)
+                        return;
+                    task = std::move(_tasks.front());
+                    _tasks.pop_front();
+                }
+                task();
+            }
+        }
+};
+
+// Multiple producers, single consumer queue that never blocks either side: producers push onto an intrusive stack
+// with a compare and swap, the consumer takes the whole stack at once and puts it back in push order
+template <typename T>
+class LockFreeQueue
+{
+    public:
+        LockFreeQueue() {}
+
+        ~LockFreeQueue()
+        {
+            popAll();
+        }
+
+        LockFreeQueue(const LockFreeQueue&) = delete;
+        LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+
+        void push(T value)
+        {
+            Node *node = new Node{std::move(value), _head.load(std::memory_order_relaxed)};
+            while (!_head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+                ;
+        }
+
+        // Everything pushed so far, oldest first
+        std::vector<T> popAll()
+        {
+            std::vector<T> values;
+            popAll(values);
+            return values;
+        }
+
+        // Appends everything pushed so far to values, oldest first. The per frame consumers pass a vector of the frame arena
+        template <typename Allocator>
+        void popAll(std::vector<T, Allocator> &values)
+        {
+            size_t first = values.size();
+            Node *node = _head.exchange(nullptr, std::memory_order_acquire);
+            while (node)
+            {
+                values.push_back(std::move(node->value));
+                Node *next = node->next;
+                delete node;
+                node = next;
+            }
+            std::reverse(values.begin() + first, values.end());
+        }
+
+    private:
+        struct Node
+        {
+            T value;
+            Node *next;
+        };
+
+        std::atomic<Node*> _head{nullptr};
+};
+
+// Size of the blocks of an Arena, larger allocations get a block of their own
+constexpr size_t ARENA_BLOCK_SIZE = 1 << 20;
+constexpr size_t FRAME_ARENA_BLOCK_SIZE = 64 << 10;
+
+// Bump allocator for temporaries that all die at the same time. Allocations are carved out of large blocks one
+// after the other and never freed on their own: reset() makes the blocks available again (for per frame data),
+// release() gives them back to the system. Not thread safe, each thread or object owns its own
+class Arena
+{
+    public:
+        explicit Arena(size_t blockSize = ARENA_BLOCK_SIZE): _blockSize(blockSize) {}
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        void *allocate(size_t size, size_t alignment)
+        {
+            for (;; _current++, _used = 0)
+            {
+                if (_current == _blocks.size())
+                {
+                    size_t blockSize = std::max(_blockSize, size + alignment);
+                    _blocks.push_back(Block{std::unique_ptr<char[]>(new char[blockSize]), blockSize});
+                }
+
+                Block &block = _blocks[_current];
+                uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+                size_t start = ((base + _used + alignment - 1) & ~uintptr_t(alignment - 1)) - base;
+                if (start + size <= block.size)
+                {
+                    _used = start + size;
+                    return block.data.get() + start;
+                }
+            }
+        }
+
+        // Gives back what is allocated during its lifetime when going out of scope, declared before the containers
+        // using it so they are gone by then
+        class Scope
+        {
+            public:
+                explicit Scope(Arena &arena): _arena(arena), _block(arena._current), _used(arena._used) {}
+                ~Scope()
+                {
+                    _arena._current = _block;
+                    _arena._used = _used;
+                }
+
+                Scope(const Scope&) = delete;
+                Scope& operator=(const Scope&) = delete;
+
+            private:
+                Arena &_arena;
+                size_t _block;
+                size_t _used;
+        };
+
+        // Everything allocated so far is forgotten, the blocks are kept for the next allocations
+        void reset()
+        {
+            _current = 0;
+            _used = 0;
+        }
+
+        void release()
+        {
+            _blocks.clear();
+            reset();
+        }
+
+        size_t capacity() const
+        {
+            size_t total = 0;
+            for (const Block &block: _blocks)
+                total += block.size;
+            return total;
+        }
+
+    private:
+        struct Block
+        {
+            std::unique_ptr<char[]> data;
+            size_t size;
+        };
+
+        std::vector<Block> _blocks;
+        size_t _blockSize;
+        size_t _current = 0; // block the next allocation is tried in first
+        size_t _used = 0; // of the current block
+};
+
+// Standard allocator over an Arena, deallocate() does nothing so containers should be reserved to their final size
+template <typename T>
+struct ArenaAllocator
+{
+    using value_type = T;
+
+    Arena *arena;
+
+    ArenaAllocator(Arena &arena): arena(&arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other): arena(other.arena) {}
+
+    T *allocate(size_t count) { return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Read-only mapping of a whole file, unmapped when going out of scope
+class MappedFile
+{
+    private:
+        const char* _data = nullptr;
+        size_t _size = 0;
+
+    public:
+        MappedFile(const std::string& filename)
+        {
+            int fd = open(filename.c_str(), O_RDONLY);
+            if (fd == -1)
+                throw FileNotFoundException("file " + filename + " not found");
+
+            struct stat st;
+            if (fstat(fd, &st) == -1)
+            {
+                close(fd);
+                throw FileNotFoundException("cannot stat file " + filename);
+            }
+
+            _size = st.st_size;
+            if (_size > 0)
+            {
+                void *data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED)
+                {
+                    close(fd);
+                    throw FileNotFoundException("cannot map file " + filename);
+                }
+                madvise(data, _size, MADV_SEQUENTIAL);
+                _data = static_cast<const char*>(data);
+            }
+            // the mapping stays valid once the descriptor is closed
+            close(fd);
+        }
+
+        ~MappedFile()
+        {
+            if (_data)
+                munmap(const_cast<char*>(_data), _size);
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        std::string_view view() const { return std::string_view(_data, _size); }
+};
+
+enum class LoadMode
+{
+    Stream,   // std::getline + split, the reference implementation
+    Mapped,   // mmap + in place std::string_view tokenizing
+    Parallel, // same as Mapped, with the file cut in chunks parsed on several threads
+    Progressive, // read a block at a time, the mesh is drawn while it loads (see ObjectFile::loadProgressive())
+};
+
+// Faces meeting at a sharper angle than this (in degrees) keep a hard edge when normals are generated
+constexpr float DEFAULT_CREASE_ANGLE = 60.0f;
+
+struct LoadOptions
+{
+    LoadMode mode = LoadMode::Parallel;
+    unsigned threads = 0; // 0 means one per hardware thread
+    bool useCache = true; // read and write foo.obj.scopcache
+    bool verbose = true; // print loading progress on stdout
+    bool buildLods = true; // simplified levels of detail for large meshes
+    float creaseAngle = DEFAULT_CREASE_ANGLE; // see ObjectFile::generateNormals()
+    bool lenient = false; // skip and count invalid lines instead of failing
+    bool compress = false; // cache and draw quantized vertices, see PackedVertex and encodeIndices()
+};
+
+// Fewest vertices a worker transforms on the CPU, below that it costs more to wake it than to do them on the calling thread
+constexpr size_t TRANSFORM_MIN_RANGE = 16384;
+
+// Progressive loads read the file this many bytes at a time, each block becoming one batch (and one cluster)
+constexpr size_t PROGRESSIVE_BLOCK_SIZE = 4 << 20;
+// Batches parsed but not uploaded yet, the loader waits for the render thread past this so memory stays bounded
+constexpr size_t PROGRESSIVE_MAX_PENDING = 4;
+// Capacity of the GPU buffer segments a progressive load appends its batches to
+constexpr size_t SEGMENT_VERTICES = 1 << 20;
+constexpr size_t SEGMENT_INDICES = 3 << 20;
+// Granularity of the uploads when a reloaded mesh reuses the buffers of the previous version, see updateRenderBuffers()
+constexpr size_t UPLOAD_BLOCK_SIZE = 64 << 10;
+
+// Render data of one block of a progressive load, indices start at 0 for the first vertex of the batch
+struct MeshBatch
+{
+    std::vector<RenderVertex> vertices;
+    std::vector<GLuint> indices;
+    bool hasNormals = false;
+    bool hasTexcoords = false;
+    float center[3]; // bounding sphere of the batch
+    float radius;
+    Bounds bounds; // of every position read so far, normalization follows it while loading
+};
+
+class SharedBuffers;
+
+// Vertex and index buffers holding part of a mesh. Meshes loaded at once have a single segment, progressive loads
+// add one whenever a batch doesn't fit in the last one since a buffer can't grow without going through the CPU.
+// Indices in a segment start at 0 for its first vertex, unless the segment is a range of SharedBuffers
+struct RenderSegment
+{
+    GLuint vertexBuffer = 0;
+    GLuint indexBuffer = 0;
+    uint32_t firstIndex = 0; // in the whole index range of the mesh, see MeshCluster::indexOffset
+    uint32_t indicesCount = 0;
+    uint32_t verticesCount = 0;
+    uint32_t indexCapacity = 0;
+    uint32_t vertexCapacity = 0;
+    // In shared buffers, where the segment starts in them. The indices are uploaded with baseVertex added
+    SharedBuffers *shared = nullptr;
+    uint32_t baseVertex = 0;
+    uint32_t bufferFirstIndex = 0;
+};
+
+// Capacity of the blocks of SharedBuffers, a mesh that doesn't fit gets a block of its size
+constexpr size_t SHARED_BLOCK_VERTICES = 1 << 20;
+constexpr size_t SHARED_BLOCK_INDICES = 6 << 20;
+
+// A few large vertex and index buffers that the meshes are packed into, so that drawing one after the other doesn't
+// rebind anything (see Scene::draw()). Blocks are made per vertex size and carved into ranges first fit, the indices
+// are 32 bits. Needs the GL context for its whole life, release() before it goes away
+class SharedBuffers
+{
+    public:
+        SharedBuffers() {}
+
+        ~SharedBuffers()
+        {
+            release();
+        }
+
+        SharedBuffers(const SharedBuffers&) = delete;
+        SharedBuffers& operator=(const SharedBuffers&) = delete;
+
+        // Gives segment room for vertexCount vertices of vertexSize bytes and indexCount indices, and leaves its buffers bound
+        void allocate(size_t vertexSize, size_t vertexCount, size_t indexCount, RenderSegment &segment)
+        {
+            uint32_t firstVertex = 0, firstIndex = 0;
+            size_t b = 0;
+            for (; b < _blocks.size(); b++)
+            {
+                Block &block = _blocks[b];
+                if (block.vertexSize != vertexSize || !take(block.freeVertices, vertexCount, firstVertex))
+                    continue;
+                if (take(block.freeIndices, indexCount, firstIndex))
+                    break;
+                give(block.freeVertices, firstVertex, vertexCount);
+            }
+            if (b == _blocks.size())
+            {
+                Block block;
+                block.vertexSize = vertexSize;
+                block.vertexCapacity = std::max(SHARED_BLOCK_VERTICES, vertexCount);
+                block.indexCapacity = std::max(SHARED_BLOCK_INDICES, indexCount);
+                glGenBuffers(1, &block.vertexBuffer);
+                glBindBuffer(GL_ARRAY_BUFFER, block.vertexBuffer);
+                glBufferData(GL_ARRAY_BUFFER, block.vertexCapacity * vertexSize, nullptr, GL_STATIC_DRAW);
+                glGenBuffers(1, &block.indexBuffer);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, block.indexBuffer);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, block.indexCapacity * sizeof(GLuint), nullptr, GL_STATIC_DRAW);
+                block.freeVertices.push_back({0, (uint32_t)block.vertexCapacity});
+                block.freeIndices.push_back({0, (uint32_t)block.indexCapacity});
+                _blocks.push_back(std::move(block));
+                take(_blocks[b].freeVertices, vertexCount, firstVertex);
+                take(_blocks[b].freeIndices, indexCount, firstIndex);
+            }
+
+            segment.vertexBuffer = _blocks[b].vertexBuffer;
+            segment.indexBuffer = _blocks[b].indexBuffer;
+            segment.vertexCapacity = vertexCount;
+            segment.indexCapacity = indexCount;
+            segment.shared = this;
+            segment.baseVertex = firstVertex;
+            segment.bufferFirstIndex = firstIndex;
+            glBindBuffer(GL_ARRAY_BUFFER, segment.vertexBuffer);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, segment.indexBuffer);
+        }
+
+        // The ranges of segment can be given to another one
+        void free(const RenderSegment &segment)
+        {
+            for (Block &block: _blocks)
+                if (block.vertexBuffer == segment.vertexBuffer)
+                {
+                    give(block.freeVertices, segment.baseVertex, segment.vertexCapacity);
+                    give(block.freeIndices, segment.bufferFirstIndex, segment.indexCapacity);
+                    return;
+                }
+        }
+
+        void release()
+        {
+            for (const Block &block: _blocks)
+            {
+                glDeleteBuffers(1, &block.vertexBuffer);
+                glDeleteBuffers(1, &block.indexBuffer);
+            }
+            _blocks.clear();
+        }
+
+    private:
+        struct Range
+        {
+            uint32_t offset;
+            uint32_t size;
+        };
+
+        struct Block
+        {
+            size_t vertexSize;
+            size_t vertexCapacity;
+            size_t indexCapacity;
+            GLuint vertexBuffer = 0;
+            GLuint indexBuffer = 0;
+            std::vector<Range> freeVertices; // sorted by offset, never adjacent
+            std::vector<Range> freeIndices;
+        };
+
+        std::vector<Block> _blocks;
+
+        static bool take(std::vector<Range> &free, size_t size, uint32_t &offset)
+        {
+            for (size_t i = 0; i < free.size(); i++)
+            {
+                if (free[i].size < size)
+                    continue;
+                offset = free[i].offset;
+                free[i].offset += size;
+                free[i].size -= size;
+                if (free[i].size == 0)
+                    free.erase(free.begin() + i);
+                return true;
+            }
+            return false;
+        }
+
+        static void give(std::vector<Range> &free, uint32_t offset, size_t size)
+        {
+            if (size == 0)
+                return;
+            auto next = std::lower_bound(free.begin(), free.end(), offset, [](const Range &range, uint32_t value) {
+                return range.offset < value;
+            });
+            next = free.insert(next, Range{offset, (uint32_t)size});
+            if (next + 1 != free.end() && next->offset + next->size == (next + 1)->offset)
+            {
+                next->size += (next + 1)->size;
+                free.erase(next + 1);
+            }
+            if (next != free.begin() && (next - 1)->offset + (next - 1)->size == next->offset)
+            {
+                (next - 1)->size += next->size;
+                free.erase(next);
+            }
+        }
+};
+
+// Read-only view over contiguous elements, owned elsewhere (a vector or a mapped file)
+template <typename T>
+struct ArrayView
+{
+    const T *data = nullptr;
+    size_t size = 0;
+
+    ArrayView() {}
+    ArrayView(const T *data, size_t size): data(data), size(size) {}
+    ArrayView(const std::vector<T> &vector): data(vector.data()), size(vector.size()) {}
+
+    const T& operator[](size_t i) const { return data[i]; }
+    const T* begin() const { return data; }
+    const T* end() const { return data + size; }
+};
+
+// Binary mesh cache, written next to foo.obj as foo.obj.scopcache once it was parsed.
+// A header, a table of sections, then the sections themselves, 16 bytes aligned so they can be used in place once mapped.
+// Bump MESH_CACHE_VERSION whenever what is stored (or how it is built) changes
+constexpr char MESH_CACHE_MAGIC[8] = "SCOPMSH";
+constexpr uint32_t MESH_CACHE_VERSION = 9;
+constexpr uint32_t MESH_CACHE_BYTE_ORDER = 0x01020304;
+
+enum MeshCacheSectionId : uint32_t
+{
+    MESH_CACHE_SOURCE_PATH = 1,
+    MESH_CACHE_RENDER_VERTICES = 2,
+    MESH_CACHE_RENDER_INDICES = 3,
+    MESH_CACHE_LODS = 4,
+    MESH_CACHE_CLUSTERS = 5,
+    MESH_CACHE_CLUSTER_NODES = 6,
+    MESH_CACHE_MATERIAL_LIBRARIES = 7, // names separated by '\0', like the one below
+    MESH_CACHE_MATERIAL_NAMES = 8,
+    MESH_CACHE_MATERIAL_RANGES = 9,
+    MESH_CACHE_GROUP_NAMES = 10,
+    MESH_CACHE_SUB_MESHES = 11,
+    MESH_CACHE_LINE_INDICES = 12,
+    MESH_CACHE_PACKED_VERTICES = 13, // replace the render vertices and indices in compressed caches
+    MESH_CACHE_PACKED_INDICES = 14,
+    MESH_CACHE_QUANTIZATION = 15,
+};
+
+// "a\0b\0" for {"a", "b"}
+std::string joinNames(const std::vector<std::string> &names)
+{
+    std::string joined;
+    for (const std::string &name: names)
+        joined.append(name).push_back('\0');
+    return joined;
+}
+
+std::vector<std::string> splitNames(std::string_view joined)
+{
+    std::vector<std::string> names;
+    for (size_t start = 0, end; start < joined.size(); start = end + 1)
+    {
+        end = joined.find('\0', start);
+        if (end == std::string_view::npos)
+            end = joined.size();
+        names.emplace_back(joined.substr(start, end - start));
+    }
+    return names;
+}
+
+enum MeshCacheFlags : uint32_t
+{
+    MESH_CACHE_HAS_NORMALS = 1 << 0,
+    MESH_CACHE_HAS_TEXCOORDS = 1 << 1,
+    MESH_CACHE_COMPRESSED = 1 << 2, // written with LoadOptions::compress
+};
+
+struct MeshCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t sourceSize;
+    int64_t sourceMtime; // nanoseconds
+    uint32_t flags;
+    uint32_t sectionsCount;
+    uint64_t verticesCount;
+    uint64_t texcoordsCount;
+    uint64_t normalsCount;
+    float creaseAngle; // the generated normals depend on it
+    uint32_t reserved;
+};
+
+struct MeshCacheSection
+{
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// Size and modification time of the source file, what a cache is keyed on along with its path
+struct SourceStamp
+{
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+bool getSourceStamp(const std::string &filename, SourceStamp &stamp)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) == -1)
+        return false;
+
+    stamp.size = st.st_size;
+#ifdef __APPLE__
+    stamp.mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+std::string getRealPath(const std::string &filename)
+{
+    char *resolved = realpath(filename.c_str(), nullptr);
+    if (!resolved)
+        return filename;
+    std::string path(resolved);
+    free(resolved);
+    return path;
+}
+
+// Collects sections then writes the whole cache at once, through a temporary file renamed over the old cache
+class MeshCacheWriter
+{
+    private:
+        struct PendingSection
+        {
+            uint32_t id;
+            const void *data;
+            uint64_t size;
+        };
+
+        std::vector<PendingSection> _sections;
+
+    public:
+        MeshCacheHeader header = {};
+
+        void addSection(uint32_t id, const void *data, uint64_t size)
+        {
+            _sections.push_back({id, data, size});
+        }
+
+        bool write(const std::string &cachePath)
+        {
+            std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+            header.version = MESH_CACHE_VERSION;
+            header.byteOrder = MESH_CACHE_BYTE_ORDER;
+            header.sectionsCount = _sections.size();
+
+            std::vector<MeshCacheSection> table;
+            uint64_t offset = alignOffset(sizeof(MeshCacheHeader) + _sections.size() * sizeof(MeshCacheSection));
+            for (const auto &section: _sections)
+            {
+                table.push_back({section.id, 0, offset, section.size});
+                offset = alignOffset(offset + section.size);
+            }
+
+            std::string tmpPath = cachePath + ".tmp" + std::to_string(getpid());
+            FILE *file = fopen(tmpPath.c_str(), "wb");
+            if (!file)
+                return false;
+
+            bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+            ok = ok && fwrite(table.data(), sizeof(MeshCacheSection), table.size(), file) == table.size();
+            for (size_t i = 0; ok && i < _sections.size(); i++)
+            {
+                ok = fseek(file, table[i].offset, SEEK_SET) == 0;
+                ok = ok && (_sections[i].size == 0 || fwrite(_sections[i].data, _sections[i].size, 1, file) == 1);
+            }
+            // seeking past the end writes nothing, an empty last section would point past a shorter file
+            ok = ok && fflush(file) == 0 && ftruncate(fileno(file), offset) == 0;
+            ok = fclose(file) == 0 && ok;
+
+            if (!ok || rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+            {
+                unlink(tmpPath.c_str());
+                return false;
+            }
+            return true;
+        }
+
+        static uint64_t alignOffset(uint64_t offset)
+        {
+            return (offset + 15) & ~uint64_t(15);
+        }
+};
+
+struct InvalidImageException : public std::exception
+{
+    private:
+        std::string message;
+
+    public:
+        InvalidImageException(const std::string& message) : message(message) {}
+        virtual const char* what() const throw() { return message.c_str(); }
+};
+
+// RGBA pixels, rows from the bottom up like GL textures (and texture coordinates) expect them
+struct Image
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> pixels;
+};
+
+inline uint32_t readLittleEndian(const unsigned char *p, int bytes)
+{
+    uint32_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        value = value << 8 | p[i];
+    return value;
+}
+
+// Uncompressed and RLE true color or grayscale TGA, 8, 24 or 32 bits per pixel
+Image decodeTga(std::string_view data, const std::string &path)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data.data());
+    if (data.size() < 18)
+        throw InvalidImageException("truncated TGA file " + path);
+
+    uint32_t idLength = bytes[0], colorMapType = bytes[1], imageType = bytes[2];
+    uint32_t width = readLittleEndian(bytes + 12, 2), height = readLittleEndian(bytes + 14, 2);
+    uint32_t bytesPerPixel = bytes[16] / 8, descriptor = bytes[17];
+    bool rle = imageType == 10 || imageType == 11;
+    bool gray = imageType == 3 || imageType == 11;
+    if (colorMapType != 0 || (imageType != 2 && imageType != 3 && !rle) || width == 0 || height == 0
+        || (gray ? bytesPerPixel != 1 : bytesPerPixel != 3 && bytesPerPixel != 4))
+        throw InvalidImageException("unsupported TGA file " + path);
+
+    Image image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize((size_t)width * height * 4);
+    size_t offset = 18 + idLength;
+    size_t count = (size_t)width * height;
+    auto readPixel = [&](uint8_t *out) {
+        if (offset + bytesPerPixel > data.size())
+            throw InvalidImageException("truncated TGA file " + path);
+        const unsigned char *p = bytes + offset;
+        offset += bytesPerPixel;
+        out[0] = gray ? p[0] : p[2];
+        out[1] = gray ? p[0] : p[1];
+        out[2] = p[0];
+        out[3] = bytesPerPixel == 4 ? p[3] : 255;
+    };
+
+    for (size_t i = 0; i < count; )
+    {
+        size_t run = 1;
+        bool repeated = false;
+        if (rle)
+        {
+            if (offset >= data.size())
+                throw InvalidImageException("truncated TGA file " + path);
+            run = (bytes[offset] & 0x7f) + 1;
+            repeated = bytes[offset] & 0x80;
+            offset++;
+        }
+        run = std::min(run, count - i);
+        readPixel(&image.pixels[i * 4]);
+        for (size_t j = 1; j < run; j++)
+        {
+            if (repeated)
+                std::memcpy(&image.pixels[(i + j) * 4], &image.pixels[i * 4], 4);
+            else
+                readPixel(&image.pixels[(i + j) * 4]);
+        }
+        i += run;
+    }
+
+    // bit 5 set means the first row is the top one
+    if (descriptor & 0x20)
+        for (uint32_t y = 0; y < height / 2; y++)
+            std::swap_ranges(&image.pixels[(size_t)y * width * 4], &image.pixels[(size_t)(y + 1) * width * 4],
+                &image.pixels[(size_t)(height - 1 - y) * width * 4]);
+    return image;
+}
+
+// Uncompressed 24 and 32 bits BMP, bottom up or top down
+Image decodeBmp(std::string_view data, const std::string &path)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data.data());
+    if (data.size() < 54)
+        throw InvalidImageException("truncated BMP file " + path);
+
+    uint32_t pixelsOffset = readLittleEndian(bytes + 10, 4);
+    int32_t width = readLittleEndian(bytes + 18, 4), height = readLittleEndian(bytes + 22, 4);
+    uint32_t bitsPerPixel = readLittleEndian(bytes + 28, 2), compression = readLittleEndian(bytes + 30, 4);
+    // 32 bits images are BI_BITFIELDS with the usual masks more often than not, which is read the same
+    if (width <= 0 || height == 0 || (bitsPerPixel != 24 && bitsPerPixel != 32) || (compression != 0 && compression != 3))
+        throw InvalidImageException("unsupported BMP file " + path);
+
+    bool topDown = height < 0;
+    uint32_t rows = topDown ? -height : height;
+    size_t bytesPerPixel = bitsPerPixel / 8;
+    size_t stride = ((size_t)width * bytesPerPixel + 3) & ~size_t(3);
+    if (pixelsOffset + stride * rows > data.size())
+        throw InvalidImageException("truncated BMP file " + path);
+
+    Image image;
+    image.width = width;
+    image.height = rows;
+    image.pixels.resize((size_t)width * rows * 4);
+    for (uint32_t y = 0; y < rows; y++)
+    {
+        const unsigned char *row = bytes + pixelsOffset + (topDown ? rows - 1 - y : y) * stride;
+        uint8_t *out = &image.pixels[(size_t)y * width * 4];
+        for (int32_t x = 0; x < width; x++, row += bytesPerPixel, out += 4)
+        {
+            out[0] = row[2];
+            out[1] = row[1];
+            out[2] = row[0];
+            out[3] = bytesPerPixel == 4 ? row[3] : 255;
+        }
+    }
+    return image;
+}
+
+// Binary PPM (P6) with at most 8 bits per channel
+Image decodePpm(std::string_view data, const std::string &path)
+{
+    size_t pos = 2;
+    uint32_t header[3];
+    for (int i = 0; i < 3; i++)
+    {
+        // blanks and comments between the fields
+        while (pos < data.size() && (std::isspace((unsigned char)data[pos]) || data[pos] == '#'))
+        {
+            if (data[pos] == '#')
+                while (pos < data.size() && data[pos] != '\n')
+                    pos++;
+            else
+                pos++;
+        }
+        size_t start = pos;
+        while (pos < data.size() && std::isdigit((unsigned char)data[pos]))
+            pos++;
+        if (!parseNumber(data.substr(start, pos - start), header[i]))
+            throw InvalidImageException("invalid PPM file " + path);
+    }
+    uint32_t width = header[0], height = header[1], maxValue = header[2];
+    // a single blank ends the header
+    pos++;
+    if (width == 0 || height == 0 || maxValue == 0 || maxValue > 255)
+        throw InvalidImageException("unsupported PPM file " + path);
+    if (pos + (size_t)width * height * 3 > data.size())
+        throw InvalidImageException("truncated PPM file " + path);
+
+    Image image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize((size_t)width * height * 4);
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data.data()) + pos;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const unsigned char *row = bytes + (size_t)(height - 1 - y) * width * 3;
+        uint8_t *out = &image.pixels[(size_t)y * width * 4];
+        for (uint32_t x = 0; x < width; x++, row += 3, out += 4)
+        {
+            for (int k = 0; k < 3; k++)
+                out[k] = row[k] * 255 / maxValue;
+            out[3] = 255;
+        }
+    }
+    return image;
+}
+
+// Binary PPM (P6) of the color channels of image, rows from the top down as decodePpm() reads them
+bool writePpm(const Image &image, const std::string &path)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = fprintf(file, "P6\n%u %u\n255\n", image.width, image.height) > 0;
+    std::vector<uint8_t> row((size_t)image.width * 3);
+    for (uint32_t y = image.height; ok && y-- > 0;)
+    {
+        const uint8_t *in = &image.pixels[(size_t)y * image.width * 4];
+        for (uint32_t x = 0; x < image.width; x++)
+            std::memcpy(&row[x * 3], &in[x * 4], 3);
+        ok = fwrite(row.data(), row.size(), 1, file) == 1;
+    }
+    return fclose(file) == 0 && ok;
+}
+
+// Picks the decoder from the first bytes of the file rather than from its extension
+Image decodeImage(const std::string &path)
+{
+    MappedFile file(path);
+    std::string_view data = file.view();
+    if (data.substr(0, 2) == "BM")
+        return decodeBmp(data, path);
+    if (data.substr(0, 2) == "P6")
+        return decodePpm(data, path);
+    std::string extension = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+    // TGA has no magic number
+    if (extension == ".tga")
+        return decodeTga(data, path);
+    throw InvalidImageException("unsupported image format " + path + " (only TGA, BMP and PPM are read)");
+}
+
+// The image and its halved versions down to 1x1, each texel of a level averages the 2x2 (fewer at odd edges) texels under it
+std::vector<Image> buildMipmaps(Image image)
+{
+    std::vector<Image> levels;
+    levels.push_back(std::move(image));
+    while (levels.back().width > 1 || levels.back().height > 1)
+    {
+        const Image &source = levels.back();
+        Image level;
+        level.width = std::max(1u, source.width / 2);
+        level.height = std::max(1u, source.height / 2);
+        level.pixels.resize((size_t)level.width * level.height * 4);
+        for (uint32_t y = 0; y < level.height; y++)
+        {
+            uint32_t y0 = std::min(y * 2, source.height - 1), y1 = std::min(y * 2 + 1, source.height - 1);
+            for (uint32_t x = 0; x < level.width; x++)
+            {
+                uint32_t x0 = std::min(x * 2, source.width - 1), x1 = std::min(x * 2 + 1, source.width - 1);
+                for (int k = 0; k < 4; k++)
+                {
+                    uint32_t sum = source.pixels[((size_t)y0 * source.width + x0) * 4 + k] + source.pixels[((size_t)y0 * source.width + x1) * 4 + k]
+                        + source.pixels[((size_t)y1 * source.width + x0) * 4 + k] + source.pixels[((size_t)y1 * source.width + x1) * 4 + k];
+                    level.pixels[((size_t)y * level.width + x) * 4 + k] = (sum + 2) / 4;
+                }
+            }
+        }
+        levels.push_back(std::move(level));
+    }
+    return levels;
+}
+
+// An image file used by materials, decoded with its mipmaps on a worker then uploaded by the render thread
+struct Texture
+{
+    std::string path;
+    GLuint id = 0; // stays 0 until uploaded, or if the image could not be decoded
+    std::vector<Image> levels; // freed once uploaded
+    std::string error;
+    bool ready = false; // set by TextureCache::uploadDecoded(), uploaded or not
+};
+
+// Shares the textures between every mesh by path, decodes them on threads of its own and uploads those that are
+// ready in uploadDecoded(). Until then the materials using them draw untextured
+class TextureCache
+{
+    public:
+        TextureCache(unsigned threads): _decoders(threads) {}
+
+        TextureCache(const TextureCache&) = delete;
+        TextureCache& operator=(const TextureCache&) = delete;
+
+        // Render thread only, the first use of a path queues its decoding
+        std::shared_ptr<Texture> acquire(const std::string &path)
+        {
+            std::shared_ptr<Texture> &texture = _textures[getRealPath(path)];
+            if (texture)
+                return texture;
+
+            texture = std::make_shared<Texture>();
+            texture->path = path;
+            _decoders.submit([this, texture]() {
+                try {
+                    texture->levels = buildMipmaps(decodeImage(texture->path));
+                } catch (std::exception &e) {
+                    texture->error = e.what();
+                }
+                _decoded.push(texture);
+            });
+            return texture;
+        }
+
+        // Needs the GL context, frame holds the list of the decoded textures
+        void uploadDecoded(Arena &frame)
+        {
+            ArenaVector<std::shared_ptr<Texture>> decoded{ArenaAllocator<std::shared_ptr<Texture>>(frame)};
+            _decoded.popAll(decoded);
+            for (const std::shared_ptr<Texture> &texture: decoded)
+            {
+                texture->ready = true;
+                if (!texture->error.empty())
+                {
+                    std::cerr << "Cannot load texture: " << texture->error << std::endl;
+                    continue;
+                }
+
+                glGenTextures(1, &texture->id);
+                glBindTexture(GL_TEXTURE_2D, texture->id);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                for (size_t level = 0; level < texture->levels.size(); level++)
+                {
+                    const Image &image = texture->levels[level];
+                    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels.data());
+                }
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture->levels.size() - 1);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+                texture->levels = std::vector<Image>();
+            }
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        // Needs the GL context, the textures are drawn untextured afterwards
+        void release()
+        {
+            for (auto &entry: _textures)
+            {
+                if (entry.second->id)
+                    glDeleteTextures(1, &entry.second->id);
+                entry.second->id = 0;
+            }
+        }
+
+    private:
+        std::unordered_map<std::string, std::shared_ptr<Texture>> _textures;
+        LockFreeQueue<std::shared_ptr<Texture>> _decoded;
+        ThreadPool _decoders; // last, so that the decodes still running are waited for before the rest goes
+};
+
+// newmtl of an MTL file, the defaults are the look of the meshes without materials. Only the diffuse part is drawn:
+// the ambient light follows the diffuse color (see GL_COLOR_MATERIAL), and the fixed function specular term needs
+// a viewer towards +z while it is towards -z here (see initGlState()), so Ka, Ks and Ns are left out
+struct Material
+{
+    std::string name;
+    glm::vec3 diffuse = glm::vec3(0.8f, 0.3f, 0.4f); // Kd
+    std::string diffuseMap; // map_Kd, made relative to the working directory
+    std::shared_ptr<Texture> texture; // of diffuseMap, see ObjectFile::acquireTextures()
+};
+
+// "dir/" for "dir/file.obj", "" for "file.obj"
+std::string directoryOf(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+// Paths of MTL files are relative to the file naming them, and from Windows exporters more often than not
+std::string resolveRelativePath(const std::string &directory, std::string_view path)
+{
+    std::string resolved(path);
+    std::replace(resolved.begin(), resolved.end(), '\\', '/');
+    if (!resolved.empty() && resolved[0] == '/')
+        return resolved;
+    return directory + resolved;
+}
+
+// The newmtl of an MTL file. Only the statements drawn with are read (Kd and map_Kd), the other ones and the lines
+// that can't be read are skipped: the format has many extensions and a material is only a look
+std::vector<Material> parseMaterialLibrary(const std::string &path)
+{
+    MappedFile file(path);
+    std::string directory = directoryOf(path);
+    std::string_view data = file.view();
+    std::vector<Material> materials;
+
+    size_t offset = 0;
+    while (offset < data.size())
+    {
+        size_t end = data.find('\n', offset);
+        if (end == std::string_view::npos)
+            end = data.size();
+        std::string_view line = data.substr(offset, end - offset);
+        offset = end + 1;
+
+        size_t pos = 0;
+        std::string_view identifier = nextToken(line, pos);
+        if (identifier == "newmtl")
+        {
+            materials.emplace_back();
+            materials.back().name = std::string(restOfLine(line, pos));
+            continue;
+        }
+        if (materials.empty() || identifier.empty() || identifier.at(0) == '#')
+            continue;
+
+        Material &material = materials.back();
+        if (identifier == "Kd")
+        {
+            // a single value is gray
+            double values[3];
+            bool valid;
+            int count = scanNumbers(line, pos, values, 3, valid);
+            if (!valid)
+                continue;
+            if (count == 1)
+                material.diffuse = glm::vec3(values[0]);
+            else if (count == 3)
+                material.diffuse = glm::vec3(values[0], values[1], values[2]);
+        } else if (identifier == "map_Kd") {
+            // the options (-s 1 1 1, -bm 0.5...) come first, the file name is the last token
+            std::string_view name;
+            for (std::string_view token = nextToken(line, pos); !token.empty(); token = nextToken(line, pos))
+                name = token;
+            if (!name.empty())
+                material.diffuseMap = resolveRelativePath(directory, name);
+        }
+    }
+    return materials;
+}
+
+// The one light of the scene, for the fixed function pipeline (see initGlState()) and the shaders alike. It sits at the
+// viewer, towards -z since the projection is the identity. The ambient is the default GL_LIGHT_MODEL_AMBIENT
+constexpr float LIGHT_DIRECTION[3] = {0.0f, 0.0f, -1.0f};
+constexpr float LIGHT_AMBIENT = 0.2f;
+
+// Permutations of the mesh shader, picked from what each mesh has when it is drawn (see ObjectFile::shaderFlags())
+enum ShaderFlags : uint32_t
+{
+    SHADER_NORMALS = 1 << 0, // otherwise every vertex has the default normal, like glNormal3f(0, 0, 1)
+    SHADER_TEXCOORDS = 1 << 1, // and a diffuse map for the materials that have one
+    SHADER_MATERIAL = 1 << 2, // diffuse color from a uniform, otherwise the default one
+    SHADER_LIT = 1 << 3,
+    SHADER_INSTANCED = 1 << 4, // model matrix from the per instance attribute, see InstanceRenderer
+    SHADER_QUANTIZED = 1 << 5, // PackedVertex attributes, decoded with the uniforms of VertexQuantization
+};
+constexpr uint32_t SHADER_PERMUTATIONS = 1 << 6;
+
+// Generic attribute locations of the mesh shaders, the ones of gl_Vertex, gl_Normal and gl_MultiTexCoord0 with
+// the drivers that alias them
+constexpr GLuint POSITION_ATTRIBUTE = 0;
+constexpr GLuint NORMAL_ATTRIBUTE = 2;
+constexpr GLuint TEXCOORD_ATTRIBUTE = 8;
+// First of the 4 generic attributes holding the instance model matrix, aliased with texture units 4 to 7 by the drivers
+// that alias attributes
+constexpr GLuint INSTANCE_MODEL_ATTRIBUTE = 12;
+
+// Only generic attributes and uniforms, no gl_ built-in state: the same source compiles as GLSL 1.50 for a core
+// profile and as GLSL 1.20 for the legacy contexts, see ShaderLibrary::versionHeader()
+constexpr const char *MESH_VERTEX_SHADER =
+    "IN vec3 position;\n"
+    "#ifdef HAS_NORMALS\n"
+    "#ifdef QUANTIZED\n"
+    "IN vec2 normal;\n"
+    "#else\n"
+    "IN vec3 normal;\n"
+    "#endif\n"
+    "#endif\n"
+    "#ifdef HAS_TEXCOORDS\n"
+    "IN vec2 texcoord;\n"
+    "OUT vec2 fragmentTexcoord;\n"
+    "#endif\n"
+    "#ifdef QUANTIZED\n"
+    "uniform vec3 positionMin;\n"
+    "uniform vec3 positionScale;\n"
+    "uniform vec2 texcoordMin;\n"
+    "uniform vec2 texcoordScale;\n"
+    "vec3 octahedralDecode(vec2 e)\n"
+    "{\n"
+    "    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+    "    if (n.z < 0.0)\n"
+    "        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n"
+    "    return normalize(n);\n"
+    "}\n"
+    "#endif\n"
+    "#ifdef INSTANCED\n"
+    "IN mat4 instanceModel;\n"
+    "#else\n"
+    "uniform mat4 model;\n"
+    "#endif\n"
+    "#ifdef LIT\n"
+    "OUT vec3 fragmentNormal;\n"
+    "#endif\n"
+    "void main()\n"
+    "{\n"
+    "#ifdef INSTANCED\n"
+    "    mat4 transform = instanceModel;\n"
+    "#else\n"
+    "    mat4 transform = model;\n"
+    "#endif\n"
+    "#ifdef LIT\n"
+    "#if defined(HAS_NORMALS) && defined(QUANTIZED)\n"
+    "    fragmentNormal = mat3(transform) * octahedralDecode(normal);\n"
+    "#elif defined(HAS_NORMALS)\n"
+    "    fragmentNormal = mat3(transform) * normal;\n"
+    "#else\n"
+    "    fragmentNormal = mat3(transform) * vec3(0.0, 0.0, 1.0);\n"
+    "#endif\n"
+    "#endif\n"
+    "#if defined(HAS_TEXCOORDS) && defined(QUANTIZED)\n"
+    "    fragmentTexcoord = texcoordMin + texcoord * texcoordScale;\n"
+    "#elif defined(HAS_TEXCOORDS)\n"
+    "    fragmentTexcoord = texcoord;\n"
+    "#endif\n"
+    "#ifdef QUANTIZED\n"
+    "    gl_Position = transform * vec4(positionMin + position * positionScale, 1.0);\n"
+    "#else\n"
+    "    gl_Position = transform * vec4(position, 1.0);\n"
+    "#endif\n"
+    "}\n";
+
+// Per fragment version of the fixed function lighting set by initGlState(): the color is the ambient and diffuse
+// material, both sides are lit and the diffuse map modulates the result
+constexpr const char *MESH_FRAGMENT_SHADER =
+    "#ifdef HAS_MATERIAL\n"
+    "uniform vec3 diffuse;\n"
+    "#else\n"
+    "const vec3 diffuse = DEFAULT_DIFFUSE;\n"
+    "#endif\n"
+    "#ifdef HAS_TEXCOORDS\n"
+    "uniform sampler2D diffuseMap;\n"
+    "uniform bool textured;\n"
+    "IN vec2 fragmentTexcoord;\n"
+    "#endif\n"
+    "#ifdef LIT\n"
+    "uniform vec3 lightDirection;\n"
+    "uniform float lightAmbient;\n"
+    "IN vec3 fragmentNormal;\n"
+    "#endif\n"
+    "void main()\n"
+    "{\n"
+    "    vec3 color = diffuse;\n"
+    "#ifdef LIT\n"
+    "    vec3 normal = dot(fragmentNormal, fragmentNormal) > 0.0 ? normalize(fragmentNormal) : vec3(0.0);\n"
+    "    if (!gl_FrontFacing)\n"
+    "        normal = -normal;\n"
+    "    color = clamp(color * (lightAmbient + max(dot(normal, lightDirection), 0.0)), 0.0, 1.0);\n"
+    "#endif\n"
+    "    vec4 result = vec4(color, 1.0);\n"
+    "#ifdef HAS_TEXCOORDS\n"
+    "    if (textured)\n"
+    "        result *= TEXTURE(diffuseMap, fragmentTexcoord);\n"
+    "#endif\n"
+    "    FRAGMENT_COLOR = result;\n"
+    "}\n";
+
+// One linked permutation of the mesh shader, the locations are -1 for the uniforms it doesn't have
+struct ShaderProgram
+{
+    GLuint program = 0;
+    GLint model = -1;
+    GLint diffuse = -1;
+    GLint textured = -1;
+    GLint positionMin = -1; // and the other VertexQuantization uniforms, with SHADER_QUANTIZED
+    GLint positionScale = -1;
+    GLint texcoordMin = -1;
+    GLint texcoordScale = -1;
+};
+
+// Program binaries cache, a header followed by the entries one after the other. Binaries only load on the driver
+// that made them, which the key covers (with the source of the permutation)
+constexpr char PROGRAM_CACHE_MAGIC[8] = "SCOPPRG";
+constexpr uint32_t PROGRAM_CACHE_VERSION = 1;
+constexpr const char *PROGRAM_CACHE_NAME = ".scop.programcache"; // in $HOME
+
+struct ProgramCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entriesCount;
+};
+
+struct ProgramCacheEntry
+{
+    uint64_t key;
+    uint32_t format;
+    uint32_t size; // of the binary right after
+};
+
+// Version of the current context as major * 10 + minor, 0 when it can't be read
+int getGlVersion()
+{
+    const char *version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    int major = 0, minor = 0;
+    if (!version || sscanf(version, "%d.%d", &major, &minor) != 2)
+        return 0;
+    return major * 10 + minor;
+}
+
+// Whether the current context is a core profile one, without any of the fixed function pipeline
+bool isCoreProfile()
+{
+#ifdef GL_CONTEXT_CORE_PROFILE_BIT
+    if (getGlVersion() < 32)
+        return false;
+    GLint profile = 0;
+    glGetIntegerv(GL_CONTEXT_PROFILE_MASK, &profile);
+    glGetError(); // legacy contexts don't know GL_CONTEXT_PROFILE_MASK
+    return profile & GL_CONTEXT_CORE_PROFILE_BIT;
+#else
+    return false;
+#endif
+}
+
+// Whether the current context has the extension name. Core profiles only list them one by one, glGetString(GL_EXTENSIONS)
+// is an error there
+bool hasGlExtension(const char *name)
+{
+    if (isCoreProfile())
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char *extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if (extension && strcmp(extension, name) == 0)
+                return true;
+        }
+        return false;
+    }
+    const char *extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+    return extensions && strstr(extensions, name);
+}
+
+// Every permutation of the mesh shader, linked on first use or straight from the binary a previous run cached.
+// Needs a current GL context for its whole life, release() before it goes away
+class ShaderLibrary
+{
+    public:
+        ShaderLibrary(std::string cachePath): _cachePath(std::move(cachePath))
+        {
+            const char *language = reinterpret_cast<const char*>(glGetString(GL_SHADING_LANGUAGE_VERSION));
+            int major = 0, minor = 0;
+            if (!language || sscanf(language, "%d.%d", &major, &minor) != 2 || major * 100 + minor < 120)
+                return;
+            // core profiles are 3.2 or later, which have GLSL 1.50
+            _core = isCoreProfile();
+            _available = true;
+
+            const char *vendor = reinterpret_cast<const char*>(glGetString(GL_VENDOR));
+            const char *renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+            const char *version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+            _driver = std::string(vendor ? vendor : "") + "\n" + (renderer ? renderer : "") + "\n" + (version ? version : "");
+
+#if defined(GL_ARB_get_program_binary)
+            GLint formats = 0;
+            if (_core || hasGlExtension("GL_ARB_get_program_binary"))
+                glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            _binaries = formats > 0 && !_cachePath.empty();
+#endif
+            if (_binaries)
+                loadCache();
+
+            // the permutations linked by an earlier run are ready before the first frame
+            for (uint32_t flags = 0; flags < SHADER_PERMUTATIONS; flags++)
+                if (flags == normalizeFlags(flags) && _cached.count(programKey(flags)))
+                    program(flags);
+        }
+
+        ~ShaderLibrary()
+        {
+            release();
+        }
+
+        ShaderLibrary(const ShaderLibrary&) = delete;
+        ShaderLibrary& operator=(const ShaderLibrary&) = delete;
+
+        bool available() const { return _available; }
+        // Whether the context is a core profile one, where nothing falls back on the fixed function pipeline
+        bool core() const { return _core; }
+
+        // nullptr when the permutation doesn't compile, the caller falls back on the fixed function pipeline
+        const ShaderProgram *program(uint32_t flags)
+        {
+            flags = normalizeFlags(flags);
+            ShaderProgram &program = _programs[flags];
+            if (!_available || _failed[flags])
+                return nullptr;
+            if (program.program)
+                return &program;
+
+            program.program = _binaries ? linkCached(flags) : 0;
+            if (!program.program)
+                program.program = linkSources(flags);
+            if (!program.program)
+            {
+                _failed[flags] = true;
+                return nullptr;
+            }
+
+            program.model = glGetUniformLocation(program.program, "model");
+            program.diffuse = glGetUniformLocation(program.program, "diffuse");
+            program.textured = glGetUniformLocation(program.program, "textured");
+            program.positionMin = glGetUniformLocation(program.program, "positionMin");
+            program.positionScale = glGetUniformLocation(program.program, "positionScale");
+            program.texcoordMin = glGetUniformLocation(program.program, "texcoordMin");
+            program.texcoordScale = glGetUniformLocation(program.program, "texcoordScale");
+            glUseProgram(program.program);
+            glUniform1i(glGetUniformLocation(program.program, "diffuseMap"), 0);
+            glUniform3fv(glGetUniformLocation(program.program, "lightDirection"), 1, LIGHT_DIRECTION);
+            glUniform1f(glGetUniformLocation(program.program, "lightAmbient"), LIGHT_AMBIENT);
+            glUseProgram(0);
+            return &program;
+        }
+
+        // Writes the binaries linked during this run to the cache and deletes the programs
+        void release()
+        {
+            if (_cacheDirty && !writeCache())
+                std::cerr << "Cannot write the program cache " << _cachePath << std::endl;
+            _cacheDirty = false;
+            for (ShaderProgram &program: _programs)
+            {
+                if (program.program)
+                    glDeleteProgram(program.program);
+                program = ShaderProgram();
+            }
+        }
+
+    private:
+        struct CachedBinary
+        {
+            uint32_t format;
+            std::vector<char> data;
+        };
+
+        std::string _cachePath;
+        std::string _driver;
+        bool _available = false;
+        bool _core = false;
+        bool _binaries = false;
+        bool _cacheDirty = false;
+        ShaderProgram _programs[SHADER_PERMUTATIONS];
+        bool _failed[SHADER_PERMUTATIONS] = {};
+        std::unordered_map<uint64_t, CachedBinary> _cached;
+
+        // The unlit permutations don't read the normals
+        static uint32_t normalizeFlags(uint32_t flags)
+        {
+            return flags & SHADER_LIT ? flags : flags & ~SHADER_NORMALS;
+        }
+
+        std::string versionHeader(GLenum type) const
+        {
+            if (_core)
+                return type == GL_VERTEX_SHADER ? "#version 150\n#define IN in\n#define OUT out\n"
+                    : "#version 150\n#define IN in\n#define TEXTURE texture\nout vec4 fragmentColor;\n#define FRAGMENT_COLOR fragmentColor\n";
+            return type == GL_VERTEX_SHADER ? "#version 120\n#define IN attribute\n#define OUT varying\n"
+                : "#version 120\n#define IN varying\n#define TEXTURE texture2D\n#define FRAGMENT_COLOR gl_FragColor\n";
+        }
+
+        std::string source(GLenum type, uint32_t flags) const
+        {
+            std::string text = versionHeader(type);
+            if (flags & SHADER_NORMALS)
+                text += "#define HAS_NORMALS\n";
+            if (flags & SHADER_TEXCOORDS)
+                text += "#define HAS_TEXCOORDS\n";
+            if (flags & SHADER_MATERIAL)
+                text += "#define HAS_MATERIAL\n";
+            if (flags & SHADER_LIT)
+                text += "#define LIT\n";
+            if (flags & SHADER_INSTANCED)
+                text += "#define INSTANCED\n";
+            if (flags & SHADER_QUANTIZED)
+                text += "#define QUANTIZED\n";
+            glm::vec3 diffuse = Material().diffuse;
+            text += "#define DEFAULT_DIFFUSE vec3(" + std::to_string(diffuse.x) + ", " + std::to_string(diffuse.y) + ", "
+                + std::to_string(diffuse.z) + ")\n";
+            return text + (type == GL_VERTEX_SHADER ? MESH_VERTEX_SHADER : MESH_FRAGMENT_SHADER);
+        }
+
+        // FNV-1a of the driver and the sources
+        uint64_t programKey(uint32_t flags) const
+        {
+            uint64_t key = 1469598103934665603ull;
+            for (const std::string &text: {_driver, source(GL_VERTEX_SHADER, flags), source(GL_FRAGMENT_SHADER, flags)})
+                for (char c: text + '\0')
+                {
+                    key ^= (unsigned char)c;
+                    key *= 1099511628211ull;
+                }
+            return key;
+        }
+
+        GLuint linkSources(uint32_t flags)
+        {
+            GLuint vertexShader = compileShader(GL_VERTEX_SHADER, source(GL_VERTEX_SHADER, flags));
+            GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, source(GL_FRAGMENT_SHADER, flags));
+            GLuint program = 0;
+            if (vertexShader && fragmentShader)
+            {
+                program = glCreateProgram();
+                glAttachShader(program, vertexShader);
+                glAttachShader(program, fragmentShader);
+                glBindAttribLocation(program, POSITION_ATTRIBUTE, "position");
+                glBindAttribLocation(program, NORMAL_ATTRIBUTE, "normal");
+                glBindAttribLocation(program, TEXCOORD_ATTRIBUTE, "texcoord");
+                glBindAttribLocation(program, INSTANCE_MODEL_ATTRIBUTE, "instanceModel");
+#if defined(GL_ARB_get_program_binary)
+                if (_binaries)
+                    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
+                glLinkProgram(program);
+
+                GLint linked = GL_FALSE;
+                glGetProgramiv(program, GL_LINK_STATUS, &linked);
+                if (!linked)
+                {
+                    char log[1024] = "";
+                    glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+                    std::cerr << "Cannot link the mesh shader: " << log << std::endl;
+                    glDeleteProgram(program);
+                    program = 0;
+                }
+            }
+            glDeleteShader(vertexShader);
+            glDeleteShader(fragmentShader);
+
+#if defined(GL_ARB_get_program_binary)
+            if (program && _binaries)
+            {
+                GLint length = 0;
+                glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+                CachedBinary binary = {0, std::vector<char>(length)};
+                if (length > 0)
+                {
+                    glGetProgramBinary(program, length, nullptr, &binary.format, binary.data.data());
+                    _cached[programKey(flags)] = std::move(binary);
+                    _cacheDirty = true;
+                }
+            }
+#endif
+            return program;
+        }
+
+        // 0 when there is no binary or the driver refuses it (after an update for example), it is linked again then
+        GLuint linkCached(uint32_t flags)
+        {
+#if defined(GL_ARB_get_program_binary)
+            auto found = _cached.find(programKey(flags));
+            if (found == _cached.end())
+                return 0;
+
+            GLuint program = glCreateProgram();
+            glProgramBinary(program, found->second.format, found->second.data.data(), found->second.data.size());
+            GLint linked = GL_FALSE;
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+            if (linked)
+                return program;
+            glDeleteProgram(program);
+            _cached.erase(found);
+            _cacheDirty = true;
+#endif
+            (void)flags;
+            return 0;
+        }
+
+        static GLuint compileShader(GLenum type, const std::string &source)
+        {
+            GLuint shader = glCreateShader(type);
+            const char *text = source.c_str();
+            glShaderSource(shader, 1, &text, nullptr);
+            glCompileShader(shader);
+
+            GLint compiled = GL_FALSE;
+            glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+            if (!compiled)
+            {
+                char log[1024] = "";
+                glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+                std::cerr << "Cannot compile the mesh shader: " << log << std::endl;
+                glDeleteShader(shader);
+                return 0;
+            }
+            return shader;
+        }
+
+        // Anything unexpected and the cache is ignored, it is rewritten once the programs are linked again
+        void loadCache()
+        {
+            std::unique_ptr<MappedFile> file;
+            try {
+                file = std::make_unique<MappedFile>(_cachePath);
+            } catch (std::exception &) {
+                return;
+            }
+
+            std::string_view data = file->view();
+            ProgramCacheHeader header;
+            if (data.size() < sizeof(header))
+                return;
+            std::memcpy(&header, data.data(), sizeof(header));
+            if (std::memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != PROGRAM_CACHE_VERSION)
+                return;
+
+            size_t offset = sizeof(header);
+            for (uint32_t i = 0; i < header.entriesCount; i++)
+            {
+                ProgramCacheEntry entry;
+                if (data.size() - offset < sizeof(entry))
+                    return;
+                std::memcpy(&entry, data.data() + offset, sizeof(entry));
+                offset += sizeof(entry);
+                if (data.size() - offset < entry.size)
+                    return;
+                _cached[entry.key] = CachedBinary{entry.format, std::vector<char>(data.data() + offset, data.data() + offset + entry.size)};
+                offset += entry.size;
+            }
+        }
+
+        bool writeCache() const
+        {
+            std::string tmpPath = _cachePath + ".tmp" + std::to_string(getpid());
+            FILE *file = fopen(tmpPath.c_str(), "wb");
+            if (!file)
+                return false;
+
+            ProgramCacheHeader header = {};
+            std::memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+            header.version = PROGRAM_CACHE_VERSION;
+            header.entriesCount = _cached.size();
+            bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+            for (const auto &cached: _cached)
+            {
+                ProgramCacheEntry entry = {cached.first, cached.second.format, (uint32_t)cached.second.data.size()};
+                ok = ok && fwrite(&entry, sizeof(entry), 1, file) == 1;
+                ok = ok && (entry.size == 0 || fwrite(cached.second.data.data(), entry.size, 1, file) == 1);
+            }
+            ok = fclose(file) == 0 && ok;
+
+            if (!ok || rename(tmpPath.c_str(), _cachePath.c_str()) != 0)
+            {
+                unlink(tmpPath.c_str());
+                return false;
+            }
+            return true;
+        }
+};
+
+// Empty without $HOME, binaries are then not cached
+std::string getProgramCachePath()
+{
+    const char *home = getenv("HOME");
+    if (!home || !*home)
+        return "";
+    return std::string(home) + "/" + PROGRAM_CACHE_NAME;
+}
+
+// https://www.cs.cmu.edu/~mbz/personal/graphics/obj.html
+// https://en.wikipedia.org/wiki/Wavefront_.obj_file#File_format
+// http://paulbourke.net/dataformats/obj/
+class ObjectFile
+{
+    public:
+        std::string _filename;
+
+        ObjAttributes _attributes;
+        ObjFaces _faces;
+        ObjFaces _lineElements; // l records, polylines through vertexIndices
+
+        size_t _verticesCount = 0;
+        size_t _texcoordsCount = 0;
+        size_t _normalsCount = 0;
+
+        // Triangulated faces, built once after loading and uploaded on the first display()
+        std::vector<RenderVertex> _renderVertices;
+        std::vector<GLuint> _renderIndices;
+        // Level 0 is the full mesh, the simplified ones follow it in the index buffer
+        std::vector<LodLevel> _lods;
+        // The trees of all the levels, see buildClusterTree()
+        std::vector<MeshCluster> _clusters;
+        std::vector<ClusterNode> _clusterNodes;
+        bool _hasRenderNormals = false;
+        bool _hasRenderTexcoords = false;
+
+        // When loaded from the binary cache, the render data stays in the mapped file instead of the vectors above
+        // (and _attributes/_faces are left empty, only what rendering needs is cached)
+        std::unique_ptr<MappedFile> _cacheFile;
+        ArrayView<RenderVertex> _cachedRenderVertices;
+        ArrayView<GLuint> _cachedRenderIndices;
+
+        // With LoadOptions::compress, _renderVertices quantized in the box normalize() left the positions in. Compressed
+        // caches keep only these (mapped in place), the render indices are decoded and the floats only when asked for
+        bool _compress = false;
+        std::vector<PackedVertex> _packedVertices;
+        ArrayView<PackedVertex> _cachedPackedVertices;
+        VertexQuantization _quantization;
+        // Whether the buffers hold the packed vertices, drawn through the SHADER_QUANTIZED permutations. Their indices
+        // are 16 bits when there are few enough vertices, see chooseBufferFormats()
+        bool _quantized = false;
+        GLenum _indexType = GL_UNSIGNED_INT;
+
+        std::vector<RenderSegment> _segments;
+        ShaderLibrary *_shaders = nullptr; // see useShaders()
+        SharedBuffers *_sharedBuffers = nullptr; // see useSharedBuffers()
+        GLuint _lineBuffer = 0; // _lineIndices, drawn with the vertices of the first segment
+
+        // Per frame culling results, see markVisibleClusters() and collectVisibleRanges()
+        struct SegmentDraw
+        {
+            uint32_t segment;
+            uint32_t material;
+            uint32_t firstRange;
+            uint32_t rangesCount;
+        };
+        std::vector<bool> _visibleClusters;
+        std::vector<GLsizei> _drawCounts;
+        std::vector<const void*> _drawOffsets;
+        std::vector<SegmentDraw> _segmentDraws;
+        std::vector<GLsizei> _lineCounts; // of the line index buffer
+        std::vector<const void*> _lineOffsets;
+        std::vector<uint32_t> _clusterGroups; // sub-mesh of each cluster, see markVisibleClusters()
+        std::vector<bool> _subMeshesInView; // of the last markVisibleClusters() call
+        std::vector<bool> _visibleSubMeshes; // since the last collectVisibleRanges()
+        std::vector<RenderVertex> _transformedVertices; // see displayTransformed()
+
+        // Progressive loads: the loader thread hands batches over through _batches, the positions stay as in the file
+        // and the normalization is done by _normalization instead, from the bounds read so far
+        bool _progressive = false;
+        LockFreeQueue<MeshBatch> _batches;
+        // the loader waits on _batchesTaken while PROGRESSIVE_MAX_PENDING batches are not uploaded yet, see cancelLoad()
+        std::mutex _pendingMutex;
+        std::condition_variable _batchesTaken;
+        size_t _pendingBatches = 0;
+        std::atomic<bool> _cancelLoad{false};
+        glm::mat4 _normalization = glm::mat4(1.0f);
+        float _normalizationScale = 1.0f;
+
+        // Where the constructor spent its time, in seconds
+        struct LoadTimings
+        {
+            bool fromCache = false;
+            double load = 0.0; // cache lookup or parsing
+            double normalize = 0.0;
+            double renderBuffers = 0.0;
+            double lods = 0.0;
+            double clusters = 0.0;
+        };
+        LoadTimings _loadTimings;
+        // Temporaries of the render buffers, levels of detail and clusters builds, all released at once when done
+        Arena _loadArena;
+        bool _verbose = true;
+        float _creaseAngle = DEFAULT_CREASE_ANGLE;
+
+        // Lenient loads skip the lines they can't parse (and the faces with an index out of bounds) instead of failing
+        bool _lenient = false;
+        size_t _skippedLines = 0;
+        std::string _firstSkippedLine;
+
+        // mtllib, usemtl, o/g and s as read from the file, see loadMaterials(). Each run gives its state to the faces
+        // from firstFace and the lines from firstLine on, up to the next run. The elements before the first run have
+        // no material and are in the default group
+        struct ElementRun
+        {
+            size_t firstFace;
+            size_t firstLine;
+            uint32_t material;
+            uint32_t group; // in _groupNames
+            uint32_t smoothingGroup;
+        };
+        std::vector<std::string> _materialLibraries;
+        std::vector<std::string> _materialNames;
+        std::vector<std::string> _groupNames;
+        std::vector<ElementRun> _elementRuns;
+        // Parallel to _materialNames, the ones not found keep the default look
+        std::vector<Material> _materials;
+        // Index ranges drawn with the same material, see groupTriangles()
+        std::vector<MaterialRange> _materialRanges;
+        // Parallel to _groupNames, see buildSubMeshes()
+        std::vector<SubMesh> _subMeshes;
+        // GL_LINES pairs of render vertices, see buildLineBuffer()
+        std::vector<GLuint> _lineIndices;
+
+        // Of the _attributes positions, see getBounds()
+        Bounds _bounds;
+        bool _boundsValid = false;
+
+    public:
+        ObjectFile() {}
+
+        ~ObjectFile()
+        {
+            releaseRenderBuffers();
+        }
+
+        ObjectFile(const ObjectFile&) = delete;
+        ObjectFile& operator=(const ObjectFile&) = delete;
+
+        ObjectFile(const char* filename, const LoadOptions &options = LoadOptions())
+            : _filename(filename), _compress(options.compress), _verbose(options.verbose), _creaseAngle(options.creaseAngle),
+            _lenient(options.lenient)
+        {
+            auto start = std::chrono::steady_clock::now();
+            auto elapsed = [&start]() {
+                auto now = std::chrono::steady_clock::now();
+                double seconds = std::chrono::duration<double>(now - start).count();
+                start = now;
+                return seconds;
+            };
+
+            std::string cachePath = _filename + ".scopcache";
+            SourceStamp stamp;
+            bool useCache = options.useCache && getSourceStamp(_filename, stamp);
+            if (useCache && loadCache(cachePath, stamp))
+            {
+                loadMaterials();
+                _loadTimings.fromCache = true;
+                _loadTimings.load = elapsed();
+                return;
+            }
+
+            unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+            if (options.mode != LoadMode::Parallel)
+                threads = 1;
+
+            // a progressive load needs a mesh being drawn to hand its batches to, it is a stream load anywhere else
+            if (options.mode == LoadMode::Stream || options.mode == LoadMode::Progressive)
+                load(filename);
+            else
+                loadMapped(filename, threads);
+            loadMaterials();
+            _loadTimings.load = elapsed();
+            normalize();
+            _loadTimings.normalize = elapsed();
+            buildRenderBuffers(threads);
+            _loadTimings.renderBuffers = elapsed();
+            // the render buffers need the most temporaries by far, they would stay resident through the simplification
+            _loadArena.release();
+            buildLods(options.buildLods);
+            _loadTimings.lods = elapsed();
+            buildClusters();
+            _loadTimings.clusters = elapsed();
+            if (_compress)
+                packRenderVertices();
+
+            // a cache would hide the skipped lines from the next loads, the strict ones would not fail anymore
+            if (useCache && _skippedLines == 0 && !writeCache(cachePath, stamp))
+                std::cerr << "Cannot write mesh cache " << cachePath << std::endl;
+            _loadArena.release();
+        }
+
+        // The vertices of a compressed cache are unpacked the first time they are asked for
+        ArrayView<RenderVertex> renderVertices()
+        {
+            if (_cacheFile && _cachedRenderVertices.size == 0 && _cachedPackedVertices.size != 0)
+            {
+                _renderVertices.resize(_cachedPackedVertices.size);
+                unpackVertices(_cachedPackedVertices.data, _cachedPackedVertices.size, _quantization, _renderVertices.data());
+                _cachedRenderVertices = ArrayView<RenderVertex>(_renderVertices);
+            }
+            return _cacheFile ? _cachedRenderVertices : ArrayView<RenderVertex>(_renderVertices);
+        }
+
+        ArrayView<PackedVertex> packedVertices() const
+        {
+            return _cacheFile ? _cachedPackedVertices : ArrayView<PackedVertex>(_packedVertices);
+        }
+
+        ArrayView<GLuint> renderIndices() const
+        {
+            return _cacheFile ? _cachedRenderIndices : ArrayView<GLuint>(_renderIndices);
+        }
+
+        bool writeCache(const std::string &cachePath, const SourceStamp &stamp)
+        {
+            std::string sourcePath = getRealPath(_filename);
+
+            MeshCacheWriter writer;
+            writer.header.sourceSize = stamp.size;
+            writer.header.sourceMtime = stamp.mtime;
+            if (_hasRenderNormals)
+                writer.header.flags |= MESH_CACHE_HAS_NORMALS;
+            if (_hasRenderTexcoords)
+                writer.header.flags |= MESH_CACHE_HAS_TEXCOORDS;
+            writer.header.verticesCount = _verticesCount;
+            writer.header.texcoordsCount = _texcoordsCount;
+            writer.header.normalsCount = _normalsCount;
+            writer.header.creaseAngle = _creaseAngle;
+
+            writer.addSection(MESH_CACHE_SOURCE_PATH, sourcePath.data(), sourcePath.size());
+            std::vector<uint8_t> packedIndices;
+            if (_compress)
+            {
+                writer.header.flags |= MESH_CACHE_COMPRESSED;
+                packedIndices = encodeIndices(_renderIndices.data(), _renderIndices.size());
+                writer.addSection(MESH_CACHE_PACKED_VERTICES, _packedVertices.data(), _packedVertices.size() * sizeof(PackedVertex));
+                writer.addSection(MESH_CACHE_PACKED_INDICES, packedIndices.data(), packedIndices.size());
+                writer.addSection(MESH_CACHE_QUANTIZATION, &_quantization, sizeof(_quantization));
+            }
+            else
+            {
+                writer.addSection(MESH_CACHE_RENDER_VERTICES, _renderVertices.data(), _renderVertices.size() * sizeof(RenderVertex));
+                writer.addSection(MESH_CACHE_RENDER_INDICES, _renderIndices.data(), _renderIndices.size() * sizeof(GLuint));
+            }
+            writer.addSection(MESH_CACHE_LODS, _lods.data(), _lods.size() * sizeof(LodLevel));
+            writer.addSection(MESH_CACHE_CLUSTERS, _clusters.data(), _clusters.size() * sizeof(MeshCluster));
+            writer.addSection(MESH_CACHE_CLUSTER_NODES, _clusterNodes.data(), _clusterNodes.size() * sizeof(ClusterNode));
+            std::string libraries = joinNames(_materialLibraries), names = joinNames(_materialNames);
+            writer.addSection(MESH_CACHE_MATERIAL_LIBRARIES, libraries.data(), libraries.size());
+            writer.addSection(MESH_CACHE_MATERIAL_NAMES, names.data(), names.size());
+            writer.addSection(MESH_CACHE_MATERIAL_RANGES, _materialRanges.data(), _materialRanges.size() * sizeof(MaterialRange));
+            std::string groups = joinNames(_groupNames);
+            writer.addSection(MESH_CACHE_GROUP_NAMES, groups.data(), groups.size());
+            writer.addSection(MESH_CACHE_SUB_MESHES, _subMeshes.data(), _subMeshes.size() * sizeof(SubMesh));
+            writer.addSection(MESH_CACHE_LINE_INDICES, _lineIndices.data(), _lineIndices.size() * sizeof(GLuint));
+            return writer.write(cachePath);
+        }
+
+        // Maps the cache if it exists and still matches the source file, anything unexpected means it is ignored (and rewritten).
+        // So does a cache compressed or not when the load asks for the other kind
+        bool loadCache(const std::string &cachePath, const SourceStamp &stamp)
+        {
+            std::unique_ptr<MappedFile> file;
+            try {
+                file = std::make_unique<MappedFile>(cachePath);
+            } catch (FileNotFoundException &) {
+                return false;
+            }
+
+            std::string_view data = file->view();
+            if (data.size() < sizeof(MeshCacheHeader))
+                return false;
+
+            MeshCacheHeader header;
+            std::memcpy(&header, data.data(), sizeof(header));
+            if (std::memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0
+                || header.version != MESH_CACHE_VERSION || header.byteOrder != MESH_CACHE_BYTE_ORDER
+                || header.sourceSize != stamp.size || header.sourceMtime != stamp.mtime || header.creaseAngle != _creaseAngle
+                || bool(header.flags & MESH_CACHE_COMPRESSED) != _compress
+                || sizeof(MeshCacheHeader) + header.sectionsCount * sizeof(MeshCacheSection) > data.size())
+                return false;
+
+            const auto *table = reinterpret_cast<const MeshCacheSection*>(data.data() + sizeof(MeshCacheHeader));
+            std::string_view sourcePath, vertices, indices, lods, clusters, clusterNodes, materialLibraries, materialNames, materialRanges;
+            std::string_view groupNames, subMeshes, lineIndices, packedVertices, packedIndices, quantization;
+            for (uint32_t i = 0; i < header.sectionsCount; i++)
+            {
+                if (table[i].offset > data.size() || table[i].size > data.size() - table[i].offset)
+                    return false;
+
+                std::string_view section = data.substr(table[i].offset, table[i].size);
+                if (table[i].id == MESH_CACHE_SOURCE_PATH)
+                    sourcePath = section;
+                else if (table[i].id == MESH_CACHE_RENDER_VERTICES)
+                    vertices = section;
+                else if (table[i].id == MESH_CACHE_RENDER_INDICES)
+                    indices = section;
+                else if (table[i].id == MESH_CACHE_LODS)
+                    lods = section;
+                else if (table[i].id == MESH_CACHE_CLUSTERS)
+                    clusters = section;
+                else if (table[i].id == MESH_CACHE_CLUSTER_NODES)
+                    clusterNodes = section;
+                else if (table[i].id == MESH_CACHE_MATERIAL_LIBRARIES)
+                    materialLibraries = section;
+                else if (table[i].id == MESH_CACHE_MATERIAL_NAMES)
+                    materialNames = section;
+                else if (table[i].id == MESH_CACHE_MATERIAL_RANGES)
+                    materialRanges = section;
+                else if (table[i].id == MESH_CACHE_GROUP_NAMES)
+                    groupNames = section;
+                else if (table[i].id == MESH_CACHE_SUB_MESHES)
+                    subMeshes = section;
+                else if (table[i].id == MESH_CACHE_LINE_INDICES)
+                    lineIndices = section;
+                else if (table[i].id == MESH_CACHE_PACKED_VERTICES)
+                    packedVertices = section;
+                else if (table[i].id == MESH_CACHE_PACKED_INDICES)
+                    packedIndices = section;
+                else if (table[i].id == MESH_CACHE_QUANTIZATION)
+                    quantization = section;
+            }
+
+            // the indices of compressed caches are decoded here, the vertices stay packed in the mapped file
+            std::vector<GLuint> decodedIndices;
+            if (_compress)
+            {
+                if (packedVertices.size() % sizeof(PackedVertex) != 0 || quantization.size() != sizeof(VertexQuantization)
+                    || !decodeIndices(packedIndices, packedVertices.size() / sizeof(PackedVertex), decodedIndices))
+                    return false;
+                indices = std::string_view(reinterpret_cast<const char*>(decodedIndices.data()), decodedIndices.size() * sizeof(GLuint));
+            }
+
+            if (sourcePath != getRealPath(_filename) || vertices.size() % sizeof(RenderVertex) != 0 || indices.size() % sizeof(GLuint) != 0
+                || lods.empty() || lods.size() % sizeof(LodLevel) != 0 || clusters.size() % sizeof(MeshCluster) != 0
+                || clusterNodes.size() % sizeof(ClusterNode) != 0 || materialRanges.empty() || materialRanges.size() % sizeof(MaterialRange) != 0
+                || subMeshes.empty() || subMeshes.size() % sizeof(SubMesh) != 0 || lineIndices.size() % sizeof(GLuint) != 0)
+                return false;
+
+            size_t indicesCount = indices.size() / sizeof(GLuint);
+            std::vector<LodLevel> levels(lods.size() / sizeof(LodLevel));
+            std::memcpy(levels.data(), lods.data(), lods.size());
+            std::vector<MeshCluster> meshClusters(clusters.size() / sizeof(MeshCluster));
+            std::memcpy(meshClusters.data(), clusters.data(), clusters.size());
+            std::vector<ClusterNode> nodes(clusterNodes.size() / sizeof(ClusterNode));
+            std::memcpy(nodes.data(), clusterNodes.data(), clusterNodes.size());
+            std::vector<MaterialRange> ranges(materialRanges.size() / sizeof(MaterialRange));
+            std::memcpy(ranges.data(), materialRanges.data(), materialRanges.size());
+            std::vector<std::string> names = splitNames(materialNames);
+            std::vector<std::string> groups = splitNames(groupNames);
+            std::vector<SubMesh> meshes(subMeshes.size() / sizeof(SubMesh));
+            std::memcpy(meshes.data(), subMeshes.data(), subMeshes.size());
+            std::vector<GLuint> lines(lineIndices.size() / sizeof(GLuint));
+            std::memcpy(lines.data(), lineIndices.data(), lineIndices.size());
+            size_t verticesCount = _compress ? packedVertices.size() / sizeof(PackedVertex) : vertices.size() / sizeof(RenderVertex);
+
+            for (const LodLevel &level: levels)
+                if (level.indexOffset > indicesCount || level.indexCount > indicesCount - level.indexOffset || level.rootNode >= nodes.size())
+                    return false;
+            for (const MeshCluster &cluster: meshClusters)
+                if (cluster.indexOffset > indicesCount || cluster.indexCount > indicesCount - cluster.indexOffset)
+                    return false;
+            for (size_t i = 0; i < nodes.size(); i++)
+                if (nodes[i].firstCluster > meshClusters.size() || nodes[i].clustersCount > meshClusters.size() - nodes[i].firstCluster
+                    || nodes[i].skip <= i || nodes[i].skip > nodes.size())
+                    return false;
+            // the ranges cover the index buffer one after the other, every cluster is in one of them
+            size_t rangesEnd = 0;
+            for (const MaterialRange &range: ranges)
+            {
+                if (range.indexOffset != rangesEnd || range.indexCount > indicesCount - rangesEnd
+                    || (range.material != NO_MATERIAL && range.material >= names.size()) || range.group >= meshes.size())
+                    return false;
+                rangesEnd += range.indexCount;
+            }
+            if (rangesEnd != indicesCount || groups.size() != meshes.size())
+                return false;
+            for (const SubMesh &mesh: meshes)
+                if (mesh.indexOffset > indicesCount || mesh.indexCount > indicesCount - mesh.indexOffset
+                    || mesh.lineOffset > lines.size() || mesh.lineCount > lines.size() - mesh.lineOffset || mesh.lineCount % 2 != 0)
+                    return false;
+            for (GLuint index: lines)
+                if (index >= verticesCount)
+                    return false;
+            // decodeIndices() already checked those of compressed caches
+            const GLuint *triangles = reinterpret_cast<const GLuint*>(indices.data());
+            if (!_compress && std::any_of(triangles, triangles + indicesCount, [verticesCount](GLuint index) { return index >= verticesCount; }))
+                return false;
+            _lods = std::move(levels);
+            _clusters = std::move(meshClusters);
+            _clusterNodes = std::move(nodes);
+            _materialRanges = std::move(ranges);
+            _materialNames = std::move(names);
+            _materialLibraries = splitNames(materialLibraries);
+            _groupNames = std::move(groups);
+            _subMeshes = std::move(meshes);
+            _lineIndices = std::move(lines);
+
+            if (_compress)
+            {
+                _cachedPackedVertices = ArrayView<PackedVertex>(reinterpret_cast<const PackedVertex*>(packedVertices.data()), verticesCount);
+                std::memcpy(&_quantization, quantization.data(), sizeof(_quantization));
+                _renderIndices = std::move(decodedIndices);
+                _cachedRenderIndices = ArrayView<GLuint>(_renderIndices);
+            }
+            else
+            {
+                _cachedRenderVertices = ArrayView<RenderVertex>(reinterpret_cast<const RenderVertex*>(vertices.data()), verticesCount);
+                _cachedRenderIndices = ArrayView<GLuint>(reinterpret_cast<const GLuint*>(indices.data()), indices.size() / sizeof(GLuint));
+            }
+            _hasRenderNormals = header.flags & MESH_CACHE_HAS_NORMALS;
+            _hasRenderTexcoords = header.flags & MESH_CACHE_HAS_TEXCOORDS;
+            _verticesCount = header.verticesCount;
+            _texcoordsCount = header.texcoordsCount;
+            _normalsCount = header.normalsCount;
+            _cacheFile = std::move(file);
+
+            if (_verbose)
+                std::cout << "Loaded " << _filename << " from " << cachePath << std::endl;
+            return true;
+        }
+
+        void load(const char* filename)
+        {
+            if (_verbose)
+                std::cout << "Loading " << filename << std::endl;
+
+            std::ifstream file(filename);
+            if (!file.is_open())
+                throw FileNotFoundException("file " + _filename + " not found");
+
+            // The whole file is one chunk, so indices are resolved and errors ordered the same way as with loadMapped()
+            std::vector<ObjChunk> chunks(1);
+            ObjChunk &chunk = chunks[0];
+
+            std::string line;
+            std::string failedLine;
+            while (std::getline(file, line))
+            {
+                chunk.lineCount++;
+
+                // blank lines, '\r' included, are skipped like the mapped loader does
+                if (restOfLine(line, 0).empty() || line.at(0) == '#')
+                    continue;
+
+                // rejected elements are added all the same, see parseChunk()
+                ParseError error = ParseError::None;
+                if (startsWithKeyword(line, "v")) {
+                    auto vertex = parseVertex(line);
+                    error = vertex.error;
+                    chunk.attributes.addVertex(vertex.value);
+                } else if (startsWithKeyword(line, "vt")) {
+                    auto textureCoordinate = parseTextureCoordinate(line);
+                    error = textureCoordinate.error;
+                    chunk.attributes.addTextureCoordinate(textureCoordinate.value);
+                } else if (startsWithKeyword(line, "vn")) {
+                    auto normal = parseNormal(line);
+                    error = normal.error;
+                    chunk.attributes.addNormal(normal.value);
+                } else if (startsWithKeyword(line, "vp")) {
+                    auto parameterSpaceVertex = parseParameterSpaceVertex(line);
+                    error = parameterSpaceVertex.error;
+                    chunk.attributes.addParameterSpaceVertex(parameterSpaceVertex.value);
+                }  else if (startsWithKeyword(line, "f")) {
+                    auto face = parseFace(line);
+                    if (!face)
+                        error = face.error;
+                    else
+                    {
+                        for (const auto &vertex: face.value.vertices)
+                        {
+                            chunk.faces.addCorner(rawIndex(vertex.vertexIndex),
+                                vertex.textureCoordinateIndex.has_value() ? rawIndex(vertex.textureCoordinateIndex.value()) : 0,
+                                vertex.normalIndex.has_value() ? rawIndex(vertex.normalIndex.value()) : 0);
+                        }
+                        chunk.faces.endFace();
+                        chunk.faceContexts.push_back({chunk.lineCount, chunk.attributes.verticesCount(), chunk.attributes.texcoords.size(), chunk.attributes.normals.size()});
+                    }
+                } else if (startsWithKeyword(line, "l")) {
+                    auto objLine = parseLine(line);
+                    if (!objLine)
+                        error = objLine.error;
+                    else
+                    {
+                        for (int vertexIndex: objLine.value.vertexIndices)
+                            chunk.lines.addCorner(rawIndex(vertexIndex), 0, 0);
+                        chunk.lines.endFace();
+                        chunk.lineContexts.push_back({chunk.lineCount, chunk.attributes.verticesCount(), 0, 0});
+                    }
+                } else if (startsWithKeyword(line, "o") || startsWithKeyword(line, "g")) {
+                    chunk.changeState(ObjChunk::StateChange::Group, restOfLine(line, 1));
+                } else if (startsWithKeyword(line, "s")) {
+                    uint32_t smoothingGroup;
+                    if (!scanSmoothingGroup(line, 1, smoothingGroup))
+                        error = ParseError::InvalidSmoothingGroup;
+                    else
+                        chunk.changeState(ObjChunk::StateChange::Smoothing, "", smoothingGroup);
+                } else if (startsWithKeyword(line, "usemtl")) {
+                    chunk.changeState(ObjChunk::StateChange::Material, restOfLine(line, 6));
+                } else if (startsWithKeyword(line, "mtllib")) {
+                    size_t pos = 6;
+                    for (std::string_view library = nextToken(line, pos); !library.empty(); library = nextToken(line, pos))
+                        chunk.materialLibraries.emplace_back(library);
+                } else {
+                    error = ParseError::UnknownToken;
+                }
+
+                if (error == ParseError::None)
+                    continue;
+                // the failure must outlive line, which the next std::getline() reads over
+                if (!chunk.failure)
+                    failedLine = line;
+                std::string_view text = failedLine;
+                if (!chunk.reject(error, error == ParseError::UnknownToken ? text.substr(0, keywordEnd(text)) : text, _lenient))
+                    break;
+            }
+
+            mergeChunks(chunks);
+            warnSkippedLines();
+
+            if (_verbose)
+                std::cout << "Successfully loaded and parsed " << filename << std::endl;
+        }
+
+        // Same grammar as load() but tokenizes the mapped file in place, the only allocations left are the parsed elements themselves.
+        // With more than one thread the file is parsed in chunks, which are merged in file order so results and errors are the same as with one
+        void loadMapped(const char* filename, unsigned threads)
+        {
+            if (_verbose)
+                std::cout << "Loading " << filename << std::endl;
+
+            MappedFile file(filename);
+            std::vector<ObjChunk> chunks = splitChunks(file.view(), threads);
+            runParallel(chunks.size(), [this, &chunks](size_t i) { parseChunk(chunks[i], _lenient); });
+
+            mergeChunks(chunks);
+            warnSkippedLines();
+
+            if (_verbose)
+                std::cout << "Successfully loaded and parsed " << filename << std::endl;
+        }
+
+        void mergeChunks(std::vector<ObjChunk> &chunks)
+        {
+            // Prefix sums of what the previous chunks declared, nothing after the first chunk with an error matters
+            struct ChunkBase
+            {
+                size_t lineNum = 0;
+                size_t verticesCount = 0;
+                size_t texcoordsCount = 0;
+                size_t normalsCount = 0;
+                size_t facesCount = 0;
+                size_t cornersCount = 0;
+                size_t linesCount = 0;
+                size_t lineCornersCount = 0;
+            };
+
+            std::vector<ChunkBase> bases;
+            ChunkBase total;
+            bool hasTexcoords = false;
+            bool hasNormals = false;
+            for (auto &chunk: chunks)
+            {
+                bases.push_back(total);
+                total.lineNum += chunk.lineCount;
+                total.verticesCount += chunk.attributes.verticesCount();
+                total.texcoordsCount += chunk.attributes.texcoords.size();
+                total.normalsCount += chunk.attributes.normals.size();
+                total.facesCount += chunk.faces.size();
+                total.cornersCount += chunk.faces.offsets.back();
+                total.linesCount += chunk.lines.size();
+                total.lineCornersCount += chunk.lines.offsets.back();
+                hasTexcoords |= chunk.faces.hasTexcoords();
+                hasNormals |= chunk.faces.hasNormals();
+                if (chunk.failure && !_lenient)
+                    break;
+            }
+            chunks.resize(bases.size());
+
+            _faces.offsets.resize(total.facesCount + 1);
+            _faces.vertexIndices.resize(total.cornersCount);
+            _faces.texcoordIndices.assign(hasTexcoords ? total.cornersCount : 0, NO_INDEX);
+            _faces.normalIndices.assign(hasNormals ? total.cornersCount : 0, NO_INDEX);
+            _lineElements.offsets.resize(total.linesCount + 1);
+            _lineElements.vertexIndices.resize(total.lineCornersCount);
+
+            std::vector<ParseFailure> resolveFailures(chunks.size());
+            std::vector<std::vector<size_t>> rejectedFaces(chunks.size()), rejectedLines(chunks.size());
+            runParallel(chunks.size(), [&](size_t i) {
+                const ObjChunk &chunk = chunks[i];
+                const ChunkBase &base = bases[i];
+                ParseFailure faces = resolveChunkFaces(chunk.faces, chunk.faceContexts, _faces, base.lineNum, base.verticesCount,
+                    base.texcoordsCount, base.normalsCount, base.facesCount, base.cornersCount, rejectedFaces[i]);
+                ParseFailure lines = resolveChunkFaces(chunk.lines, chunk.lineContexts, _lineElements, base.lineNum, base.verticesCount,
+                    0, 0, base.linesCount, base.lineCornersCount, rejectedLines[i]);
+                resolveFailures[i] = firstFailure(faces, lines);
+            });
+
+            // The earliest line wins, which puts index errors first since every face of a strict chunk comes before its parse error
+            ParseFailure failure;
+            size_t skippedLines = 0;
+            for (size_t i = 0; i < chunks.size(); i++)
+            {
+                ParseFailure parsed = chunks[i].failure;
+                parsed.lineNum += bases[i].lineNum;
+                failure = firstFailure(failure, firstFailure(resolveFailures[i], parsed));
+                skippedLines += chunks[i].skippedLines + rejectedFaces[i].size() + rejectedLines[i].size();
+            }
+            if (failure && !_lenient)
+                throw InvalidObjFileException(failure.message());
+            _faces.offsets[total.facesCount] = total.cornersCount;
+            _lineElements.offsets[total.linesCount] = total.lineCornersCount;
+
+            std::vector<size_t> removedFaces, removedLines;
+            if (skippedLines > 0)
+            {
+                for (size_t i = 0; i < chunks.size(); i++)
+                {
+                    removedFaces.insert(removedFaces.end(), rejectedFaces[i].begin(), rejectedFaces[i].end());
+                    removedLines.insert(removedLines.end(), rejectedLines[i].begin(), rejectedLines[i].end());
+                }
+                if (!removedFaces.empty())
+                    _faces.removeFaces(removedFaces);
+                if (!removedLines.empty())
+                    _lineElements.removeFaces(removedLines);
+                skipLines(skippedLines, failure);
+            }
+
+            // Materials and groups are numbered in the order they are first used (the faces before any o/g are in the
+            // default group), the runs are shifted down by the faces and lines removed before them
+            std::unordered_map<std::string, uint32_t> materialIndices, groupIndices = {{DEFAULT_GROUP, 0}};
+            _groupNames.assign(1, DEFAULT_GROUP);
+            ElementRun state = {0, 0, NO_MATERIAL, 0, SMOOTHING_UNSET};
+            auto numberName = [](std::unordered_map<std::string, uint32_t> &indices, std::vector<std::string> &names, const std::string &name) {
+                auto inserted = indices.emplace(name, names.size());
+                if (inserted.second)
+                    names.push_back(name);
+                return inserted.first->second;
+            };
+            for (size_t i = 0; i < chunks.size(); i++)
+            {
+                for (const std::string &library: chunks[i].materialLibraries)
+                    if (std::find(_materialLibraries.begin(), _materialLibraries.end(), library) == _materialLibraries.end())
+                        _materialLibraries.push_back(library);
+
+                for (const ObjChunk::StateChange &change: chunks[i].stateChanges)
+                {
+                    if (change.kind == ObjChunk::StateChange::Material)
+                        state.material = numberName(materialIndices, _materialNames, change.name);
+                    else if (change.kind == ObjChunk::StateChange::Group)
+                        state.group = numberName(groupIndices, _groupNames, change.name.empty() ? DEFAULT_GROUP : change.name);
+                    else
+                        state.smoothingGroup = change.smoothingGroup;
+
+                    state.firstFace = bases[i].facesCount + change.firstFace;
+                    state.firstFace -= std::lower_bound(removedFaces.begin(), removedFaces.end(), state.firstFace) - removedFaces.begin();
+                    state.firstLine = bases[i].linesCount + change.firstLine;
+                    state.firstLine -= std::lower_bound(removedLines.begin(), removedLines.end(), state.firstLine) - removedLines.begin();
+                    // a change followed by another one before any element has nothing left to apply to but its state
+                    if (!_elementRuns.empty() && _elementRuns.back().firstFace == state.firstFace && _elementRuns.back().firstLine == state.firstLine)
+                        _elementRuns.back() = state;
+                    else
+                        _elementRuns.push_back(state);
+                }
+            }
+
+            if (chunks.size() == 1)
+                _attributes = std::move(chunks[0].attributes);
+            else
+            {
+                _attributes.reserve(total.verticesCount, total.texcoordsCount, total.normalsCount);
+                for (const auto &chunk: chunks)
+                    _attributes.append(chunk.attributes);
+            }
+
+            _verticesCount = total.verticesCount;
+            _texcoordsCount = total.texcoordsCount;
+            _normalsCount = total.normalsCount;
+        }
+
+        // Reads filename PROGRESSIVE_BLOCK_SIZE bytes at a time on the calling thread and hands every block over to target
+        // as a batch of render data, for target.uploadPendingBatches() to append to its buffers while the rest loads.
+        // Only the v/vt/vn records are kept since faces can refer back to any of them, the text and the faces of a block
+        // are dropped once it is sent. Normals can't be smoothed without all the faces around a vertex, the corners
+        // without one get the normal of their face. The first error is thrown like with the other loaders
+        void loadProgressive(const char *filename, ObjectFile &target)
+        {
+            if (_verbose)
+                std::cout << "Loading " << filename << " progressively" << std::endl;
+
+            std::ifstream file(filename, std::ios::binary);
+            if (!file.is_open())
+                throw FileNotFoundException("file " + _filename + " not found");
+
+            std::string buffer;
+            size_t lineBase = 0;
+            Bounds bounds;
+            double sum[3] = {0.0, 0.0, 0.0};
+            bool done = false;
+            while (!done && !target._cancelLoad)
+            {
+                size_t kept = buffer.size();
+                buffer.resize(kept + PROGRESSIVE_BLOCK_SIZE);
+                file.read(&buffer[kept], PROGRESSIVE_BLOCK_SIZE);
+                buffer.resize(kept + file.gcount());
+                done = !file;
+
+                // whole lines only, the last one waits for the next block (npos + 1 is 0 when a line is longer than a block)
+                size_t end = done ? buffer.size() : buffer.rfind('\n') + 1;
+                if (end == 0)
+                    continue;
+
+                ObjChunk chunk;
+                chunk.text = std::string_view(buffer.data(), end);
+                parseChunk(chunk, _lenient);
+
+                size_t verticesBase = _attributes.verticesCount();
+                size_t texcoordsBase = _attributes.texcoords.size();
+                size_t normalsBase = _attributes.normals.size();
+                _attributes.append(chunk.attributes);
+
+                // same order as mergeChunks(): the faces of the block come before its parse error
+                size_t cornersCount = chunk.faces.offsets.back();
+                _faces.offsets.assign(chunk.faces.size() + 1, cornersCount);
+                _faces.vertexIndices.assign(cornersCount, 0);
+                _faces.texcoordIndices.assign(chunk.faces.hasTexcoords() ? cornersCount : 0, NO_INDEX);
+                _faces.normalIndices.assign(chunk.faces.hasNormals() ? cornersCount : 0, NO_INDEX);
+                std::vector<size_t> rejectedFaces;
+                ParseFailure failure = resolveChunkFaces(chunk.faces, chunk.faceContexts, _faces, lineBase, verticesBase, texcoordsBase, normalsBase,
+                    0, 0, rejectedFaces);
+                ParseFailure parsed = chunk.failure;
+                parsed.lineNum += lineBase;
+                failure = firstFailure(failure, parsed);
+                if (failure && !_lenient)
+                    throw InvalidObjFileException(failure.message());
+                if (!rejectedFaces.empty())
+                    _faces.removeFaces(rejectedFaces);
+                if (failure)
+                    skipLines(chunk.skippedLines + rejectedFaces.size(), failure);
+                lineBase += chunk.lineCount;
+                buffer.erase(0, end);
+
+                size_t added = _attributes.verticesCount() - verticesBase;
+                if (added > 0)
+                {
+                    Bounds block = computeBounds(&_attributes.positionsX[verticesBase], &_attributes.positionsY[verticesBase],
+                        &_attributes.positionsZ[verticesBase], added);
+                    bounds.min = verticesBase ? glm::min(bounds.min, block.min) : block.min;
+                    bounds.max = verticesBase ? glm::max(bounds.max, block.max) : block.max;
+                    for (int k = 0; k < 3; k++)
+                        sum[k] += (double)block.center[k] * added;
+                    size_t total = _attributes.verticesCount();
+                    bounds.center = glm::vec3(sum[0] / total, sum[1] / total, sum[2] / total);
+                }
+
+                MeshBatch batch;
+                batch.bounds = bounds;
+                if (_faces.size() > 0)
+                {
+                    buildRenderBuffers(1, false);
+                    batch.vertices = std::move(_renderVertices);
+                    batch.indices = std::move(_renderIndices);
+                    batch.hasNormals = _hasRenderNormals;
+                    batch.hasTexcoords = _hasRenderTexcoords;
+                    _renderVertices.clear();
+                    _renderIndices.clear();
+
+                    glm::vec3 min(INFINITY), max(-INFINITY);
+                    for (const RenderVertex &vertex: batch.vertices)
+                    {
+                        glm::vec3 p(vertex.position[0], vertex.position[1], vertex.position[2]);
+                        min = glm::min(min, p);
+                        max = glm::max(max, p);
+                    }
+                    glm::vec3 center = (min + max) * 0.5f;
+                    batch.radius = 0.0f;
+                    for (const RenderVertex &vertex: batch.vertices)
+                        batch.radius = std::max(batch.radius, glm::length(glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]) - center));
+                    for (int k = 0; k < 3; k++)
+                        batch.center[k] = center[k];
+                }
+                _faces = ObjFaces();
+                // the blocks of the first batch are reused by the next ones
+                _loadArena.reset();
+
+                {
+                    std::unique_lock<std::mutex> lock(target._pendingMutex);
+                    target._batchesTaken.wait(lock, [&target]() {
+                        return target._pendingBatches < PROGRESSIVE_MAX_PENDING || target._cancelLoad;
+                    });
+                    target._pendingBatches++;
+                }
+                target._batches.push(std::move(batch));
+            }
+
+            warnSkippedLines();
+            if (_verbose && !target._cancelLoad)
+                std::cout << "Successfully loaded and parsed " << filename << std::endl;
+        }
+
+        // Empty mesh for a loadProgressive() on another thread to fill: a single level of detail, and a cluster tree
+        // made of a root with one leaf per batch
+        void startProgressive()
+        {
+            _progressive = true;
+            _lods.assign(1, LodLevel{0, 0, 0.0f, 0});
+            // usemtl, o/g and l are not read by progressive loads, everything is in the default sub-mesh
+            _materialRanges.assign(1, MaterialRange{0, 0, NO_MATERIAL, 0});
+            _groupNames.assign(1, DEFAULT_GROUP);
+            _subMeshes.assign(1, SubMesh());
+            _clusterNodes.assign(1, ClusterNode{{0.0f, 0.0f, 0.0f}, 0.0f, 0, 0, 1, 0});
+        }
+
+        // Stops a loadProgressive() into this mesh after the block it is reading, and wakes it up if it waits for room
+        void cancelLoad()
+        {
+            std::lock_guard<std::mutex> lock(_pendingMutex);
+            _cancelLoad = true;
+            _batchesTaken.notify_one();
+        }
+
+        // Appends the batches handed over since the last call to the GPU buffers, frame holds the list of them.
+        // Needs a current GL context
+        void uploadPendingBatches(Arena &frame)
+        {
+            if (!_progressive)
+                return;
+
+            ArenaVector<MeshBatch> batches{ArenaAllocator<MeshBatch>(frame)};
+            _batches.popAll(batches);
+            if (!batches.empty())
+            {
+                std::lock_guard<std::mutex> lock(_pendingMutex);
+                _pendingBatches -= batches.size();
+                _batchesTaken.notify_one();
+            }
+            for (MeshBatch &batch: batches)
+            {
+                setNormalization(batch.bounds);
+                if (batch.indices.empty())
+                    continue;
+
+                RenderSegment *segment = _segments.empty() ? nullptr : &_segments.back();
+                if (!segment || segment->verticesCount + batch.vertices.size() > segment->vertexCapacity
+                    || segment->indicesCount + batch.indices.size() > segment->indexCapacity)
+                    segment = &addSegment(std::max(SEGMENT_VERTICES, batch.vertices.size()), std::max(SEGMENT_INDICES, batch.indices.size()));
+
+                for (GLuint &index: batch.indices)
+                    index += segment->verticesCount;
+                glBindBuffer(GL_ARRAY_BUFFER, segment->vertexBuffer);
+                glBufferSubData(GL_ARRAY_BUFFER, segment->verticesCount * sizeof(RenderVertex), batch.vertices.size() * sizeof(RenderVertex),
+                    batch.vertices.data());
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, segment->indexBuffer);
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, segment->indicesCount * sizeof(GLuint), batch.indices.size() * sizeof(GLuint),
+                    batch.indices.data());
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+                MeshCluster cluster = {};
+                cluster.indexOffset = segment->firstIndex + segment->indicesCount;
+                cluster.indexCount = batch.indices.size();
+                std::memcpy(cluster.center, batch.center, sizeof(cluster.center));
+                cluster.radius = batch.radius;
+                cluster.coneAxis[2] = 1.0f;
+                cluster.coneCutoff = CONE_NEVER_CULLED;
+                segment->verticesCount += batch.vertices.size();
+                segment->indicesCount += batch.indices.size();
+
+                ClusterNode &root = _clusterNodes[0];
+                if (root.clustersCount == 0)
+                {
+                    std::memcpy(root.center, cluster.center, sizeof(root.center));
+                    root.radius = cluster.radius;
+                }
+                else
+                    mergeSpheres(root.center, root.radius, cluster.center, cluster.radius);
+                root.clustersCount++;
+                root.skip = _clusterNodes.size() + 1;
+
+                ClusterNode leaf = {{cluster.center[0], cluster.center[1], cluster.center[2]}, cluster.radius,
+                    (uint32_t)_clusters.size(), 1, root.skip, 0};
+                _clusters.push_back(cluster);
+                _clusterNodes.push_back(leaf);
+                _lods[0].indexCount += cluster.indexCount;
+                _materialRanges[0].indexCount += cluster.indexCount;
+                _subMeshes[0].indexCount += cluster.indexCount;
+                std::memcpy(_subMeshes[0].center, root.center, sizeof(root.center));
+                _subMeshes[0].radius = root.radius;
+                _hasRenderNormals |= batch.hasNormals;
+                _hasRenderTexcoords |= batch.hasTexcoords;
+            }
+        }
+
+        // Same transform as normalize() does to the positions
+        void setNormalization(const Bounds &bounds)
+        {
+            float max = std::max({std::abs(bounds.min.x), std::abs(bounds.max.x), std::abs(bounds.min.y),
+                std::abs(bounds.max.y), std::abs(bounds.min.z), std::abs(bounds.max.z)});
+            if (max == 0.0f)
+                return;
+
+            _normalizationScale = 1.0f / max;
+            _normalization = glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(_normalizationScale)), -bounds.center);
+        }
+
+        // Writes the faces (or the lines) of a chunk into target, starting at face faceBase and corner cornerBase.
+        // The other bases are the line and element counts of the chunks before it. Returns the first face with
+        // an index out of bounds, lenient loads go on and list the faces to remove (numbered as in target) in rejectedFaces
+        ParseFailure resolveChunkFaces(const ObjRawFaces &faces, const std::vector<ObjChunk::FaceContext> &contexts, ObjFaces &target,
+            size_t lineBase, size_t verticesBase, size_t texcoordsBase, size_t normalsBase, size_t faceBase, size_t cornerBase,
+            std::vector<size_t> &rejectedFaces)
+        {
+            ParseFailure failure;
+
+            for (size_t f = 0; f < faces.size(); f++)
+            {
+                const auto &context = contexts[f];
+                size_t verticesCount = verticesBase + context.verticesCount;
+                size_t texcoordsCount = texcoordsBase + context.texcoordsCount;
+                size_t normalsCount = normalsBase + context.normalsCount;
+
+                target.offsets[faceBase + f] = cornerBase + faces.offsets[f];
+                for (uint32_t c = faces.offsets[f]; c < faces.offsets[f + 1]; c++)
+                {
+                    size_t corner = cornerBase + c;
+
+                    ParseError error = ParseError::None;
+                    if (!resolveIndex(faces.vertexIndices[c], verticesCount, target.vertexIndices[corner]))
+                        error = ParseError::VertexIndexOutOfBounds;
+                    else if (faces.hasTexcoords() && faces.texcoordIndices[c] != 0 && !resolveIndex(faces.texcoordIndices[c], texcoordsCount, target.texcoordIndices[corner]))
+                        error = ParseError::TextureCoordinateIndexOutOfBounds;
+                    else if (faces.hasNormals() && faces.normalIndices[c] != 0 && !resolveIndex(faces.normalIndices[c], normalsCount, target.normalIndices[corner]))
+                        error = ParseError::NormalIndexOutOfBounds;
+
+                    if (error != ParseError::None)
+                    {
+                        if (!failure)
+                            failure = {error, lineBase + context.lineNum, std::string_view()};
+                        if (!_lenient)
+                            return failure;
+                        rejectedFaces.push_back(faceBase + f);
+                        break;
+                    }
+                }
+            }
+            return failure;
+        }
+
+        // Reads the mtllib libraries (relative to the OBJ file) for the materials named by usemtl. The first definition
+        // of a name wins, and the libraries or materials that can't be found only warn: their faces keep the default look
+        void loadMaterials()
+        {
+            std::unordered_map<std::string, Material> defined;
+            std::string directory = directoryOf(_filename);
+            for (const std::string &library: _materialLibraries)
+            {
+                try {
+                    for (Material &material: parseMaterialLibrary(resolveRelativePath(directory, library)))
+                        defined.emplace(material.name, std::move(material));
+                } catch (FileNotFoundException &e) {
+                    std::cerr << "Cannot load material library: " << e.what() << std::endl;
+                }
+            }
+
+            _materials.assign(_materialNames.size(), Material());
+            for (size_t i = 0; i < _materialNames.size(); i++)
+            {
+                auto found = defined.find(_materialNames[i]);
+                if (found != defined.end())
+                    _materials[i] = found->second;
+                else
+                    std::cerr << "Material " << _materialNames[i] << " of " << _filename << " not found" << std::endl;
+                _materials[i].name = _materialNames[i];
+            }
+        }
+
+        // Starts decoding the diffuse maps of the materials, shared with the other meshes through cache.
+        // Render thread only, like the cache
+        void acquireTextures(TextureCache &cache)
+        {
+            for (Material &material: _materials)
+                if (!material.diffuseMap.empty() && !material.texture)
+                    material.texture = cache.acquire(material.diffuseMap);
+        }
+
+        // Whether the textures of acquireTextures() are all uploaded or failed to load, until then they draw untextured
+        bool texturesReady() const
+        {
+            for (const Material &material: _materials)
+                if (material.texture && !material.texture->ready)
+                    return false;
+            return true;
+        }
+
+        // Draws with the mesh shaders of library from now on instead of the fixed function pipeline, nullptr goes back to it
+        void useShaders(ShaderLibrary *library)
+        {
+            _shaders = library;
+        }
+
+        // The next uploadRenderBuffers() goes in a range of buffers instead of buffers of its own. Not for the meshes
+        // transformed on the CPU, their client vertices are indexed from 0
+        void useSharedBuffers(SharedBuffers *buffers)
+        {
+            _sharedBuffers = buffers;
+        }
+
+        // Mesh shader permutation for the buffers of the mesh, the lines are unlit in the default color
+        uint32_t shaderFlags(bool lines) const
+        {
+            uint32_t flags = _quantized ? (uint32_t)SHADER_QUANTIZED : 0u;
+            if (lines)
+                return flags;
+            flags |= SHADER_LIT;
+            if (_hasRenderNormals)
+                flags |= SHADER_NORMALS;
+            if (_hasRenderTexcoords)
+                flags |= SHADER_TEXCOORDS;
+            if (!_materials.empty())
+                flags |= SHADER_MATERIAL;
+            return flags;
+        }
+
+        // Binds the permutation for flags with model as its transform, nullptr and nothing bound without shaders
+        // (or when it doesn't compile)
+        const ShaderProgram *useShader(uint32_t flags, const glm::mat4 &model)
+        {
+            const ShaderProgram *program = _shaders ? _shaders->program(flags) : nullptr;
+            if (!program)
+                return nullptr;
+            glUseProgram(program->program);
+            if (program->model >= 0)
+                glUniformMatrix4fv(program->model, 1, GL_FALSE, glm::value_ptr(model));
+            applyQuantization(program);
+            return program;
+        }
+
+        // The box and ranges the packed vertices are decoded with, for program already in use
+        void applyQuantization(const ShaderProgram *program) const
+        {
+            if (!_quantized)
+                return;
+            glUniform3fv(program->positionMin, 1, _quantization.positionMin);
+            glUniform3fv(program->positionScale, 1, _quantization.positionScale);
+            glUniform2fv(program->texcoordMin, 1, _quantization.texcoordMin);
+            glUniform2fv(program->texcoordScale, 1, _quantization.texcoordScale);
+        }
+
+        // Lenient loads only warn about what they skipped, once they are done (see warnSkippedLines())
+        void skipLines(size_t count, const ParseFailure &first)
+        {
+            if (_skippedLines == 0)
+                _firstSkippedLine = first.message();
+            _skippedLines += count;
+        }
+
+        void warnSkippedLines() const
+        {
+            if (_skippedLines > 0)
+                std::cerr << "Skipped " << _skippedLines << " invalid lines of " << _filename << ", the first one: " << _firstSkippedLine << std::endl;
+        }
+
+        // Area weighted smooth normals for every corner, faces further apart than _creaseAngle or in other smoothing
+        // groups (s records, s off and s 0 make flat faces) don't contribute to the corners of each other. keys numbers
+        // the distinct normals around each vertex (from 0), so that the welder only splits a vertex along creases.
+        // Runs on threads threads.
+        // Without smooth, corners get the normal of their face and keys are face numbers
+        void generateNormals(unsigned threads, bool smooth, ArenaVector<glm::vec3> &normals, ArenaVector<uint32_t> &keys)
+        {
+            size_t facesCount = _faces.size();
+            size_t cornersCount = _faces.cornersCount();
+            // the results first, the rest only lives until the end
+            normals.resize(cornersCount);
+            keys.resize(cornersCount);
+            Arena::Scope temporaries(_loadArena);
+            ArenaAllocator<uint32_t> scratch(_loadArena);
+            size_t verticesCount = _attributes.verticesCount();
+            auto position = [this](uint32_t v) {
+                return glm::vec3(_attributes.positionsX[v], _attributes.positionsY[v], _attributes.positionsZ[v]);
+            };
+            auto slices = [threads](size_t count, auto fn) {
+                size_t slicesCount = std::max<size_t>(1, std::min<size_t>(threads, count / 4096));
+                runParallel(slicesCount, [&](size_t i) {
+                    fn(count * i / slicesCount, count * (i + 1) / slicesCount);
+                });
+            };
+
+            // Newell normals, twice the area of the face long
+            ArenaVector<glm::vec3> faceNormals(facesCount, scratch);
+            ArenaVector<uint32_t> cornerFaces(cornersCount, scratch);
+            slices(facesCount, [&](size_t begin, size_t end) {
+                for (size_t f = begin; f < end; f++)
+                {
+                    glm::vec3 normal(0.0f);
+                    uint32_t first = _faces.offsets[f], last = _faces.offsets[f + 1];
+                    for (uint32_t c = first; c < last; c++)
+                    {
+                        glm::vec3 a = position(_faces.vertexIndices[c]);
+                        glm::vec3 b = position(_faces.vertexIndices[c + 1 < last ? c + 1 : first]);
+                        normal += glm::vec3((a.y - b.y) * (a.z + b.z), (a.z - b.z) * (a.x + b.x), (a.x - b.x) * (a.y + b.y));
+                        cornerFaces[c] = f;
+                    }
+                    faceNormals[f] = normal;
+                }
+            });
+
+            if (!smooth)
+            {
+                for (size_t c = 0; c < cornersCount; c++)
+                {
+                    float length = glm::length(faceNormals[cornerFaces[c]]);
+                    normals[c] = length > 0.0f ? faceNormals[cornerFaces[c]] / length : glm::vec3(0.0f, 0.0f, 1.0f);
+                    keys[c] = cornerFaces[c];
+                }
+                return;
+            }
+
+            // corners around each vertex
+            ArenaVector<uint32_t> vertexOffsets(verticesCount + 1, 0, scratch);
+            for (uint32_t v: _faces.vertexIndices)
+                vertexOffsets[v + 1]++;
+            for (size_t v = 0; v < verticesCount; v++)
+                vertexOffsets[v + 1] += vertexOffsets[v];
+            ArenaVector<uint32_t> vertexCorners(cornersCount, scratch);
+            ArenaVector<uint32_t> filled(vertexOffsets.begin(), vertexOffsets.end() - 1, scratch);
+            for (size_t c = 0; c < cornersCount; c++)
+                vertexCorners[filled[_faces.vertexIndices[c]]++] = c;
+
+            // only when the file has s records, the faces before the first one stay SMOOTHING_UNSET
+            ArenaVector<uint32_t> faceSmoothing(scratch);
+            if (std::any_of(_elementRuns.begin(), _elementRuns.end(), [](const ElementRun &run) { return run.smoothingGroup != SMOOTHING_UNSET; }))
+            {
+                faceSmoothing.resize(facesCount, SMOOTHING_UNSET);
+                for (size_t r = 0; r < _elementRuns.size(); r++)
+                {
+                    size_t last = r + 1 < _elementRuns.size() ? _elementRuns[r + 1].firstFace : facesCount;
+                    std::fill(faceSmoothing.begin() + _elementRuns[r].firstFace, faceSmoothing.begin() + last, _elementRuns[r].smoothingGroup);
+                }
+            }
+
+            // The corners of each vertex are sorted by smoothing group, then each one joins the first bucket of its group
+            // within the crease angle of the normals already in it, a new bucket otherwise. Flat faces only share a bucket
+            // with the same normal, degenerate ones go last into the first bucket of their group (the smooth normal of the
+            // vertex). A corner gets the normal of its bucket, and the bucket number as its key
+            float minCos = std::cos(glm::radians(std::min(_creaseAngle, 180.0f)));
+            slices(verticesCount, [&](size_t begin, size_t end) {
+                std::vector<uint32_t> sorted;
+                std::vector<glm::vec3> buckets; // sums of the face normals, the unit normal for flat faces
+                std::vector<uint32_t> cornerBuckets;
+                auto smoothingOf = [&](uint32_t corner) {
+                    return faceSmoothing.empty() ? SMOOTHING_UNSET : faceSmoothing[cornerFaces[corner]];
+                };
+                for (size_t v = begin; v < end; v++)
+                {
+                    const uint32_t *corners = &vertexCorners[vertexOffsets[v]];
+                    uint32_t count = vertexOffsets[v + 1] - vertexOffsets[v];
+
+                    // the corners are already in order, which breaks the ties
+                    sorted.assign(corners, corners + count);
+                    if (!faceSmoothing.empty())
+                        std::sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) {
+                            return std::make_pair(smoothingOf(a), a) < std::make_pair(smoothingOf(b), b);
+                        });
+
+                    buckets.clear();
+                    cornerBuckets.resize(count);
+                    for (uint32_t groupBegin = 0, groupEnd = 0; groupBegin < count; groupBegin = groupEnd)
+                    {
+                        uint32_t smoothing = smoothingOf(sorted[groupBegin]);
+                        for (groupEnd = groupBegin + 1; groupEnd < count && smoothingOf(sorted[groupEnd]) == smoothing; groupEnd++)
+                            ;
+                        size_t firstBucket = buckets.size();
+                        for (bool degenerate: {false, true})
+                            for (uint32_t i = groupBegin; i < groupEnd; i++)
+                            {
+                                const glm::vec3 &faceNormal = faceNormals[cornerFaces[sorted[i]]];
+                                float length = glm::length(faceNormal);
+                                if ((length == 0.0f) != degenerate)
+                                    continue;
+
+                                size_t bucket = firstBucket;
+                                if (smoothing == 0)
+                                {
+                                    glm::vec3 normal = degenerate ? glm::vec3(0.0f) : faceNormal / length;
+                                    for (; bucket < buckets.size() && buckets[bucket] != normal; bucket++)
+                                        ;
+                                    if (bucket == buckets.size())
+                                        buckets.push_back(normal);
+                                }
+                                else if (!degenerate)
+                                {
+                                    for (; bucket < buckets.size() && minCos > -1.0f
+                                        && glm::dot(faceNormal, buckets[bucket]) < minCos * length * glm::length(buckets[bucket]); bucket++)
+                                        ;
+                                    if (bucket == buckets.size())
+                                        buckets.push_back(glm::vec3(0.0f));
+                                    buckets[bucket] += faceNormal;
+                                }
+                                else if (bucket == buckets.size())
+                                    buckets.push_back(glm::vec3(0.0f));
+                                cornerBuckets[i] = bucket;
+                            }
+                    }
+
+                    for (uint32_t i = 0; i < count; i++)
+                    {
+                        const glm::vec3 &sum = buckets[cornerBuckets[i]];
+                        float length = glm::length(sum);
+                        normals[sorted[i]] = length > 0.0f ? sum / length : glm::vec3(0.0f, 0.0f, 1.0f);
+                        keys[sorted[i]] = cornerBuckets[i];
+                    }
+                }
+            });
+        }
+
+        // Corners sharing the same vertex/texcoord/normal triple are welded into one render vertex, faces are triangulated
+        // then the triangles reordered for the vertex cache. Corners without a normal get a generated one, smooth unless
+        // the faces don't all come at once
+        void buildRenderBuffers(unsigned threads = 1, bool smoothNormals = true)
+        {
+            _hasRenderTexcoords = _faces.hasTexcoords();
+
+            // the temporaries go in _loadArena, released once the mesh is built
+            ArenaAllocator<uint32_t> scratch(_loadArena);
+            ArenaVector<glm::vec3> generatedNormals(scratch);
+            ArenaVector<uint32_t> generatedKeys(scratch);
+            bool generate = !_faces.hasNormals() || std::count(_faces.normalIndices.begin(), _faces.normalIndices.end(), NO_INDEX) > 0;
+            if (generate)
+                generateNormals(threads, smoothNormals, generatedNormals, generatedKeys);
+            // generated normals are told apart from the ones of the file by their indices, past the end of _attributes.normals
+            uint32_t generatedBase = _attributes.normals.size();
+            _hasRenderNormals = _faces.size() > 0;
+
+            _renderVertices.clear();
+            _renderIndices.clear();
+            // the faces can be a small part of the mesh (see loadProgressive())
+            size_t expectedVertices = std::min(_attributes.verticesCount(), _faces.cornersCount());
+            _renderVertices.reserve(expectedVertices);
+            _renderIndices.reserve((_faces.cornersCount() - 2 * _faces.size()) * 3);
+
+            CornerWelder welder(expectedVertices);
+            std::vector<GLuint> faceVertices;
+            std::vector<glm::vec3> facePoints;
+            std::vector<uint32_t> faceTriangles;
+            // the triangles of a sub-mesh and material go in the same slot, see groupTriangles()
+            size_t materialSlots = _materialNames.size() + 1;
+            ArenaVector<uint32_t> triangleSlots(scratch);
+            triangleSlots.reserve(_renderIndices.capacity() / 3);
+            uint32_t slot = materialSlots - 1;
+            size_t nextRun = 0;
+
+            for (size_t f = 0; f < _faces.size(); f++)
+            {
+                for (; nextRun < _elementRuns.size() && _elementRuns[nextRun].firstFace <= f; nextRun++)
+                {
+                    const ElementRun &run = _elementRuns[nextRun];
+                    slot = run.group * materialSlots + (run.material == NO_MATERIAL ? materialSlots - 1 : run.material);
+                }
+
+                faceVertices.clear();
+                for (uint32_t c = _faces.offsets[f]; c < _faces.offsets[f + 1]; c++)
+                {
+                    uint32_t vertexIndex = _faces.vertexIndices[c];
+                    uint32_t texcoordIndex = _hasRenderTexcoords ? _faces.texcoordIndices[c] : NO_INDEX;
+                    uint32_t normalIndex = _faces.hasNormals() ? _faces.normalIndices[c] : NO_INDEX;
+                    if (normalIndex == NO_INDEX && generate)
+                        normalIndex = generatedBase + generatedKeys[c];
+
+                    bool inserted;
+                    GLuint welded = welder.weld(vertexIndex, texcoordIndex, normalIndex, _renderVertices.size(), inserted);
+                    faceVertices.push_back(welded);
+                    if (!inserted)
+                        continue;
+
+                    RenderVertex renderVertex = {};
+                    renderVertex.position[0] = _attributes.positionsX[vertexIndex];
+                    renderVertex.position[1] = _attributes.positionsY[vertexIndex];
+                    renderVertex.position[2] = _attributes.positionsZ[vertexIndex];
+
+                    if (normalIndex != NO_INDEX)
+                    {
+                        // unit length, the model matrix only has uniform scales so GL_RESCALE_NORMAL keeps them so
+                        glm::vec3 normal = normalIndex >= generatedBase ? generatedNormals[c] : _attributes.normals[normalIndex];
+                        if (glm::length(normal) > 0.0f)
+                            normal = glm::normalize(normal);
+                        renderVertex.normal[0] = normal.x;
+                        renderVertex.normal[1] = normal.y;
+                        renderVertex.normal[2] = normal.z;
+                    }
+                    if (texcoordIndex != NO_INDEX)
+                    {
+                        const glm::vec2 &texcoord = _attributes.texcoords[texcoordIndex];
+                        renderVertex.texcoord[0] = texcoord.x;
+                        renderVertex.texcoord[1] = texcoord.y;
+                    }
+                    _renderVertices.push_back(renderVertex);
+                }
+
+                if (faceVertices.size() == 3)
+                {
+                    _renderIndices.insert(_renderIndices.end(), faceVertices.begin(), faceVertices.end());
+                    triangleSlots.push_back(slot);
+                    continue;
+                }
+
+                facePoints.clear();
+                faceTriangles.clear();
+                for (uint32_t c = _faces.offsets[f]; c < _faces.offsets[f + 1]; c++)
+                {
+                    uint32_t vertexIndex = _faces.vertexIndices[c];
+                    facePoints.push_back(glm::vec3(_attributes.positionsX[vertexIndex], _attributes.positionsY[vertexIndex], _attributes.positionsZ[vertexIndex]));
+                }
+                triangulatePolygon(facePoints, faceTriangles);
+                for (uint32_t corner: faceTriangles)
+                    _renderIndices.push_back(faceVertices[corner]);
+                triangleSlots.resize(_renderIndices.size() / 3, slot);
+            }
+
+            groupTriangles(triangleSlots);
+            buildLineBuffer(welder);
+            buildSubMeshes();
+        }
+
+        // Sorts the triangles by sub-mesh then material (keeping their order otherwise, the ones without a material last)
+        // so that each sub-mesh is one range and each of its materials is drawn at once, then optimizes every range for
+        // the vertex cache on its own
+        void groupTriangles(const ArenaVector<uint32_t> &triangleSlots)
+        {
+            ArenaAllocator<size_t> scratch(_loadArena);
+            size_t materialSlots = _materialNames.size() + 1;
+            size_t slots = std::max<size_t>(1, _groupNames.size()) * materialSlots;
+            ArenaVector<size_t> offsets(slots + 1, 0, scratch);
+            for (uint32_t slot: triangleSlots)
+                offsets[slot + 1]++;
+            for (size_t i = 1; i < offsets.size(); i++)
+                offsets[i] += offsets[i - 1];
+
+            if (slots > 1)
+            {
+                ArenaVector<size_t> fill(offsets.begin(), offsets.end() - 1, scratch);
+                std::vector<GLuint> sorted(_renderIndices.size());
+                for (size_t t = 0; t < triangleSlots.size(); t++)
+                    std::memcpy(&sorted[fill[triangleSlots[t]]++ * 3], &_renderIndices[t * 3], 3 * sizeof(GLuint));
+                _renderIndices = std::move(sorted);
+            }
+
+            _materialRanges.clear();
+            std::vector<GLuint> indices;
+            for (size_t s = 0; s < slots; s++)
+            {
+                // an empty mesh still has its (empty) range
+                if (offsets[s + 1] == offsets[s] && !(s == slots - 1 && _materialRanges.empty()))
+                    continue;
+
+                auto first = _renderIndices.begin() + offsets[s] * 3, last = _renderIndices.begin() + offsets[s + 1] * 3;
+                indices.assign(first, last);
+                optimizeVertexCache(indices, _renderVertices.size());
+                std::copy(indices.begin(), indices.end(), first);
+                uint32_t material = s % materialSlots == materialSlots - 1 ? NO_MATERIAL : s % materialSlots;
+                _materialRanges.push_back({(uint32_t)offsets[s] * 3, (uint32_t)indices.size(), material, (uint32_t)(s / materialSlots)});
+            }
+        }
+
+        // Welds the corners of the l records into render vertices of their own (without a normal or texture coordinate,
+        // lines are not lit) and cuts the polylines in segments, sorted by sub-mesh into _lineIndices
+        void buildLineBuffer(CornerWelder &welder)
+        {
+            size_t groups = std::max<size_t>(1, _groupNames.size());
+            ArenaAllocator<GLuint> scratch(_loadArena);
+            ArenaVector<GLuint> segments(scratch);
+            ArenaVector<uint32_t> segmentGroups(scratch);
+            segments.reserve(_lineElements.cornersCount() * 2);
+            segmentGroups.reserve(_lineElements.cornersCount());
+            uint32_t group = 0;
+            size_t nextRun = 0;
+            for (size_t l = 0; l < _lineElements.size(); l++)
+            {
+                for (; nextRun < _elementRuns.size() && _elementRuns[nextRun].firstLine <= l; nextRun++)
+                    group = _elementRuns[nextRun].group;
+
+                GLuint previous = 0;
+                for (uint32_t c = _lineElements.offsets[l]; c < _lineElements.offsets[l + 1]; c++)
+                {
+                    uint32_t vertexIndex = _lineElements.vertexIndices[c];
+                    bool inserted;
+                    GLuint welded = welder.weld(vertexIndex, NO_INDEX, NO_INDEX, _renderVertices.size(), inserted);
+                    if (inserted)
+                    {
+                        RenderVertex renderVertex = {};
+                        renderVertex.position[0] = _attributes.positionsX[vertexIndex];
+                        renderVertex.position[1] = _attributes.positionsY[vertexIndex];
+                        renderVertex.position[2] = _attributes.positionsZ[vertexIndex];
+                        _renderVertices.push_back(renderVertex);
+                    }
+                    if (c > _lineElements.offsets[l])
+                    {
+                        segments.push_back(previous);
+                        segments.push_back(welded);
+                        segmentGroups.push_back(group);
+                    }
+                    previous = welded;
+                }
+            }
+
+            // counting sort by group, the segments keep their order within each
+            _subMeshes.assign(groups, SubMesh());
+            for (uint32_t g: segmentGroups)
+                _subMeshes[g].lineCount += 2;
+            for (size_t g = 1; g < groups; g++)
+                _subMeshes[g].lineOffset = _subMeshes[g - 1].lineOffset + _subMeshes[g - 1].lineCount;
+            _lineIndices.resize(segments.size());
+            ArenaVector<uint32_t> fill(groups, 0, scratch);
+            for (size_t g = 0; g < groups; g++)
+                fill[g] = _subMeshes[g].lineOffset;
+            for (size_t s = 0; s < segmentGroups.size(); s++)
+            {
+                _lineIndices[fill[segmentGroups[s]]++] = segments[s * 2];
+                _lineIndices[fill[segmentGroups[s]]++] = segments[s * 2 + 1];
+            }
+        }
+
+        // Level 0 index range and bounding sphere (from the box of its triangles and lines) of every sub-mesh,
+        // after groupTriangles() and buildLineBuffer()
+        void buildSubMeshes()
+        {
+            ArenaAllocator<glm::vec3> scratch(_loadArena);
+            ArenaVector<glm::vec3> low(_subMeshes.size(), glm::vec3(INFINITY), scratch), high(_subMeshes.size(), glm::vec3(-INFINITY), scratch);
+            auto grow = [&](size_t group, const GLuint *indices, size_t count) {
+                for (size_t i = 0; i < count; i++)
+                {
+                    const float *position = _renderVertices[indices[i]].position;
+                    glm::vec3 p(position[0], position[1], position[2]);
+                    low[group] = glm::min(low[group], p);
+                    high[group] = glm::max(high[group], p);
+                }
+            };
+
+            for (const MaterialRange &range: _materialRanges)
+            {
+                SubMesh &mesh = _subMeshes[range.group];
+                if (mesh.indexCount == 0)
+                    mesh.indexOffset = range.indexOffset;
+                mesh.indexCount += range.indexCount;
+                grow(range.group, &_renderIndices[range.indexOffset], range.indexCount);
+            }
+            for (size_t g = 0; g < _subMeshes.size(); g++)
+            {
+                SubMesh &mesh = _subMeshes[g];
+                grow(g, _lineIndices.data() + mesh.lineOffset, mesh.lineCount);
+                if (mesh.indexCount == 0 && mesh.lineCount == 0)
+                    continue;
+
+                glm::vec3 center = (low[g] + high[g]) * 0.5f;
+                mesh.center[0] = center.x;
+                mesh.center[1] = center.y;
+                mesh.center[2] = center.z;
+                mesh.radius = glm::length(high[g] - center);
+            }
+        }
+
+        // Shows or hides the sub-mesh named name, false when there is none
+        bool setSubMeshVisible(const std::string &name, bool visible)
+        {
+            auto found = std::find(_groupNames.begin(), _groupNames.end(), name);
+            if (found == _groupNames.end())
+                return false;
+            _subMeshes[found - _groupNames.begin()].visible = visible;
+            return true;
+        }
+
+        // Appends coarser versions of the mesh to _renderIndices, as long as simplifying still removes a good part of it.
+        // Every material range is simplified on its own (the edges between them are open, so they don't move) and keeps
+        // its share of the triangles, each level appends its ranges to _materialRanges
+        void buildLods(bool enabled)
+        {
+            _lods.assign(1, LodLevel{0, (uint32_t)_renderIndices.size(), 0.0f, 0});
+            if (!enabled || _renderIndices.size() / 3 < LOD_MIN_TRIANGLES)
+                return;
+
+            // With several ranges each simplifier gets the vertices of its range only, or all of them would have
+            // quadrics in every simplifier
+            struct RangeSimplifier
+            {
+                uint32_t material;
+                uint32_t group;
+                size_t triangles;
+                std::vector<RenderVertex> vertices;
+                std::vector<GLuint> globalVertices; // of the local ones, empty when the range has all of them
+                std::unique_ptr<MeshSimplifier> simplifier;
+            };
+            std::vector<RangeSimplifier> ranges(_materialRanges.size());
+            ArenaVector<GLuint> localVertices(ranges.size() > 1 ? _renderVertices.size() : 0, UINT32_MAX, ArenaAllocator<GLuint>(_loadArena));
+            for (size_t r = 0; r < ranges.size(); r++)
+            {
+                RangeSimplifier &range = ranges[r];
+                auto first = _renderIndices.begin() + _materialRanges[r].indexOffset;
+                std::vector<GLuint> indices(first, first + _materialRanges[r].indexCount);
+                range.material = _materialRanges[r].material;
+                range.group = _materialRanges[r].group;
+                range.triangles = indices.size() / 3;
+                if (ranges.size() == 1)
+                {
+                    range.simplifier = std::make_unique<MeshSimplifier>(indices, _renderVertices.data(), _renderVertices.size());
+                    continue;
+                }
+
+                for (GLuint &v: indices)
+                {
+                    if (localVertices[v] == UINT32_MAX)
+                    {
+                        localVertices[v] = range.vertices.size();
+                        range.vertices.push_back(_renderVertices[v]);
+                        range.globalVertices.push_back(v);
+                    }
+                    v = localVertices[v];
+                }
+                range.simplifier = std::make_unique<MeshSimplifier>(indices, range.vertices.data(), range.vertices.size());
+                for (GLuint v: range.globalVertices)
+                    localVertices[v] = UINT32_MAX;
+            }
+
+            size_t totalTriangles = _renderIndices.size() / 3;
+            size_t triangles = totalTriangles;
+            std::vector<GLuint> levelIndices;
+            std::vector<MaterialRange> levelRanges;
+            while (_lods.size() < LOD_LEVELS && triangles / LOD_REDUCTION >= LOD_MIN_TRIANGLES / LOD_REDUCTION)
+            {
+                triangles /= LOD_REDUCTION;
+                bool collapsedAny = false;
+                float error = 0.0f;
+                levelIndices.clear();
+                levelRanges.clear();
+                for (RangeSimplifier &range: ranges)
+                {
+                    collapsedAny |= range.simplifier->simplify(range.triangles * triangles / totalTriangles);
+                    error = std::max(error, range.simplifier->error());
+
+                    std::vector<GLuint> indices = range.simplifier->indices();
+                    if (!range.globalVertices.empty())
+                        for (GLuint &v: indices)
+                            v = range.globalVertices[v];
+                    optimizeVertexCache(indices, _renderVertices.size());
+                    levelRanges.push_back({(uint32_t)(_renderIndices.size() + levelIndices.size()), (uint32_t)indices.size(), range.material, range.group});
+                    levelIndices.insert(levelIndices.end(), indices.begin(), indices.end());
+                }
+                if (!collapsedAny || levelIndices.size() > _lods.back().indexCount * 3 / 4)
+                    break;
+
+                _lods.push_back(LodLevel{(uint32_t)_renderIndices.size(), (uint32_t)levelIndices.size(), error, 0});
+                _renderIndices.insert(_renderIndices.end(), levelIndices.begin(), levelIndices.end());
+                _materialRanges.insert(_materialRanges.end(), levelRanges.begin(), levelRanges.end());
+            }
+        }
+
+        // Builds the cluster tree of every level of detail, which reorders the triangles of its part of _renderIndices
+        void buildClusters()
+        {
+            _clusters.clear();
+            _clusterNodes.clear();
+            std::vector<size_t> cuts;
+            for (LodLevel &lod: _lods)
+            {
+                auto first = _renderIndices.begin() + lod.indexOffset;
+                std::vector<GLuint> indices(first, first + lod.indexCount);
+                cuts.clear();
+                for (const MaterialRange &range: _materialRanges)
+                    if (range.indexOffset > lod.indexOffset && range.indexOffset < lod.indexOffset + lod.indexCount)
+                        cuts.push_back((range.indexOffset - lod.indexOffset) / 3);
+                lod.rootNode = buildClusterTree(indices, lod.indexOffset, _renderVertices.data(), _clusters, _clusterNodes, cuts);
+                std::copy(indices.begin(), indices.end(), first);
+            }
+        }
+
+        // Coarsest level whose error stays under LOD_MAX_PIXEL_ERROR once scaled and projected, see viewportHeight()
+        const LodLevel &selectLod(float scale, int viewportHeight) const
+        {
+            // The projection is the identity, so the viewport height covers two model units at scale 1
+            float pixelsPerUnit = scale * viewportHeight * 0.5f;
+
+            size_t level = 0;
+            while (level + 1 < _lods.size() && _lods[level + 1].error * pixelsPerUnit <= LOD_MAX_PIXEL_ERROR)
+                level++;
+            return _lods[level];
+        }
+
+        // Needs a current GL context, so it is done lazily by display() when nobody did it before.
+        // Goes in a range of the shared buffers when there are some, see useSharedBuffers()
+        void uploadRenderBuffers()
+        {
+            chooseBufferFormats();
+            std::string_view vertices = vertexData();
+            size_t verticesCount = vertices.size() / vertexSize();
+            size_t indicesCount = renderIndices().size;
+            RenderSegment *segment;
+            if (_sharedBuffers)
+            {
+                _segments.emplace_back();
+                segment = &_segments.back();
+                _sharedBuffers->allocate(vertexSize(), verticesCount, indicesCount, *segment);
+            }
+            else
+                segment = &addSegment(verticesCount, indicesCount);
+
+            std::vector<uint8_t> storage;
+            std::string_view indices = indexData(renderIndices(), segment->baseVertex, storage);
+            glBufferSubData(GL_ARRAY_BUFFER, segment->baseVertex * vertexSize(), vertices.size(), vertices.data());
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, segment->bufferFirstIndex * indexSize(), indices.size(), indices.data());
+            segment->verticesCount = verticesCount;
+            segment->indicesCount = indicesCount;
+            uploadLineBuffer();
+        }
+
+        // Takes the place of previous, an older version of the same file, on the GPU. Its buffers (or its range of the
+        // shared buffers) are kept when the new data fits in them with the same formats, and only the UPLOAD_BLOCK_SIZE blocks that differ are uploaded.
+        // Returns the number of bytes uploaded
+        size_t updateRenderBuffers(ObjectFile &previous)
+        {
+            chooseBufferFormats();
+            std::string_view vertices = vertexData();
+            size_t indicesSize = renderIndices().size * indexSize();
+            size_t lines = _lineIndices.size() * indexSize();
+            if (previous._progressive || previous._segments.size() != 1 || (previous._segments[0].shared != nullptr) != (_sharedBuffers != nullptr)
+                || previous._quantized != _quantized
+                || previous._indexType != _indexType || vertices.size() > previous._segments[0].vertexCapacity * vertexSize()
+                || indicesSize > previous._segments[0].indexCapacity * indexSize())
+            {
+                uploadRenderBuffers();
+                return vertices.size() + indicesSize + lines;
+            }
+
+            // a range of the shared buffers is taken over as it is, both versions are indexed from the same base vertex
+            RenderSegment segment = previous._segments[0];
+            previous._segments.clear();
+            std::vector<uint8_t> storage, previousStorage;
+            std::string_view indices = indexData(renderIndices(), segment.baseVertex, storage);
+            glBindBuffer(GL_ARRAY_BUFFER, segment.vertexBuffer);
+            size_t uploaded = uploadChangedBlocks(GL_ARRAY_BUFFER, vertices, previous.vertexData(), segment.baseVertex * vertexSize());
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, segment.indexBuffer);
+            uploaded += uploadChangedBlocks(GL_ELEMENT_ARRAY_BUFFER, indices,
+                previous.indexData(previous.renderIndices(), segment.baseVertex, previousStorage), segment.bufferFirstIndex * indexSize());
+            segment.verticesCount = vertices.size() / vertexSize();
+            segment.indicesCount = indices.size() / indexSize();
+            _segments.push_back(segment);
+            uploadLineBuffer();
+            return uploaded + lines;
+        }
+
+        // Uploads the blocks of data that differ from old, what the bound buffer held until now from base on
+        static size_t uploadChangedBlocks(GLenum target, std::string_view data, std::string_view old, size_t base)
+        {
+            size_t uploaded = 0;
+            for (size_t offset = 0; offset < data.size(); offset += UPLOAD_BLOCK_SIZE)
+            {
+                size_t size = std::min(UPLOAD_BLOCK_SIZE, data.size() - offset);
+                if (offset + size <= old.size() && std::memcmp(data.data() + offset, old.data() + offset, size) == 0)
+                    continue;
+                glBufferSubData(target, base + offset, size, data.data() + offset);
+                uploaded += size;
+            }
+            return uploaded;
+        }
+
+        // The packed vertices are uploaded when there are some and their permutations compile, the fixed function
+        // pipeline can't decode them
+        void chooseBufferFormats()
+        {
+            ArrayView<PackedVertex> packed = packedVertices();
+            _quantized = packed.size != 0 && _shaders && _shaders->program(shaderFlags(false) | SHADER_QUANTIZED)
+                && (_lineIndices.empty() || _shaders->program(shaderFlags(true) | SHADER_QUANTIZED));
+            _indexType = _quantized && !_sharedBuffers && packed.size <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        }
+
+        size_t vertexSize() const
+        {
+            return _quantized ? sizeof(PackedVertex) : sizeof(RenderVertex);
+        }
+
+        size_t indexSize() const
+        {
+            return _indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+        }
+
+        // The vertices as the vertex buffer holds them
+        std::string_view vertexData()
+        {
+            if (_quantized)
+            {
+                ArrayView<PackedVertex> packed = packedVertices();
+                return std::string_view(reinterpret_cast<const char*>(packed.data), packed.size * sizeof(PackedVertex));
+            }
+            ArrayView<RenderVertex> vertices = renderVertices();
+            return std::string_view(reinterpret_cast<const char*>(vertices.data), vertices.size * sizeof(RenderVertex));
+        }
+
+        // indices plus baseVertex as an index buffer holds them, copied to storage unless they are used as they are
+        std::string_view indexData(ArrayView<GLuint> indices, GLuint baseVertex, std::vector<uint8_t> &storage) const
+        {
+            if (_indexType == GL_UNSIGNED_INT && baseVertex == 0)
+                return std::string_view(reinterpret_cast<const char*>(indices.data), indices.size * sizeof(GLuint));
+            storage.resize(indices.size * indexSize());
+            if (_indexType == GL_UNSIGNED_SHORT)
+                std::transform(indices.begin(), indices.end(), reinterpret_cast<GLushort*>(storage.data()), [baseVertex](GLuint index) {
+                    return (GLushort)(index + baseVertex);
+                });
+            else
+                std::transform(indices.begin(), indices.end(), reinterpret_cast<GLuint*>(storage.data()), [baseVertex](GLuint index) {
+                    return index + baseVertex;
+                });
+            return std::string_view(reinterpret_cast<const char*>(storage.data()), storage.size());
+        }
+
+        // Line indices go in a buffer of their own, even with shared buffers
+        void uploadLineBuffer()
+        {
+            if (_lineIndices.empty())
+                return;
+            std::vector<uint8_t> storage;
+            std::string_view lines = indexData(_lineIndices, _segments[0].baseVertex, storage);
+            glGenBuffers(1, &_lineBuffer);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _lineBuffer);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, lines.size(), lines.data(), GL_STATIC_DRAW);
+        }
+
+        // Needs the GL context the buffers were made in, done by the destructor unless done before
+        void releaseRenderBuffers()
+        {
+            for (const RenderSegment &segment: _segments)
+            {
+                if (segment.shared)
+                {
+                    segment.shared->free(segment);
+                    continue;
+                }
+                glDeleteBuffers(1, &segment.vertexBuffer);
+                glDeleteBuffers(1, &segment.indexBuffer);
+            }
+            _segments.clear();
+            if (_lineBuffer)
+                glDeleteBuffers(1, &_lineBuffer);
+            _lineBuffer = 0;
+            _quantized = false;
+            _indexType = GL_UNSIGNED_INT;
+        }
+
+        // Allocates an empty segment after the last one and leaves its buffers bound, sized for the vertex and index
+        // formats of chooseBufferFormats()
+        RenderSegment &addSegment(size_t vertexCapacity, size_t indexCapacity)
+        {
+            RenderSegment segment;
+            segment.firstIndex = _segments.empty() ? 0 : _segments.back().firstIndex + _segments.back().indicesCount;
+            segment.vertexCapacity = vertexCapacity;
+            segment.indexCapacity = indexCapacity;
+
+            glGenBuffers(1, &segment.vertexBuffer);
+            glBindBuffer(GL_ARRAY_BUFFER, segment.vertexBuffer);
+            glBufferData(GL_ARRAY_BUFFER, vertexCapacity * vertexSize(), nullptr, GL_STATIC_DRAW);
+            glGenBuffers(1, &segment.indexBuffer);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, segment.indexBuffer);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCapacity * indexSize(), nullptr, GL_STATIC_DRAW);
+
+            _segments.push_back(segment);
+            return _segments.back();
+        }
+
+        // Binds the buffers and vertex arrays of a segment, for one or more draws
+        // clientVertices replaces the vertex buffer of the segment by an array in memory, see displayTransformed().
+        // The mesh shaders read the generic attributes instead of the fixed function arrays
+        void bindRenderBuffers(const RenderSegment &segment, const RenderVertex *clientVertices = nullptr, bool generic = false)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, clientVertices ? 0 : segment.vertexBuffer);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, segment.indexBuffer);
+            const char *base = reinterpret_cast<const char*>(clientVertices);
+
+            if (generic && _quantized && !clientVertices)
+            {
+                glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+                glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), base + offsetof(PackedVertex, position));
+                if (_hasRenderNormals)
+                {
+                    glEnableVertexAttribArray(NORMAL_ATTRIBUTE);
+                    glVertexAttribPointer(NORMAL_ATTRIBUTE, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), base + offsetof(PackedVertex, normal));
+                }
+                if (_hasRenderTexcoords)
+                {
+                    glEnableVertexAttribArray(TEXCOORD_ATTRIBUTE);
+                    glVertexAttribPointer(TEXCOORD_ATTRIBUTE, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), base + offsetof(PackedVertex, texcoord));
+                }
+                return;
+            }
+            if (generic)
+            {
+                glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+                glVertexAttribPointer(POSITION_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof(RenderVertex), base + offsetof(RenderVertex, position));
+                if (_hasRenderNormals)
+                {
+                    glEnableVertexAttribArray(NORMAL_ATTRIBUTE);
+                    glVertexAttribPointer(NORMAL_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof(RenderVertex), base + offsetof(RenderVertex, normal));
+                }
+                if (_hasRenderTexcoords)
+                {
+                    glEnableVertexAttribArray(TEXCOORD_ATTRIBUTE);
+                    glVertexAttribPointer(TEXCOORD_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, sizeof(RenderVertex), base + offsetof(RenderVertex, texcoord));
+                }
+                return;
+            }
+
+            glEnableClientState(GL_VERTEX_ARRAY);
+            glVertexPointer(3, GL_FLOAT, sizeof(RenderVertex), base + offsetof(RenderVertex, position));
+            if (_hasRenderNormals)
+            {
+                glEnableClientState(GL_NORMAL_ARRAY);
+                glNormalPointer(GL_FLOAT, sizeof(RenderVertex), base + offsetof(RenderVertex, normal));
+            }
+            else
+            {
+                // the current normal is undefined after drawing from a normal array, go back to the default
+                glNormal3f(0.0f, 0.0f, 1.0f);
+            }
+            if (_hasRenderTexcoords)
+            {
+                glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+                glTexCoordPointer(2, GL_FLOAT, sizeof(RenderVertex), base + offsetof(RenderVertex, texcoord));
+            }
+
+        }
+
+        // What a material index of the draws stands for, the default look for NO_MATERIAL
+        const Material &getMaterial(uint32_t material) const
+        {
+            static const Material defaultMaterial;
+            return material < _materials.size() ? _materials[material] : defaultMaterial;
+        }
+
+        // Color and diffuse texture of a material (or the default look for NO_MATERIAL) for the next draws, through the
+        // uniforms of program when there is one. Returns whether a texture is bound, the textures still decoding are
+        // left out until they are uploaded
+        bool applyMaterial(uint32_t material, const ShaderProgram *program = nullptr)
+        {
+            const Material &current = getMaterial(material);
+            bool textured = _hasRenderTexcoords && current.texture && current.texture->id;
+
+            if (program)
+            {
+                if (program->diffuse >= 0)
+                    glUniform3f(program->diffuse, current.diffuse.x, current.diffuse.y, current.diffuse.z);
+                if (program->textured >= 0)
+                    glUniform1i(program->textured, textured);
+                if (textured)
+                    glBindTexture(GL_TEXTURE_2D, current.texture->id);
+                return textured;
+            }
+
+            glColor3f(current.diffuse.x, current.diffuse.y, current.diffuse.z);
+            if (textured)
+            {
+                glEnable(GL_TEXTURE_2D);
+                glBindTexture(GL_TEXTURE_2D, current.texture->id);
+            }
+            else
+                glDisable(GL_TEXTURE_2D);
+            return textured;
+        }
+
+        // The fixed function arrays and texturing are errors in core profiles, they are never enabled there
+        void unbindRenderBuffers()
+        {
+            glDisableVertexAttribArray(POSITION_ATTRIBUTE);
+            glDisableVertexAttribArray(NORMAL_ATTRIBUTE);
+            glDisableVertexAttribArray(TEXCOORD_ATTRIBUTE);
+            if (!_shaders || !_shaders->core())
+            {
+                glDisableClientState(GL_VERTEX_ARRAY);
+                glDisableClientState(GL_NORMAL_ARRAY);
+                glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+                glDisable(GL_TEXTURE_2D);
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        // Marks the clusters of lod that can be seen through model, until the next collectVisibleRanges(), the sub-meshes
+        // hidden or out of the view first. The view and projection are the identity, so the view volume is the [-1, 1]
+        // cube, looked at along +z (the depth test keeps the lowest z). Returns false when nothing is (lines included),
+        // scale is the one of model
+        bool markVisibleClusters(const LodLevel &lod, const glm::mat4 &model, float scale, const CullingOptions &culling)
+        {
+            _visibleClusters.resize(_clusters.size(), false);
+
+            // the clusters never straddle material ranges, so each one is in a single sub-mesh
+            if (_subMeshes.size() > 1 && _clusterGroups.size() != _clusters.size())
+            {
+                _clusterGroups.resize(_clusters.size());
+                for (size_t c = 0; c < _clusters.size(); c++)
+                {
+                    auto range = std::upper_bound(_materialRanges.begin(), _materialRanges.end(), _clusters[c].indexOffset,
+                        [](uint32_t offset, const MaterialRange &range) { return offset < range.indexOffset; });
+                    _clusterGroups[c] = (range - 1)->group;
+                }
+            }
+            bool allInView = true, linesInView = false;
+            _subMeshesInView.resize(_subMeshes.size());
+            _visibleSubMeshes.resize(_subMeshes.size(), false);
+            for (size_t g = 0; g < _subMeshes.size(); g++)
+            {
+                const SubMesh &mesh = _subMeshes[g];
+                _subMeshesInView[g] = mesh.visible && mesh.radius >= 0.0f
+                    && (!culling.frustum || classifySphere(model, scale, mesh.center, mesh.radius) >= 0);
+                allInView &= _subMeshesInView[g];
+                linesInView |= _subMeshesInView[g] && mesh.lineCount > 0;
+                if (_subMeshesInView[g])
+                    _visibleSubMeshes[g] = true;
+            }
+
+            // z of the normals once rotated: the cluster faces away when its whole cone is within 90 degrees of +z
+            glm::vec3 viewZ = glm::vec3(model[0][2], model[1][2], model[2][2]) / scale;
+            auto markClusters = [&](uint32_t first, uint32_t count) {
+                bool marked = false;
+                for (uint32_t c = first; c < first + count; c++)
+                {
+                    const MeshCluster &cluster = _clusters[c];
+                    if (!allInView && !_subMeshesInView[_subMeshes.size() > 1 ? _clusterGroups[c] : 0])
+                        continue;
+                    if (culling.backfaces && glm::dot(glm::vec3(cluster.coneAxis[0], cluster.coneAxis[1], cluster.coneAxis[2]), viewZ) >= cluster.coneCutoff)
+                        continue;
+                    _visibleClusters[c] = true;
+                    marked = true;
+                }
+                return marked;
+            };
+
+            const ClusterNode *nodes = _clusterNodes.data();
+            uint32_t end = nodes[lod.rootNode].skip;
+            bool marked = false;
+            for (uint32_t n = lod.rootNode; n < end; )
+            {
+                const ClusterNode &node = nodes[n];
+                int side = culling.frustum ? classifySphere(model, scale, node.center, node.radius) : 1;
+                if (node.clustersCount == 0 || side < 0)
+                {
+                    n = node.skip;
+                    continue;
+                }
+                // the sphere of a leaf is the one of its cluster, there is nothing tighter to test
+                if (side > 0 || node.clustersCount == 1)
+                {
+                    marked |= markClusters(node.firstCluster, node.clustersCount);
+                    n = node.skip;
+                    continue;
+                }
+                n++;
+            }
+            return marked || linesInView;
+        }
+
+        // -1 if the sphere is outside the view volume once transformed, 1 if it is inside, 0 if it crosses it
+        static int classifySphere(const glm::mat4 &model, float scale, const float *center, float radius)
+        {
+            glm::vec4 c = model * glm::vec4(center[0], center[1], center[2], 1.0f);
+            float r = radius * scale;
+            int side = 1;
+            for (int k = 0; k < 3; k++)
+            {
+                if (c[k] - r > 1.0f || c[k] + r < -1.0f)
+                    return -1;
+                if (c[k] - r < -1.0f || c[k] + r > 1.0f)
+                    side = 0;
+            }
+            return side;
+        }
+
+        // Index ranges of the clusters of lod marked since the last call into _drawCounts and _drawOffsets, consecutive
+        // clusters of the same segment and material merged into one range, and the ranges of each segment and material
+        // in _segmentDraws (the sub-meshes sharing a material are drawn at once). The lines of the sub-meshes in view go
+        // in _lineCounts and _lineOffsets. Returns the number of ranges, lines included. The temporaries go in frame
+        size_t collectVisibleRanges(const LodLevel &lod, Arena &frame)
+        {
+            _drawCounts.clear();
+            _drawOffsets.clear();
+            _segmentDraws.clear();
+            _lineCounts.clear();
+            _lineOffsets.clear();
+            _visibleSubMeshes.resize(_subMeshes.size(), false);
+            for (size_t g = 0; g < _subMeshes.size(); g++)
+            {
+                bool visible = _visibleSubMeshes[g];
+                _visibleSubMeshes[g] = false;
+                if (!visible || _subMeshes[g].lineCount == 0)
+                    continue;
+                _lineCounts.push_back(_subMeshes[g].lineCount);
+                _lineOffsets.push_back(reinterpret_cast<const void*>(_subMeshes[g].lineOffset * indexSize()));
+            }
+
+            const ClusterNode &root = _clusterNodes[lod.rootNode];
+            uint32_t segment = 0;
+            size_t range = 0;
+            uint32_t end = 0;
+            for (uint32_t c = root.firstCluster; c < root.firstCluster + root.clustersCount; c++)
+            {
+                if (!_visibleClusters[c])
+                    continue;
+                _visibleClusters[c] = false;
+
+                // clusters never straddle segments nor materials, and come in index order like both
+                const MeshCluster &cluster = _clusters[c];
+                while (cluster.indexOffset >= _segments[segment].firstIndex + _segments[segment].indicesCount)
+                    segment++;
+                while (cluster.indexOffset >= _materialRanges[range].indexOffset + _materialRanges[range].indexCount)
+                    range++;
+                uint32_t material = _materialRanges[range].material;
+                if (_segmentDraws.empty() || _segmentDraws.back().segment != segment || _segmentDraws.back().material != material)
+                    _segmentDraws.push_back(SegmentDraw{segment, material, (uint32_t)_drawCounts.size(), 0});
+                else if (cluster.indexOffset == end)
+                {
+                    _drawCounts.back() += cluster.indexCount;
+                    end += cluster.indexCount;
+                    continue;
+                }
+
+                _drawCounts.push_back(cluster.indexCount);
+                _drawOffsets.push_back(reinterpret_cast<const void*>((cluster.indexOffset - _segments[segment].firstIndex
+                    + _segments[segment].bufferFirstIndex) * indexSize()));
+                _segmentDraws.back().rangesCount++;
+                end = cluster.indexOffset + cluster.indexCount;
+            }
+            if (_subMeshes.size() > 1)
+                batchSegmentDraws(frame);
+            return _drawCounts.size() + _lineCounts.size();
+        }
+
+        // Reorders the draws of collectVisibleRanges() by segment then material, and merges the ones of the same
+        // material that the sub-meshes kept apart
+        void batchSegmentDraws(Arena &frame)
+        {
+            // given back right away, the frame goes through many meshes
+            Arena::Scope temporaries(frame);
+            ArenaVector<SegmentDraw> draws(_segmentDraws.begin(), _segmentDraws.end(), ArenaAllocator<SegmentDraw>(frame));
+            std::stable_sort(draws.begin(), draws.end(), [](const SegmentDraw &a, const SegmentDraw &b) {
+                return a.segment != b.segment ? a.segment < b.segment : a.material < b.material;
+            });
+            ArenaVector<GLsizei> counts(_drawCounts.begin(), _drawCounts.end(), ArenaAllocator<GLsizei>(frame));
+            ArenaVector<const void*> offsets(_drawOffsets.begin(), _drawOffsets.end(), ArenaAllocator<const void*>(frame));
+
+            _drawCounts.clear();
+            _drawOffsets.clear();
+            _segmentDraws.clear();
+            for (const SegmentDraw &draw: draws)
+            {
+                if (_segmentDraws.empty() || _segmentDraws.back().segment != draw.segment || _segmentDraws.back().material != draw.material)
+                    _segmentDraws.push_back(SegmentDraw{draw.segment, draw.material, (uint32_t)_drawCounts.size(), 0});
+                _drawCounts.insert(_drawCounts.end(), counts.begin() + draw.firstRange, counts.begin() + draw.firstRange + draw.rangesCount);
+                _drawOffsets.insert(_drawOffsets.end(), offsets.begin() + draw.firstRange, offsets.begin() + draw.firstRange + draw.rangesCount);
+                _segmentDraws.back().rangesCount += draw.rangesCount;
+            }
+        }
+
+        // Draws the lines of the last collectVisibleRanges() unlit in the default color, with the vertices of the first
+        // segment (or clientVertices, see bindRenderBuffers()). With the mesh shaders, program is the one of the lines
+        // (see shaderFlags()) and already in use
+        void drawLines(const RenderVertex *clientVertices = nullptr, const ShaderProgram *program = nullptr)
+        {
+            if (_lineCounts.empty())
+                return;
+
+            bindRenderBuffers(_segments[0], clientVertices, program != nullptr);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _lineBuffer);
+            applyMaterial(NO_MATERIAL, program);
+            if (program)
+            {
+                glMultiDrawElements(GL_LINES, _lineCounts.data(), _indexType, _lineOffsets.data(), _lineCounts.size());
+                return;
+            }
+            GLboolean lighting = glIsEnabled(GL_LIGHTING);
+            glDisable(GL_LIGHTING);
+            glMultiDrawElements(GL_LINES, _lineCounts.data(), _indexType, _lineOffsets.data(), _lineCounts.size());
+            if (lighting)
+                glEnable(GL_LIGHTING);
+        }
+
+        // Draws one copy with the fixed function pipeline, scale picks the level of detail and the culling temporaries
+        // go in frame. With a transformPool the vertices are transformed on the CPU instead, see displayTransformed()
+        void display(const glm::mat4 &model, float scale, Arena &frame, int viewportHeight, const CullingOptions &culling = CullingOptions(),
+            ThreadPool *transformPool = nullptr)
+        {
+            if (_segments.empty() && !_progressive)
+                uploadRenderBuffers();
+
+            const LodLevel &lod = selectLod(scale, viewportHeight);
+            markVisibleClusters(lod, model, scale, culling);
+            if (collectVisibleRanges(lod, frame) == 0)
+                return;
+
+            // the vertices of progressive loads are only kept by the GPU
+            if (transformPool && !_progressive)
+            {
+                displayTransformed(model, scale, *transformPool);
+                return;
+            }
+
+            const ShaderProgram *program = useShader(shaderFlags(false), model);
+            if (!program)
+            {
+                glPushMatrix();
+                glMultMatrixf(glm::value_ptr(model));
+            }
+
+            for (size_t i = 0; i < _segmentDraws.size(); i++)
+            {
+                const SegmentDraw &draw = _segmentDraws[i];
+                if (i == 0 || _segmentDraws[i - 1].segment != draw.segment)
+                    bindRenderBuffers(_segments[draw.segment], nullptr, program != nullptr);
+                applyMaterial(draw.material, program);
+                glMultiDrawElements(GL_TRIANGLES, &_drawCounts[draw.firstRange], _indexType, &_drawOffsets[draw.firstRange],
+                    draw.rangesCount);
+            }
+            if (!program)
+                drawLines();
+            else if (!_lineCounts.empty())
+            {
+                // skipped when the permutation of the lines doesn't compile, the fixed function matrix isn't set
+                const ShaderProgram *linesProgram = useShader(shaderFlags(true), model);
+                if (linesProgram)
+                    drawLines(nullptr, linesProgram);
+            }
+            unbindRenderBuffers();
+
+            if (program)
+                glUseProgram(0);
+            else
+                glPopMatrix();
+            glFlush();
+        }
+
+        // Draws the ranges of the last collectVisibleRanges() from vertices transformed by model on the CPU, sliced across
+        // the pool, with the GL matrices left alone. For legacy contexts that run the fixed function transform in software
+        // on a single thread. The normal matrix is the rotation, model only scales uniformly
+        void displayTransformed(const glm::mat4 &model, float scale, ThreadPool &pool)
+        {
+            ArrayView<RenderVertex> vertices = renderVertices();
+            _transformedVertices.resize(vertices.size);
+            glm::mat3 normalMatrix = glm::mat3(model) * (1.0f / scale);
+            pool.parallelFor(vertices.size, TRANSFORM_MIN_RANGE, [&](size_t begin, size_t end) {
+                transformVertices(model, normalMatrix, vertices.data + begin, _transformedVertices.data() + begin, end - begin);
+            });
+
+            for (size_t i = 0; i < _segmentDraws.size(); i++)
+            {
+                const SegmentDraw &draw = _segmentDraws[i];
+                if (i == 0 || _segmentDraws[i - 1].segment != draw.segment)
+                    bindRenderBuffers(_segments[draw.segment], _transformedVertices.data());
+                applyMaterial(draw.material);
+                glMultiDrawElements(GL_TRIANGLES, &_drawCounts[draw.firstRange], _indexType, &_drawOffsets[draw.firstRange],
+                    draw.rangesCount);
+            }
+            drawLines(_transformedVertices.data());
+            unbindRenderBuffers();
+            glFlush();
+        }
+
+        // Computed on first use and kept until the positions change
+        const Bounds &getBounds()
+        {
+            if (!_boundsValid)
+            {
+                _bounds = computeBounds(_attributes.positionsX.data(), _attributes.positionsY.data(), _attributes.positionsZ.data(),
+                    _attributes.verticesCount());
+                _boundsValid = true;
+            }
+            return _bounds;
+        }
+
+        glm::vec3 getCenterPoint()
+        {
+            return getBounds().center;
+        }
+
+        // Make all vertices coordinates between -1 and 1
+        void normalize()
+        {
+            const Bounds &bounds = getBounds();
+            glm::vec3 centerPoint = bounds.center;
+            std::vector<float> &xs = _attributes.positionsX;
+            std::vector<float> &ys = _attributes.positionsY;
+            std::vector<float> &zs = _attributes.positionsZ;
+            size_t count = _attributes.verticesCount();
+
+            // largest absolute coordinate, taken before centering
+            float max = std::max({std::abs(bounds.min.x), std::abs(bounds.max.x), std::abs(bounds.min.y),
+                std::abs(bounds.max.y), std::abs(bounds.min.z), std::abs(bounds.max.z)});
+            // all at the origin, which is already centered and the box of the packed positions
+            if (max == 0.0f)
+                return;
+
+            // the box the positions end up in, the packed ones are relative to it
+            for (int c = 0; c < 3; c++)
+            {
+                _quantization.positionMin[c] = (bounds.min[c] - centerPoint[c]) / max;
+                _quantization.positionScale[c] = (bounds.max[c] - bounds.min[c]) / max;
+            }
+
+            for (size_t i = 0; i < count; i++)
+            {
+                xs[i] = (xs[i] - centerPoint.x) / max;
+                ys[i] = (ys[i] - centerPoint.y) / max;
+                zs[i] = (zs[i] - centerPoint.z) / max;
+            }
+            _boundsValid = false;
+        }
+
+        // Fills _packedVertices, the texture coordinates are relative to their own range
+        void packRenderVertices()
+        {
+            float low[2] = {0.0f, 0.0f}, high[2] = {0.0f, 0.0f};
+            if (_hasRenderTexcoords && !_renderVertices.empty())
+            {
+                for (int c = 0; c < 2; c++)
+                    low[c] = high[c] = _renderVertices[0].texcoord[c];
+                for (const RenderVertex &vertex: _renderVertices)
+                    for (int c = 0; c < 2; c++)
+                    {
+                        low[c] = std::min(low[c], vertex.texcoord[c]);
+                        high[c] = std::max(high[c], vertex.texcoord[c]);
+                    }
+            }
+            for (int c = 0; c < 2; c++)
+            {
+                _quantization.texcoordMin[c] = low[c];
+                _quantization.texcoordScale[c] = high[c] - low[c];
+            }
+
+            _packedVertices.resize(_renderVertices.size());
+            packVertices(_renderVertices.data(), _renderVertices.size(), _quantization, _packedVertices.data());
+        }
+};
+
+
+// One placement of a mesh, several instances can share the same ObjectFile.
+// normalize() leaves meshes centered on the origin, so the translation is also the center of the object
+class ObjectInstance
+{
+    public:
+        std::shared_ptr<ObjectFile> _mesh;
+
+        // Model transform, applied when drawing so the geometry is never touched after loading
+        double _scale = 1.0;
+        glm::quat _orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+        glm::vec3 _translation = glm::vec3(0.0f, 0.0f, 0.0f);
+
+        // Where center() brings the object back, and the scale that scale() limits are relative to
+        glm::vec3 _home = glm::vec3(0.0f, 0.0f, 0.0f);
+        double _baseScale = 1.0;
+
+    public:
+        ObjectInstance(std::shared_ptr<ObjectFile> mesh, const glm::vec3 &home = glm::vec3(0.0f, 0.0f, 0.0f), double scale = 1.0)
+            : _mesh(std::move(mesh)), _scale(scale), _translation(home), _home(home), _baseScale(scale) {}
+
+        // translation * rotation * scale, the mesh is scaled and rotated around its center then moved.
+        // Meshes still loading progressively are normalized first
+        glm::mat4 getModelMatrix() const
+        {
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), _translation);
+            model = model * glm::mat4_cast(_orientation);
+            return glm::scale(model, glm::vec3(_scale, _scale, _scale)) * _mesh->_normalization;
+        }
+
+        // Of getModelMatrix()
+        float getMeshScale() const
+        {
+            return _scale * _mesh->_normalizationScale;
+        }
+
+        void display(Arena &frame, int viewportHeight, const CullingOptions &culling = CullingOptions(), ThreadPool *transformPool = nullptr)
+        {
+            _mesh->display(getModelMatrix(), getMeshScale(), frame, viewportHeight, culling, transformPool);
+        }
+
+        // Rotates around x, then y, then z (in degrees), around the center of the object
+        void rotate(float angleXDeg, float angleYDeg, float angleZDeg)
+        {
+            glm::quat rotation = glm::angleAxis(glm::radians(angleZDeg), glm::vec3(0.0f, 0.0f, 1.0f))
+                * glm::angleAxis(glm::radians(angleYDeg), glm::vec3(0.0f, 1.0f, 0.0f))
+                * glm::angleAxis(glm::radians(angleXDeg), glm::vec3(1.0f, 0.0f, 0.0f));
+
+            _orientation = glm::normalize(rotation * _orientation);
+        }
+
+        void translate(float x, float y, float z)
+        {
+            _translation += glm::vec3(x, y, z);
+        }
+
+        void scale(float factor)
+        {
+            if (factor == 0.0f || _scale * factor < 0.01f * _baseScale || _scale * factor > 2.0f * _baseScale)
+                return;
+
+            _scale *= factor;
+        }
+
+        // Moves the object back to where it started
+        void center()
+        {
+            _translation = _home;
+        }
+};
+
+// Entry points of the instanced draws, core from GL 3.3 and from ARB_instanced_arrays and ARB_draw_instanced before.
+// The legacy macOS context only has the ARB ones and its core profile only the core ones
+struct InstancingFunctions
+{
+    void (*vertexAttribDivisor)(GLuint index, GLuint divisor) = nullptr;
+    void (*drawElementsInstanced)(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instances) = nullptr;
+
+    // Of the current context, both nullptr without instancing
+    static InstancingFunctions load()
+    {
+        InstancingFunctions functions;
+#if defined(GL_ARB_instanced_arrays) && defined(GL_ARB_draw_instanced)
+        if (getGlVersion() >= 33)
+        {
+            functions.vertexAttribDivisor = glVertexAttribDivisor;
+            functions.drawElementsInstanced = glDrawElementsInstanced;
+        }
+        else if (hasGlExtension("GL_ARB_instanced_arrays") && hasGlExtension("GL_ARB_draw_instanced"))
+        {
+            functions.vertexAttribDivisor = glVertexAttribDivisorARB;
+            functions.drawElementsInstanced = glDrawElementsInstancedARB;
+        }
+#endif
+        return functions;
+    }
+
+    bool available() const { return vertexAttribDivisor && drawElementsInstanced; }
+};
+
+// Draws all the instances of a mesh with one glDrawElementsInstanced, their model matrices coming from a per instance
+// attribute read by the SHADER_INSTANCED permutations of the mesh shaders. Needs instancing (see InstancingFunctions),
+// which both macOS contexts have; without it (or the shaders) available() is false and instances are drawn one by one
+class InstanceRenderer
+{
+    public:
+        InstanceRenderer(ShaderLibrary *shaders): _shaders(shaders)
+        {
+#if defined(GL_ARB_instanced_arrays) && defined(GL_ARB_draw_instanced)
+            _instancing = InstancingFunctions::load();
+            if (!_shaders || !_instancing.available())
+                return;
+            if (!_shaders->program(SHADER_INSTANCED | SHADER_LIT | SHADER_NORMALS))
+            {
+                std::cerr << "Cannot link the instancing shader, drawing instances one by one" << std::endl;
+                return;
+            }
+            glGenBuffers(1, &_instanceBuffer);
+#endif
+        }
+
+        ~InstanceRenderer()
+        {
+            if (_instanceBuffer)
+                glDeleteBuffers(1, &_instanceBuffer);
+        }
+
+        InstanceRenderer(const InstanceRenderer&) = delete;
+        InstanceRenderer& operator=(const InstanceRenderer&) = delete;
+
+        bool available() const { return _instanceBuffer != 0; }
+
+        // All instances must share mesh, the largest scale picks the level of detail for all of them.
+        // Instances with no visible cluster are left out, the clusters visible in any instance are drawn for all of them.
+        // The model matrices and the culling temporaries go in frame
+        void draw(ObjectFile &mesh, const std::unique_ptr<ObjectInstance> *instances, size_t count, Arena &frame, int viewportHeight,
+            const CullingOptions &culling = CullingOptions())
+        {
+            if (mesh._segments.empty() && !mesh._progressive)
+                mesh.uploadRenderBuffers();
+
+            // a permutation that doesn't compile leaves the instances to the fixed function pipeline
+            const ShaderProgram *program = _shaders->program(mesh.shaderFlags(false) | SHADER_INSTANCED);
+            if (!program)
+            {
+                for (size_t i = 0; i < count; i++)
+                    instances[i]->display(frame, viewportHeight, culling);
+                return;
+            }
+
+            float scale = 0.0f;
+            for (size_t i = 0; i < count; i++)
+                scale = std::max(scale, instances[i]->getMeshScale());
+            const LodLevel &lod = mesh.selectLod(scale, viewportHeight);
+
+            ArenaVector<glm::mat4> models{ArenaAllocator<glm::mat4>(frame)};
+            models.reserve(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                glm::mat4 model = instances[i]->getModelMatrix();
+                if (mesh.markVisibleClusters(lod, model, instances[i]->getMeshScale(), culling))
+                    models.push_back(model);
+            }
+            if (mesh.collectVisibleRanges(lod, frame) == 0)
+                return;
+
+#if defined(GL_ARB_instanced_arrays) && defined(GL_ARB_draw_instanced)
+
+            // orphaned each frame, so the driver never waits for the previous frame to be done with it
+            glBindBuffer(GL_ARRAY_BUFFER, _instanceBuffer);
+            glBufferData(GL_ARRAY_BUFFER, models.size() * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, models.size() * sizeof(glm::mat4), models.data());
+            for (GLuint column = 0; column < 4; column++)
+            {
+                GLuint location = INSTANCE_MODEL_ATTRIBUTE + column;
+                glEnableVertexAttribArray(location);
+                glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), reinterpret_cast<void*>(column * sizeof(glm::vec4)));
+                _instancing.vertexAttribDivisor(location, 1);
+            }
+
+            // there is no instanced glMultiDrawElements before indirect draws
+            glUseProgram(program->program);
+            mesh.applyQuantization(program);
+            for (size_t draw = 0; draw < mesh._segmentDraws.size(); draw++)
+            {
+                const ObjectFile::SegmentDraw &segmentDraw = mesh._segmentDraws[draw];
+                if (draw == 0 || mesh._segmentDraws[draw - 1].segment != segmentDraw.segment)
+                    mesh.bindRenderBuffers(mesh._segments[segmentDraw.segment], nullptr, true);
+                mesh.applyMaterial(segmentDraw.material, program);
+                for (size_t i = segmentDraw.firstRange; i < segmentDraw.firstRange + segmentDraw.rangesCount; i++)
+                    _instancing.drawElementsInstanced(GL_TRIANGLES, mesh._drawCounts[i], mesh._indexType, mesh._drawOffsets[i], models.size());
+            }
+
+            const ShaderProgram *linesProgram = mesh._lineCounts.empty() ? nullptr : _shaders->program(mesh.shaderFlags(true) | SHADER_INSTANCED);
+            if (linesProgram)
+            {
+                glUseProgram(linesProgram->program);
+                mesh.applyQuantization(linesProgram);
+                mesh.bindRenderBuffers(mesh._segments[0], nullptr, true);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh._lineBuffer);
+                mesh.applyMaterial(NO_MATERIAL, linesProgram);
+                for (size_t i = 0; i < mesh._lineCounts.size(); i++)
+                    _instancing.drawElementsInstanced(GL_LINES, mesh._lineCounts[i], mesh._indexType, mesh._lineOffsets[i], models.size());
+            }
+            glUseProgram(0);
+
+            for (GLuint column = 0; column < 4; column++)
+            {
+                _instancing.vertexAttribDivisor(INSTANCE_MODEL_ATTRIBUTE + column, 0);
+                glDisableVertexAttribArray(INSTANCE_MODEL_ATTRIBUTE + column);
+            }
+            mesh.unbindRenderBuffers();
+            glFlush();
+#endif
+        }
+
+    private:
+        ShaderLibrary *_shaders;
+        InstancingFunctions _instancing;
+        GLuint _instanceBuffer = 0;
+};
+
+
+// Instances first to first + count - 1 of a Scene all draw mesh, loaded from the file-th distinct file
+struct MeshGroup
+{
+    std::shared_ptr<ObjectFile> mesh;
+    size_t first;
+    size_t count;
+    size_t file;
+};
+
+// Owns the instances shown in the window, and draws them all together. The meshes are packed into SharedBuffers and
+// their visible ranges sorted by mode, shader permutation, buffers, texture, material and then depth (front to back),
+// so that consecutive draws change as little state as possible. With ARB_multi_draw_indirect and ARB_base_instance
+// each change of state costs a single glMultiDrawElementsIndirect, the model matrices coming from the per instance
+// attribute of the SHADER_INSTANCED permutations. Without them each instance sets its matrix for its own
+// glMultiDrawElements, and the copies of a mesh go through the InstanceRenderer. Without the shaders (or with the CPU
+// transform) the instances are displayed one by one. The GL objects need the context from useShaders() to release()
+class Scene
+{
+    public:
+        // The copies of a file given once are laid out on a grid of cellsPerFile cells
+        Scene(size_t cellsPerFile): _cellsPerFile(std::max<size_t>(cellsPerFile, 1)) {}
+
+        ~Scene()
+        {
+            release();
+        }
+
+        Scene(const Scene&) = delete;
+        Scene& operator=(const Scene&) = delete;
+
+        // Once the context exists, before drawing. shaders is nullptr for the fixed function pipeline, the meshes
+        // transformed on transformPool stay out of the shared buffers. The meshes already added are prepared again
+        void useShaders(ShaderLibrary *shaders, ThreadPool *transformPool)
+        {
+            _shaders = shaders;
+            _transformPool = transformPool;
+            _instanceRenderer = std::make_unique<InstanceRenderer>(shaders);
+#if defined(GL_ARB_multi_draw_indirect) && defined(GL_ARB_base_instance) && defined(GL_ARB_instanced_arrays)
+            _instancing = InstancingFunctions::load();
+            bool indirect = getGlVersion() >= 43 || (hasGlExtension("GL_ARB_multi_draw_indirect") && hasGlExtension("GL_ARB_base_instance"));
+            if (_shaders && !_transformPool && indirect && _instancing.available()
+                && _shaders->program(SHADER_INSTANCED | SHADER_LIT | SHADER_NORMALS))
+            {
+                glGenBuffers(1, &_modelBuffer);
+                glGenBuffers(1, &_indirectBuffer);
+            }
+#endif
+            for (const MeshGroup &group: _groups)
+                prepareMesh(*group.mesh);
+        }
+
+        // Before mesh is uploaded, that picks its vertex format and the buffers it goes in. The progressive loads add
+        // segments of their own as they go
+        void prepareMesh(ObjectFile &mesh)
+        {
+            if (_transformPool)
+                return;
+            mesh.useShaders(_shaders);
+            if (!mesh._progressive)
+                mesh.useSharedBuffers(&_buffers);
+        }
+
+        // copies instances of mesh, the file-th distinct file
+        void addMesh(std::shared_ptr<ObjectFile> mesh, size_t copies, size_t file)
+        {
+            _groups.push_back(MeshGroup{mesh, _instances.size(), copies, file});
+            size_t side = std::ceil(std::sqrt((double)_cellsPerFile));
+            for (size_t i = 0; i < copies; i++)
+            {
+                size_t cell = i % _cellsPerFile;
+                glm::vec3 home(0.0f, 0.0f, 0.0f);
+                if (side > 1)
+                    home = glm::vec3((cell % side + 0.5f) * 2.0f / side - 1.0f, 1.0f - (cell / side + 0.5f) * 2.0f / side, 0.0f);
+                _instances.push_back(std::make_unique<ObjectInstance>(mesh, home, 1.0 / side));
+            }
+        }
+
+        // nullptr until the file-th file is added
+        MeshGroup *findFile(size_t file)
+        {
+            for (MeshGroup &group: _groups)
+                if (group.file == file)
+                    return &group;
+            return nullptr;
+        }
+
+        // mesh takes the place of the one of group once it is uploaded (see ObjectFile::updateRenderBuffers()), the
+        // instances keep their transforms. The previous mesh goes away with its buffers
+        void replaceMesh(MeshGroup &group, std::shared_ptr<ObjectFile> mesh)
+        {
+            group.mesh->cancelLoad();
+            group.mesh->releaseRenderBuffers();
+            for (size_t i = group.first; i < group.first + group.count; i++)
+                _instances[i]->_mesh = mesh;
+            group.mesh = std::move(mesh);
+        }
+
+        const std::vector<std::unique_ptr<ObjectInstance>> &instances() const { return _instances; }
+        const std::vector<MeshGroup> &groups() const { return _groups; }
+
+        // Progressive loads still running may keep their mesh a bit longer, without its buffers
+        void release()
+        {
+            for (const MeshGroup &group: _groups)
+            {
+                group.mesh->cancelLoad();
+                group.mesh->releaseRenderBuffers();
+            }
+            _groups.clear();
+            _instances.clear();
+            _instanceRenderer.reset();
+            if (_modelBuffer)
+                glDeleteBuffers(1, &_modelBuffer);
+            if (_indirectBuffer)
+                glDeleteBuffers(1, &_indirectBuffer);
+            _modelBuffer = 0;
+            _indirectBuffer = 0;
+            _buffers.release();
+        }
+
+        // Everything built for the draws of the frame goes in frame, which the caller resets once per frame
+        void draw(Arena &frame, const CullingOptions &culling = CullingOptions())
+        {
+            int height = viewportHeight();
+            if (!_shaders || _transformPool)
+            {
+                for (const std::unique_ptr<ObjectInstance> &instance: _instances)
+                    instance->display(frame, height, culling, _transformPool);
+                return;
+            }
+
+            bool indirect = _indirectBuffer != 0;
+            FrameDraws draws(frame);
+            draws.models.reserve(_instances.size());
+            for (const MeshGroup &group: _groups)
+            {
+                if (group.count > 1 && !indirect && _instanceRenderer->available())
+                {
+                    _instanceRenderer->draw(*group.mesh, &_instances[group.first], group.count, frame, height, culling);
+                    continue;
+                }
+                for (size_t i = group.first; i < group.first + group.count; i++)
+                    collectDraws(draws, *_instances[i], height, culling, indirect ? (uint32_t)SHADER_INSTANCED : 0u);
+            }
+            if (draws.draws.empty())
+                return;
+
+            std::sort(draws.draws.begin(), draws.draws.end(), [](const SceneDraw &a, const SceneDraw &b) {
+                return std::tie(a.mode, a.flags, a.vertexBuffer, a.indexBuffer, a.texture, a.state, a.material, a.depth)
+                    < std::tie(b.mode, b.flags, b.vertexBuffer, b.indexBuffer, b.texture, b.state, b.material, b.depth);
+            });
+            if (indirect)
+                submitIndirect(draws);
+            else
+                submit(draws);
+
+            glUseProgram(0);
+            draws.draws.back().mesh->unbindRenderBuffers();
+            glFlush();
+        }
+
+    private:
+        // Ranges of one segment (or of the lines) of one instance drawn with the same material
+        struct SceneDraw
+        {
+            GLenum mode; // GL_TRIANGLES or GL_LINES
+            uint32_t flags; // of the permutation
+            GLuint vertexBuffer;
+            GLuint indexBuffer;
+            GLuint texture; // 0 when untextured
+            const ObjectFile *state; // the mesh when its uniforms differ from the other meshes (quantization, materials)
+            uint32_t material;
+            float depth; // of the center of the instance, the lowest z is in front
+            ObjectFile *mesh;
+            const RenderSegment *segment;
+            uint32_t model; // in FrameDraws::models
+            uint32_t firstRange; // in FrameDraws::counts and FrameDraws::offsets
+            uint32_t rangesCount;
+        };
+
+        // Layout of the commands read by glMultiDrawElementsIndirect
+        struct DrawElementsIndirectCommand
+        {
+            GLuint count;
+            GLuint instanceCount;
+            GLuint firstIndex;
+            GLuint baseVertex;
+            GLuint baseInstance;
+        };
+
+        // Draws of the same state follow each other in FrameDraws::draws, and their commands in the indirect buffer
+        struct DrawBatch
+        {
+            size_t firstDraw;
+            size_t firstCommand;
+            size_t commandsCount;
+        };
+
+        size_t _cellsPerFile;
+        std::vector<std::unique_ptr<ObjectInstance>> _instances; // of a group are contiguous, see MeshGroup
+        std::vector<MeshGroup> _groups;
+        ShaderLibrary *_shaders = nullptr;
+        ThreadPool *_transformPool = nullptr;
+        SharedBuffers _buffers;
+        std::unique_ptr<InstanceRenderer> _instanceRenderer;
+        InstancingFunctions _instancing;
+        GLuint _modelBuffer = 0; // with the indirect draws only
+        GLuint _indirectBuffer = 0;
+
+        // Built by draw() each frame, in the arena of the frame
+        struct FrameDraws
+        {
+            Arena &arena;
+            ArenaVector<SceneDraw> draws;
+            ArenaVector<glm::mat4> models;
+            ArenaVector<GLsizei> counts;
+            ArenaVector<const void*> offsets;
+
+            explicit FrameDraws(Arena &arena): arena(arena), draws(ArenaAllocator<SceneDraw>(arena)), models(ArenaAllocator<glm::mat4>(arena)),
+                counts(ArenaAllocator<GLsizei>(arena)), offsets(ArenaAllocator<const void*>(arena)) {}
+        };
+
+        // The visible ranges of instance into draws, extraFlags is added to the permutations. An instance whose
+        // permutation doesn't compile is displayed right away by the fixed function pipeline
+        void collectDraws(FrameDraws &draws, ObjectInstance &instance, int viewportHeight, const CullingOptions &culling, uint32_t extraFlags)
+        {
+            ObjectFile &mesh = *instance._mesh;
+            if (mesh._segments.empty() && !mesh._progressive)
+                mesh.uploadRenderBuffers();
+            uint32_t flags = mesh.shaderFlags(false) | extraFlags;
+            if (!_shaders->program(flags))
+            {
+                instance.display(draws.arena, viewportHeight, culling);
+                return;
+            }
+
+            glm::mat4 model = instance.getModelMatrix();
+            float scale = instance.getMeshScale();
+            const LodLevel &lod = mesh.selectLod(scale, viewportHeight);
+            mesh.markVisibleClusters(lod, model, scale, culling);
+            if (mesh.collectVisibleRanges(lod, draws.arena) == 0)
+                return;
+
+            uint32_t modelIndex = draws.models.size();
+            draws.models.push_back(model);
+            const ObjectFile *state = mesh._quantized || !mesh._materials.empty() ? &mesh : nullptr;
+            // the mesh is centered on the origin, see normalize()
+            float depth = model[3][2];
+            for (const ObjectFile::SegmentDraw &draw: mesh._segmentDraws)
+            {
+                const RenderSegment &segment = mesh._segments[draw.segment];
+                const Material &material = mesh.getMaterial(draw.material);
+                GLuint texture = mesh._hasRenderTexcoords && material.texture ? material.texture->id : 0;
+                draws.draws.push_back(SceneDraw{GL_TRIANGLES, flags, segment.vertexBuffer, segment.indexBuffer, texture, state,
+                    draw.material, depth, &mesh, &segment, modelIndex, (uint32_t)draws.counts.size(), draw.rangesCount});
+                draws.counts.insert(draws.counts.end(), mesh._drawCounts.begin() + draw.firstRange, mesh._drawCounts.begin() + draw.firstRange + draw.rangesCount);
+                draws.offsets.insert(draws.offsets.end(), mesh._drawOffsets.begin() + draw.firstRange, mesh._drawOffsets.begin() + draw.firstRange + draw.rangesCount);
+            }
+
+            // skipped when the permutation of the lines doesn't compile, like ObjectFile::display() does
+            uint32_t linesFlags = mesh.shaderFlags(true) | extraFlags;
+            if (mesh._lineCounts.empty() || !_shaders->program(linesFlags))
+                return;
+            draws.draws.push_back(SceneDraw{GL_LINES, linesFlags, mesh._segments[0].vertexBuffer, mesh._lineBuffer, 0, mesh._quantized ? &mesh : nullptr,
+                NO_MATERIAL, depth, &mesh, &mesh._segments[0], modelIndex, (uint32_t)draws.counts.size(), (uint32_t)mesh._lineCounts.size()});
+            draws.counts.insert(draws.counts.end(), mesh._lineCounts.begin(), mesh._lineCounts.end());
+            draws.offsets.insert(draws.offsets.end(), mesh._lineOffsets.begin(), mesh._lineOffsets.end());
+        }
+
+        static bool sameState(const SceneDraw &a, const SceneDraw &b)
+        {
+            return std::tie(a.mode, a.flags, a.vertexBuffer, a.indexBuffer, a.texture, a.state, a.material)
+                == std::tie(b.mode, b.flags, b.vertexBuffer, b.indexBuffer, b.texture, b.state, b.material);
+        }
+
+        // Goes from the state of previous (nullptr for the first draw) to the one of draw, only changing what differs.
+        // Returns the program in use
+        const ShaderProgram *applyState(const SceneDraw &draw, const SceneDraw *previous, const ShaderProgram *program)
+        {
+            bool newProgram = !previous || previous->flags != draw.flags;
+            if (newProgram)
+            {
+                // the arrays of the previous permutation may not be read by this one
+                if (previous)
+                    previous->mesh->unbindRenderBuffers();
+                program = _shaders->program(draw.flags);
+                glUseProgram(program->program);
+            }
+            if (newProgram || previous->vertexBuffer != draw.vertexBuffer || previous->indexBuffer != draw.indexBuffer)
+            {
+                draw.mesh->bindRenderBuffers(*draw.segment, nullptr, true);
+                // the lines have an index buffer of their own
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, draw.indexBuffer);
+            }
+            if (newProgram || previous->state != draw.state)
+                draw.mesh->applyQuantization(program);
+            if (newProgram || previous->state != draw.state || previous->texture != draw.texture || previous->material != draw.material)
+                draw.mesh->applyMaterial(draw.material, program);
+            return program;
+        }
+
+        // One glMultiDrawElements per draw, with the model matrix of its instance
+        void submit(const FrameDraws &draws)
+        {
+            const ShaderProgram *program = nullptr;
+            for (size_t i = 0; i < draws.draws.size(); i++)
+            {
+                const SceneDraw &draw = draws.draws[i];
+                program = applyState(draw, i == 0 ? nullptr : &draws.draws[i - 1], program);
+                if (program->model >= 0)
+                    glUniformMatrix4fv(program->model, 1, GL_FALSE, glm::value_ptr(draws.models[draw.model]));
+                glMultiDrawElements(draw.mode, &draws.counts[draw.firstRange], draw.mesh->_indexType, &draws.offsets[draw.firstRange], draw.rangesCount);
+            }
+        }
+
+        // One glMultiDrawElementsIndirect per state, an instance picks its model matrix with baseInstance
+        void submitIndirect(const FrameDraws &draws)
+        {
+#if defined(GL_ARB_multi_draw_indirect) && defined(GL_ARB_base_instance) && defined(GL_ARB_instanced_arrays)
+            ArenaVector<DrawElementsIndirectCommand> commands{ArenaAllocator<DrawElementsIndirectCommand>(draws.arena)};
+            ArenaVector<DrawBatch> batches{ArenaAllocator<DrawBatch>(draws.arena)};
+            commands.reserve(draws.counts.size());
+            batches.reserve(draws.draws.size());
+            for (size_t i = 0; i < draws.draws.size(); i++)
+            {
+                const SceneDraw &draw = draws.draws[i];
+                if (i == 0 || !sameState(draws.draws[i - 1], draw))
+                    batches.push_back(DrawBatch{i, commands.size(), 0});
+                // the offsets already include where the segment starts in the shared buffers
+                GLuint indexSize = draw.mesh->indexSize();
+                for (size_t range = draw.firstRange; range < draw.firstRange + draw.rangesCount; range++)
+                    commands.push_back(DrawElementsIndirectCommand{(GLuint)draws.counts[range], 1,
+                        (GLuint)(reinterpret_cast<uintptr_t>(draws.offsets[range]) / indexSize), 0, draw.model});
+                batches.back().commandsCount += draw.rangesCount;
+            }
+
+            // orphaned each frame, like the instances of InstanceRenderer
+            glBindBuffer(GL_ARRAY_BUFFER, _modelBuffer);
+            glBufferData(GL_ARRAY_BUFFER, draws.models.size() * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, draws.models.size() * sizeof(glm::mat4), draws.models.data());
+            for (GLuint column = 0; column < 4; column++)
+            {
+                GLuint location = INSTANCE_MODEL_ATTRIBUTE + column;
+                glEnableVertexAttribArray(location);
+                glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), reinterpret_cast<void*>(column * sizeof(glm::vec4)));
+                _instancing.vertexAttribDivisor(location, 1);
+            }
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+
+            const ShaderProgram *program = nullptr;
+            for (size_t b = 0; b < batches.size(); b++)
+            {
+                const SceneDraw &draw = draws.draws[batches[b].firstDraw];
+                program = applyState(draw, b == 0 ? nullptr : &draws.draws[batches[b - 1].firstDraw], program);
+                glMultiDrawElementsIndirect(draw.mode, draw.mesh->_indexType,
+                    reinterpret_cast<const void*>(batches[b].firstCommand * sizeof(DrawElementsIndirectCommand)), batches[b].commandsCount, 0);
+            }
+
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            for (GLuint column = 0; column < 4; column++)
+            {
+                _instancing.vertexAttribDivisor(INSTANCE_MODEL_ATTRIBUTE + column, 0);
+                glDisableVertexAttribArray(INSTANCE_MODEL_ATTRIBUTE + column);
+            }
+#else
+            (void)draws;
+#endif
+        }
+};
+
+
+enum class FramePacing
+{
+    Deadline, // wait for the next 1 / fps deadline
+    Vsync, // let glfwSwapBuffers block on the display refresh
+    Uncapped // as fast as possible, for benchmarking
+};
+
+// Last part of a wait spent spinning instead of sleeping, the scheduler wakes up later than asked by about that much
+constexpr std::chrono::microseconds SCHEDULER_SPIN_TIME(1000);
+// Longest frame delta handed to the animation, so a stall (window drag, breakpoint...) does not make objects jump
+constexpr double MAX_FRAME_DELTA = 0.1;
+
+// Paces frames and measures the time between them. Needs a current GL context to set the swap interval
+class FrameScheduler
+{
+    public:
+        FrameScheduler(FramePacing pacing, double fps) : _pacing(pacing)
+        {
+            _period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / std::max(fps, 1.0)));
+            glfwSwapInterval(pacing == FramePacing::Vsync ? 1 : 0);
+            _frameStart = std::chrono::steady_clock::now();
+            _deadline = _frameStart + _period;
+        }
+
+        // Seconds since the previous frame started (or since construction), to scale the animation with
+        double beginFrame()
+        {
+            auto now = std::chrono::steady_clock::now();
+            double delta = std::chrono::duration<double>(now - _frameStart).count();
+            _frameStart = now;
+            return std::min(delta, MAX_FRAME_DELTA);
+        }
+
+        // Blocks until the next frame deadline when pacing by deadline
+        void waitNextFrame()
+        {
+            if (_pacing != FramePacing::Deadline)
+                return;
+
+            auto now = std::chrono::steady_clock::now();
+            // Deadlines follow each other so rounding never accumulates, unless we are a whole frame late:
+            // then start over from now instead of rushing frames to catch up
+            if (now > _deadline + _period)
+                _deadline = now;
+            else
+                waitUntil(_deadline);
+            _deadline += _period;
+        }
+
+    private:
+        FramePacing _pacing;
+        std::chrono::steady_clock::duration _period;
+        std::chrono::steady_clock::time_point _frameStart;
+        std::chrono::steady_clock::time_point _deadline;
+
+        // sleep_for can overshoot by a lot, so only sleep until shortly before and spin the rest
+        static void waitUntil(std::chrono::steady_clock::time_point deadline)
+        {
+            for (auto now = std::chrono::steady_clock::now(); now < deadline; now = std::chrono::steady_clock::now())
+            {
+                if (deadline - now > SCHEDULER_SPIN_TIME)
+                    std::this_thread::sleep_for(deadline - now - SCHEDULER_SPIN_TIME);
+                else
+                    std::this_thread::yield();
+            }
+        }
+};
+
+// Parts of a frame timed by the profiler
+enum class ProfileScope
+{
+    Input,
+    Transform,
+    Display,
+    Swap,
+    Sleep,
+    Count
+};
+
+constexpr size_t PROFILE_SCOPES_COUNT = (size_t)ProfileScope::Count;
+constexpr const char *PROFILE_SCOPE_NAMES[PROFILE_SCOPES_COUNT] = {"input", "transform", "display", "swap", "sleep"};
+constexpr size_t PROFILE_FRAMES = 256;
+// GPU timer queries are read back that many frames later so that reading them never stalls the pipeline
+constexpr size_t GPU_QUERY_LATENCY = 4;
+
+// Per frame CPU scope timings and GPU time kept in a ring buffer, summarized as rolling percentiles
+class FrameProfiler
+{
+    public:
+        struct FrameSample
+        {
+            uint64_t frame;
+            double totalMs;
+            double scopesMs[PROFILE_SCOPES_COUNT];
+            double gpuMs; // negative when unknown
+        };
+
+        // Adds the time spent between its construction and destruction to a scope of the current frame
+        class Scope
+        {
+            public:
+                Scope(FrameProfiler *profiler, ProfileScope scope) : _profiler(profiler), _scope(scope), _start(std::chrono::steady_clock::now()) {}
+                ~Scope()
+                {
+                    if (_profiler)
+                        _profiler->add(_scope, std::chrono::steady_clock::now() - _start);
+                }
+                Scope(const Scope&) = delete;
+                Scope& operator=(const Scope&) = delete;
+
+            private:
+                FrameProfiler *_profiler;
+                ProfileScope _scope;
+                std::chrono::steady_clock::time_point _start;
+        };
+
+        FrameProfiler(const std::string &csvPath)
+        {
+            if (csvPath.empty())
+                return;
+            _csv.open(csvPath);
+            if (!_csv)
+                throw FileNotFoundException("Cannot open profile output " + csvPath);
+            _csv << "frame,total_ms";
+            for (const char *name: PROFILE_SCOPE_NAMES)
+                _csv << "," << name << "_ms";
+            _csv << ",gpu_ms" << std::endl;
+        }
+
+        ~FrameProfiler()
+        {
+            for (uint64_t frame = _frame > GPU_QUERY_LATENCY ? _frame - GPU_QUERY_LATENCY : 0; frame < _frame; frame++)
+                writeCsv(frame);
+#ifdef GL_TIME_ELAPSED_EXT
+            if (_gpuTimer)
+                glDeleteQueries(GPU_QUERY_LATENCY, _queries);
+#endif
+        }
+
+        FrameProfiler(const FrameProfiler&) = delete;
+        FrameProfiler& operator=(const FrameProfiler&) = delete;
+
+        // Needs a current GL context, GPU times stay unknown without EXT_timer_query (or ARB_timer_query, core from 3.3).
+        // Core profiles don't have the EXT entry point
+        void initGpuTimer()
+        {
+#ifdef GL_TIME_ELAPSED_EXT
+            if (getGlVersion() >= 33 || hasGlExtension("GL_ARB_timer_query"))
+                _getQueryResult = glGetQueryObjectui64v;
+            else if (hasGlExtension("GL_EXT_timer_query"))
+                _getQueryResult = glGetQueryObjectui64vEXT;
+            else
+                return;
+            glGenQueries(GPU_QUERY_LATENCY, _queries);
+            _gpuTimer = true;
+#endif
+        }
+
+        void beginFrame()
+        {
+            FrameSample &sample = _samples[_frame % PROFILE_FRAMES];
+            sample = FrameSample();
+            sample.frame = _frame;
+            sample.gpuMs = -1.0;
+            _frameStart = std::chrono::steady_clock::now();
+        }
+
+        // Brackets the GL commands of the frame
+        void beginGpu()
+        {
+#ifdef GL_TIME_ELAPSED_EXT
+            if (!_gpuTimer)
+                return;
+            GLuint query = _queries[_frame % GPU_QUERY_LATENCY];
+            if (_frame >= GPU_QUERY_LATENCY)
+            {
+                GLint available = 0;
+                glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available)
+                {
+                    GLuint64EXT elapsed = 0;
+                    _getQueryResult(query, GL_QUERY_RESULT, &elapsed);
+                    _samples[(_frame - GPU_QUERY_LATENCY) % PROFILE_FRAMES].gpuMs = elapsed / 1e6;
+                }
+            }
+            glBeginQuery(GL_TIME_ELAPSED_EXT, query);
+#endif
+        }
+
+        void endGpu()
+        {
+#ifdef GL_TIME_ELAPSED_EXT
+            if (_gpuTimer)
+                glEndQuery(GL_TIME_ELAPSED_EXT);
+#endif
+        }
+
+        void endFrame()
+        {
+            _samples[_frame % PROFILE_FRAMES].totalMs = toMs(std::chrono::steady_clock::now() - _frameStart);
+            if (_frame >= GPU_QUERY_LATENCY)
+                writeCsv(_frame - GPU_QUERY_LATENCY);
+            _frame++;
+        }
+
+        void add(ProfileScope scope, std::chrono::steady_clock::duration elapsed)
+        {
+            _samples[_frame % PROFILE_FRAMES].scopesMs[(size_t)scope] += toMs(elapsed);
+        }
+
+        // Rolling frame and GPU time percentiles and mean scope times over the last PROFILE_FRAMES frames
+        std::string summary() const
+        {
+            size_t count = std::min<uint64_t>(_frame, PROFILE_FRAMES);
+            if (count == 0)
+                return std::string();
+
+            std::vector<double> totals, gpu;
+            double scopes[PROFILE_SCOPES_COUNT] = {};
+            for (size_t i = 0; i < count; i++)
+            {
+                const FrameSample &sample = _samples[(_frame - 1 - i) % PROFILE_FRAMES];
+                totals.push_back(sample.totalMs);
+                for (size_t s = 0; s < PROFILE_SCOPES_COUNT; s++)
+                    scopes[s] += sample.scopesMs[s];
+                if (sample.gpuMs >= 0.0)
+                    gpu.push_back(sample.gpuMs);
+            }
+
+            char buffer[256];
+            int length = snprintf(buffer, sizeof(buffer), "frame p50 %.2f p95 %.2f p99 %.2f ms |",
+                percentile(totals, 0.50), percentile(totals, 0.95), percentile(totals, 0.99));
+            for (size_t s = 0; s < PROFILE_SCOPES_COUNT && length < (int)sizeof(buffer); s++)
+                length += snprintf(buffer + length, sizeof(buffer) - length, " %s %.2f", PROFILE_SCOPE_NAMES[s], scopes[s] / count);
+            if (!gpu.empty() && length < (int)sizeof(buffer))
+                snprintf(buffer + length, sizeof(buffer) - length, " gpu p50 %.2f p95 %.2f", percentile(gpu, 0.50), percentile(gpu, 0.95));
+            return buffer;
+        }
+
+    private:
+        FrameSample _samples[PROFILE_FRAMES] = {};
+        uint64_t _frame = 0;
+        std::chrono::steady_clock::time_point _frameStart;
+        std::ofstream _csv;
+        bool _gpuTimer = false;
+        GLuint _queries[GPU_QUERY_LATENCY] = {};
+#ifdef GL_TIME_ELAPSED_EXT
+        void (*_getQueryResult)(GLuint id, GLenum name, GLuint64EXT *result) = nullptr;
+#endif
+
+        static double toMs(std::chrono::steady_clock::duration elapsed)
+        {
+            return std::chrono::duration<double, std::milli>(elapsed).count();
+        }
+
+        static double percentile(std::vector<double> values, double rank)
+        {
+            size_t n = std::min(values.size() - 1, (size_t)(rank * values.size()));
+            std::nth_element(values.begin(), values.begin() + n, values.end());
+            return values[n];
+        }
+
+        // Frames are written once their GPU time had the chance to come back
+        void writeCsv(uint64_t frame)
+        {
+            if (!_csv.is_open() || frame + PROFILE_FRAMES < _frame)
+                return;
+            const FrameSample &sample = _samples[frame % PROFILE_FRAMES];
+            _csv << sample.frame << "," << sample.totalMs;
+            for (double scopeMs: sample.scopesMs)
+                _csv << "," << scopeMs;
+            _csv << ",";
+            if (sample.gpuMs >= 0.0)
+                _csv << sample.gpuMs;
+            _csv << "\n";
+        }
+};
+
+// Shaders get a 3.2 core profile context, the fixed function pipeline (and the CPU transform that feeds it) keeps
+// the legacy one. macOS only makes forward compatible core contexts. After glfwInit(), before glfwCreateWindow()
+void hintGlContext(bool core)
+{
+    if (!core)
+        return;
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+}
+
+// Depth test and fixed function lighting shared by the window, the benchmark and the thumbnails, the mesh shaders do
+// the same lighting on their own (see ShaderLibrary). Core profiles have no fixed function state, but draw nothing
+// without a vertex array object bound
+void initGlState()
+{
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    // The identity projection keeps the lowest z in front, so the viewer is towards -z and the front faces are the
+    // clockwise ones on screen
+    glFrontFace(GL_CW);
+    if (isCoreProfile())
+    {
+        // the only one, it goes away with the context
+        GLuint vertexArray = 0;
+        glGenVertexArrays(1, &vertexArray);
+        glBindVertexArray(vertexArray);
+        return;
+    }
+
+    // lightning
+    glEnable(GL_LIGHTING);
+    glEnable(GL_LIGHT0);
+    // The light comes from the viewer (the default one, towards +z, lit the back of the meshes).
+    // Lighting both sides keeps the meshes wound the other way lit too
+    float lightPosition[4] = {LIGHT_DIRECTION[0], LIGHT_DIRECTION[1], LIGHT_DIRECTION[2], 0.0f};
+    glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+    glLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
+    glEnable(GL_COLOR_MATERIAL);
+    // normals are unit length in the mesh buffers and the model scale is uniform
+    glEnable(GL_RESCALE_NORMAL);
+    glShadeModel(GL_SMOOTH);
+
+    // glMaterialfv reads 4 components (rgba)
+    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 0.0f);
+    float specular[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, specular);
+    float ambient[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, ambient);
+    float diffuse[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, diffuse);
+}
+
+// Peak resident set size of the process, in bytes
+size_t getPeakRss()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024;
+#endif
+}
+
+// From the smallest to the largest bundled model, used by --bench when no file is given
+constexpr const char *BENCH_CORPUS[] = {
+    "test.obj", "square.obj", "cube.obj", "simple_cube.obj", "resources/42.obj", "monke3.obj", "monke1_simplified.obj",
+    "resources/teapot.obj", "resources/teapot2.obj", "aspiropoulpe.obj", "monke4.obj", "monke2.obj", "monke1.obj"
+};
+
+double median(std::vector<double> values)
+{
+    if (values.empty())
+        return 0.0;
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+// Loads every file `repeats` times without the mesh cache and prints the median timings, then optionally draws
+// `frames` frames of each one in a hidden window, through the shaders unless fixedFunction. Returns the exit status
+int runBenchmark(std::vector<std::string> filenames, LoadOptions options, int repeats, int frames, bool fixedFunction)
+{
+    if (filenames.empty())
+    {
+        for (const char *filename: BENCH_CORPUS)
+        {
+            if (access(filename, R_OK) == 0)
+                filenames.push_back(filename);
+            else
+                std::cerr << "Skipping missing " << filename << std::endl;
+        }
+    }
+    options.useCache = false;
+    options.verbose = false;
+    repeats = std::max(repeats, 1);
+
+    printf("%-24s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n", "file", "size MB", "lines", "parse ms", "MB/s", "Mlines/s",
+        "norm ms", "center ms", "build ms", "lod ms", "bvh ms", "peak MB");
+    for (const std::string &filename: filenames)
+    {
+        size_t lines = 0;
+        size_t size = 0;
+        try {
+            MappedFile file(filename.c_str());
+            std::string_view text = file.view();
+            size = text.size();
+            lines = std::count(text.begin(), text.end(), '\n') + (!text.empty() && text.back() != '\n');
+        } catch (std::exception &e) {
+            std::cerr << "Cannot open " << filename << ": " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::vector<double> load, normalize, center, build, lods, clusters;
+        for (int i = 0; i < repeats; i++)
+        {
+            try {
+                ObjectFile object(filename.c_str(), options);
+                load.push_back(object._loadTimings.load);
+                normalize.push_back(object._loadTimings.normalize);
+                build.push_back(object._loadTimings.renderBuffers);
+                lods.push_back(object._loadTimings.lods);
+                clusters.push_back(object._loadTimings.clusters);
+
+                auto start = std::chrono::steady_clock::now();
+                volatile float x = object.getCenterPoint().x;
+                (void)x;
+                center.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            } catch (std::exception &e) {
+                std::cerr << "Cannot parse file " << filename << ": " << e.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        double parseSeconds = median(load);
+        printf("%-24s %9.2f %9zu %9.2f %9.1f %9.2f %9.3f %9.3f %9.2f %9.2f %9.2f %9.1f\n", filename.c_str(), size / 1e6, lines,
+            parseSeconds * 1e3, size / 1e6 / parseSeconds, lines / 1e6 / parseSeconds,
+            median(normalize) * 1e3, median(center) * 1e3, median(build) * 1e3, median(lods) * 1e3, median(clusters) * 1e3,
+            getPeakRss() / 1e6);
+        fflush(stdout);
+    }
+
+    if (frames <= 0)
+        return EXIT_SUCCESS;
+
+    GLFWwindow* window = nullptr;
+    if (glfwInit())
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        hintGlContext(!fixedFunction);
+        window = glfwCreateWindow(640, 640, "scop bench", NULL, NULL);
+    }
+    if (!window)
+    {
+        std::cerr << "Cannot create an OpenGL context, skipping the draw benchmark" << std::endl;
+        glfwTerminate();
+        return EXIT_FAILURE;
+    }
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0);
+    initGlState();
+    glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+    std::unique_ptr<ShaderLibrary> shaders;
+    if (!fixedFunction)
+        shaders = std::make_unique<ShaderLibrary>(getProgramCachePath());
+
+    // glFinish after each frame so the CPU side timing also covers the GPU work
+    printf("\n%-24s %9s %9s %9s %9s\n", "file", "triangles", "upload ms", "draw ms", "draw p95");
+    for (const std::string &filename: filenames)
+    {
+        auto mesh = std::make_shared<ObjectFile>(filename.c_str(), options);
+        ObjectInstance object(mesh);
+        if (shaders && shaders->available())
+            mesh->useShaders(shaders.get());
+
+        auto start = std::chrono::steady_clock::now();
+        mesh->uploadRenderBuffers();
+        glFinish();
+        double upload = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<double> draw;
+        int height = viewportHeight();
+        Arena frame(FRAME_ARENA_BLOCK_SIZE);
+        for (int i = 0; i < frames; i++)
+        {
+            start = std::chrono::steady_clock::now();
+            frame.reset();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            object.display(frame, height);
+            glFinish();
+            draw.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            object.rotate(0.0, 0.75, 0.0);
+            glfwSwapBuffers(window);
+        }
+
+        std::sort(draw.begin(), draw.end());
+        printf("%-24s %9zu %9.2f %9.3f %9.3f\n", filename.c_str(), (size_t)mesh->_lods[0].indexCount / 3, upload * 1e3,
+            draw[draw.size() / 2] * 1e3, draw[std::min(draw.size() - 1, draw.size() * 95 / 100)] * 1e3);
+        fflush(stdout);
+    }
+
+    shaders.reset();
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return EXIT_SUCCESS;
+}
+
+// What a background load hands to the render thread, object is null if loading failed
+struct LoadResult
+{
+    size_t mesh;
+    std::string filename;
+    std::unique_ptr<ObjectFile> object;
+    std::string error;
+    size_t generation = 0; // of the file, only the result of its latest load is used (see FileWatcher)
+};
+
+// How long a changed file must stay the same before it is reloaded, editors may write a large file in several steps
+constexpr double WATCH_SETTLE_SECONDS = 0.2;
+
+// Tells which of a set of files changed since they were last seen, without blocking: the render thread polls it once
+// per frame. Notifications (inotify on Linux, kqueue on macOS and the BSDs) only say when to look, a file has changed
+// once its size or modification time differ and then stayed the same for WATCH_SETTLE_SECONDS. The directories are
+// watched too, for the files replaced by a rename. Without either, every file is looked at on each poll
+class FileWatcher
+{
+    public:
+        FileWatcher(const std::vector<std::string> &paths)
+        {
+            for (const std::string &path: paths)
+            {
+                WatchedFile file;
+                file.path = getRealPath(path);
+                size_t slash = file.path.rfind('/');
+                file.directory = slash == std::string::npos ? "." : file.path.substr(0, std::max<size_t>(slash, 1));
+                file.name = file.path.substr(slash == std::string::npos ? 0 : slash + 1);
+                getSourceStamp(file.path, file.stamp);
+                _files.push_back(std::move(file));
+            }
+
+#ifdef __linux__
+            _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            for (WatchedFile &file: _files)
+                if (_fd >= 0)
+                    file.watch = inotify_add_watch(_fd, file.directory.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE | IN_ATTRIB);
+#elif defined(HAS_KQUEUE)
+            _fd = kqueue();
+            for (size_t i = 0; i < _files.size() && _fd >= 0; i++)
+            {
+                // udata 0 is a directory, a file is its index + 1
+                _files[i].directoryFd = open(_files[i].directory.c_str(), O_RDONLY);
+                if (_files[i].directoryFd >= 0)
+                    addKqueueWatch(_files[i].directoryFd, 0, NOTE_WRITE);
+                openWatchedFile(i);
+            }
+#endif
+        }
 
-    // Capture obj to be able to use it in the callback
-    glfwSetCursorPosCallback(window, [](GLFWwindow* window, double xpos, double ypos) {
-        static double last_xpos = xpos;
-        static double last_ypos = ypos;
+        ~FileWatcher()
+        {
+#ifdef HAS_KQUEUE
+            for (const WatchedFile &file: _files)
+            {
+                if (file.fd >= 0)
+                    close(file.fd);
+                if (file.directoryFd >= 0)
+                    close(file.directoryFd);
+            }
+#endif
+            if (_fd >= 0)
+                close(_fd);
+        }
+
+        FileWatcher(const FileWatcher&) = delete;
+        FileWatcher& operator=(const FileWatcher&) = delete;
+
+        // Indices (in the paths given to the constructor) of the files that changed since the last poll() reported them
+        std::vector<size_t> poll()
+        {
+            readNotifications();
+
+            std::vector<size_t> changed;
+            auto now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < _files.size(); i++)
+            {
+                WatchedFile &file = _files[i];
+                if (_fd >= 0 && !file.dirty && !file.changing)
+                    continue;
+                file.dirty = false;
+
+                // a file missing for a moment (while an editor replaces it) is still changing
+                SourceStamp stamp;
+                if (!getSourceStamp(file.path, stamp))
+                    continue;
+                if (stamp.size == file.stamp.size && stamp.mtime == file.stamp.mtime)
+                {
+                    file.changing = false;
+                    continue;
+                }
+                if (!file.changing || stamp.size != file.pending.size || stamp.mtime != file.pending.mtime)
+                {
+                    file.changing = true;
+                    file.pending = stamp;
+                    file.since = now;
+                    continue;
+                }
+                if (std::chrono::duration<double>(now - file.since).count() >= WATCH_SETTLE_SECONDS)
+                {
+                    file.changing = false;
+                    file.stamp = stamp;
+                    changed.push_back(i);
+                }
+            }
+            return changed;
+        }
+
+    private:
+        struct WatchedFile
+        {
+            std::string path;
+            std::string directory;
+            std::string name;
+            SourceStamp stamp; // of the version last reported
+            SourceStamp pending; // of the version seen changing
+            std::chrono::steady_clock::time_point since; // when pending was first seen
+            bool changing = false;
+            bool dirty = false; // a notification came, to be looked at
+            int watch = -1; // inotify watch of the directory
+            int fd = -1; // kqueue watches
+            int directoryFd = -1;
+        };
+
+        std::vector<WatchedFile> _files;
+        int _fd = -1;
+
+        void readNotifications()
+        {
+#ifdef __linux__
+            alignas(struct inotify_event) char buffer[4096];
+            ssize_t length;
+            while (_fd >= 0 && (length = read(_fd, buffer, sizeof(buffer))) > 0)
+            {
+                for (char *p = buffer; p < buffer + length; )
+                {
+                    const struct inotify_event *event = reinterpret_cast<const struct inotify_event*>(p);
+                    for (WatchedFile &file: _files)
+                        if ((event->mask & IN_Q_OVERFLOW) || (event->wd == file.watch && event->len && file.name == event->name))
+                            file.dirty = true;
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+            }
+#elif defined(HAS_KQUEUE)
+            struct kevent events[16];
+            struct timespec timeout = {0, 0};
+            int count;
+            while (_fd >= 0 && (count = kevent(_fd, nullptr, 0, events, 16, &timeout)) > 0)
+            {
+                for (int e = 0; e < count; e++)
+                {
+                    size_t index = (uintptr_t)events[e].udata;
+                    // a file replaced or removed is watched again through its new node, once there is one
+                    if (index > 0 && (events[e].fflags & (NOTE_DELETE | NOTE_RENAME)))
+                    {
+                        close(_files[index - 1].fd);
+                        _files[index - 1].fd = -1;
+                    }
+                    // the event of a directory doesn't say which entry changed
+                    for (size_t i = 0; i < _files.size(); i++)
+                        if (index == 0 || index == i + 1)
+                            _files[i].dirty = true;
+                }
+            }
+            for (size_t i = 0; i < _files.size(); i++)
+                if (_files[i].fd < 0)
+                    openWatchedFile(i);
+#endif
+        }
+
+#ifdef HAS_KQUEUE
+        void addKqueueWatch(int fd, uintptr_t index, unsigned flags)
+        {
+            struct kevent change;
+            EV_SET(&change, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, flags, 0, (void*)index);
+            kevent(_fd, &change, 1, nullptr, 0, nullptr);
+        }
+
+        void openWatchedFile(size_t i)
+        {
+            _files[i].fd = open(_files[i].path.c_str(), O_RDONLY);
+            if (_files[i].fd >= 0)
+                addKqueueWatch(_files[i].fd, i + 1, NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME);
+        }
+#endif
+};
+
+// Mouse input as the GLFW callbacks see it, x and y are the cursor position or the scroll offsets
+struct InputEvent
+{
+    enum Type { Cursor, Scroll } type;
+    double x;
+    double y;
+    int button; // held when the cursor moved, -1 for none
+};
+
+// Everything the mouse did during a frame, applied to every object at once
+struct InputDelta
+{
+    glm::vec2 translation = glm::vec2(0.0f, 0.0f);
+    glm::vec2 rotation = glm::vec2(0.0f, 0.0f); // degrees around x then y
+    double scale = 1.0;
+};
+
+// The GLFW callbacks only push events, the render thread drains them once per frame into a single delta. Drawing
+// cost doesn't depend on how many events a fast mouse sends, and the last cursor position lives here
+class InputQueue
+{
+    public:
+        void push(const InputEvent &event)
+        {
+            _events.push(event);
+        }
+
+        // Sums the events since the last call, rotations around x and y are small enough per frame to be added up.
+        // frame holds the list of the events
+        InputDelta coalesce(Arena &frame)
+        {
+            InputDelta delta;
+            ArenaVector<InputEvent> events{ArenaAllocator<InputEvent>(frame)};
+            _events.popAll(events);
+            for (const InputEvent &event: events)
+            {
+                if (event.type == InputEvent::Scroll)
+                {
+                    delta.scale *= 1.0 + event.y / 10.0;
+                    continue;
+                }
+
+                if (!_cursorKnown)
+                {
+                    _lastX = event.x;
+                    _lastY = event.y;
+                    _cursorKnown = true;
+                }
+                // idk why x axis is vertical and y axis is horizontal
+                double xOffset = event.x - _lastX;
+                double yOffset = _lastY - event.y;
+                _lastX = event.x;
+                _lastY = event.y;
+
+                if (event.button == GLFW_MOUSE_BUTTON_MIDDLE)
+                    delta.translation += glm::vec2(xOffset / 250.0, yOffset / 250.0);
+                else if (event.button == GLFW_MOUSE_BUTTON_RIGHT)
+                    delta.scale *= 1.0 + yOffset / 100.0;
+                else if (event.button == GLFW_MOUSE_BUTTON_LEFT)
+                    delta.rotation += glm::vec2(yOffset * 0.5, xOffset * 0.5);
+            }
+            return delta;
+        }
+
+    private:
+        LockFreeQueue<InputEvent> _events;
+        bool _cursorKnown = false;
+        double _lastX = 0.0;
+        double _lastY = 0.0;
+};
+
+// Side of the --render thumbnails, in pixels
+constexpr GLsizei THUMBNAIL_SIZE = 256;
+// Thumbnails read back at once: the pixels of one are mapped only once the next ones are drawn, by then the copy to
+// its pixel buffer is long done and mapping it doesn't wait for the GPU
+constexpr size_t THUMBNAIL_READBACKS = 3;
+// The fixed camera of the thumbnails, in degrees around x, y then z. A normalized mesh fits in the view volume
+// whatever its rotation at a scale under 1 / sqrt(3)
+constexpr float THUMBNAIL_ANGLES[3] = {-25.0f, 35.0f, 0.0f};
+constexpr double THUMBNAIL_SCALE = 0.57;
+// Files parsed or waiting to be drawn per loader thread, so that memory stays bounded on a large library
+constexpr size_t THUMBNAIL_LOADS_PER_THREAD = 2;
+// How long the render thread sleeps when it waits for the loaders or the writers
+constexpr std::chrono::milliseconds THUMBNAIL_POLL(1);
+
+// --render: draws each file once at the fixed camera into out_dir/name.ppm, without the interactive loop. The files
+// are parsed side by side by a pool of loaders while the render thread draws those that are ready into a framebuffer
+// object. Its pixels go to a ring of pixel buffers that are mapped THUMBNAIL_READBACKS thumbnails later, and the
+// images are written by a pool of their own. GLFW only gives a context with a window, it stays hidden
+int renderThumbnails(const std::string &outDir, const std::vector<std::string> &filenames, LoadOptions options, bool fixedFunction)
+{
+    if (mkdir(outDir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        std::cerr << "Cannot create " << outDir << ": " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+    // each file on one thread unless --threads says otherwise, the files are the parallel part
+    if (options.threads == 0)
+        options.threads = 1;
+    options.verbose = false;
+
+    // a number is added to the files sharing a name
+    std::vector<std::string> outputs;
+    std::unordered_map<std::string, size_t> names;
+    for (const std::string &filename: filenames)
+    {
+        size_t slash = filename.rfind('/');
+        std::string name = filename.substr(slash == std::string::npos ? 0 : slash + 1);
+        name.resize(name.size() - 4);
+        size_t uses = ++names[name];
+        outputs.push_back(outDir + "/" + name + (uses > 1 ? "-" + std::to_string(uses) : "") + ".ppm");
+    }
+
+    GLFWwindow* window = nullptr;
+    if (glfwInit())
+    {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        hintGlContext(!fixedFunction);
+        window = glfwCreateWindow(THUMBNAIL_SIZE, THUMBNAIL_SIZE, "scop render", NULL, NULL);
+    }
+    if (!window)
+    {
+        std::cerr << "Cannot create an OpenGL context" << std::endl;
+        glfwTerminate();
+        return EXIT_FAILURE;
+    }
+    glfwMakeContextCurrent(window);
+    initGlState();
+    glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+    std::unique_ptr<ShaderLibrary> shaders;
+    if (!fixedFunction)
+        shaders = std::make_unique<ShaderLibrary>(getProgramCachePath());
+    if (shaders && !shaders->available())
+        shaders.reset();
+
+    // framebuffer objects are only core from GL 3.0, the legacy macOS context has the extension: the same enums
+    // through other entry points
+    const bool core = isCoreProfile();
+    auto genFramebuffers = core ? glGenFramebuffers : glGenFramebuffersEXT;
+    auto bindFramebuffer = core ? glBindFramebuffer : glBindFramebufferEXT;
+    auto deleteFramebuffers = core ? glDeleteFramebuffers : glDeleteFramebuffersEXT;
+    auto genRenderbuffers = core ? glGenRenderbuffers : glGenRenderbuffersEXT;
+    auto bindRenderbuffer = core ? glBindRenderbuffer : glBindRenderbufferEXT;
+    auto deleteRenderbuffers = core ? glDeleteRenderbuffers : glDeleteRenderbuffersEXT;
+    auto renderbufferStorage = core ? glRenderbufferStorage : glRenderbufferStorageEXT;
+    auto framebufferRenderbuffer = core ? glFramebufferRenderbuffer : glFramebufferRenderbufferEXT;
+    auto checkFramebufferStatus = core ? glCheckFramebufferStatus : glCheckFramebufferStatusEXT;
+
+    GLuint framebuffer, renderbuffers[2];
+    genFramebuffers(1, &framebuffer);
+    bindFramebuffer(GL_FRAMEBUFFER_EXT, framebuffer);
+    genRenderbuffers(2, renderbuffers);
+    bindRenderbuffer(GL_RENDERBUFFER_EXT, renderbuffers[0]);
+    renderbufferStorage(GL_RENDERBUFFER_EXT, GL_RGBA8, THUMBNAIL_SIZE, THUMBNAIL_SIZE);
+    framebufferRenderbuffer(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, renderbuffers[0]);
+    bindRenderbuffer(GL_RENDERBUFFER_EXT, renderbuffers[1]);
+    renderbufferStorage(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, THUMBNAIL_SIZE, THUMBNAIL_SIZE);
+    framebufferRenderbuffer(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, renderbuffers[1]);
+    bindRenderbuffer(GL_RENDERBUFFER_EXT, 0);
+    bool complete = checkFramebufferStatus(GL_FRAMEBUFFER_EXT) == GL_FRAMEBUFFER_COMPLETE_EXT;
+    glViewport(0, 0, THUMBNAIL_SIZE, THUMBNAIL_SIZE);
+    glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    struct Readback
+    {
+        GLuint buffer = 0;
+        size_t file = 0;
+        bool pending = false; // glReadPixels was queued, the pixels are not mapped yet
+    };
+    const size_t imageSize = (size_t)THUMBNAIL_SIZE * THUMBNAIL_SIZE * 4;
+    Readback readbacks[THUMBNAIL_READBACKS];
+    for (Readback &readback: readbacks)
+    {
+        glGenBuffers(1, &readback.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, imageSize, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    TextureCache textures(std::max(1u, threads / 2));
+    LockFreeQueue<LoadResult> loaded;
+    LockFreeQueue<std::string> written; // empty once a thumbnail is written, the error otherwise
+    // declared after the queues, so that they're destroyed (and their running tasks finished) first
+    ThreadPool loaders(std::min<size_t>(filenames.size(), threads));
+    ThreadPool writers(std::max(1u, threads / 4));
+
+    size_t nextLoad = 0, loading = 0, finished = 0, failures = 0, drawn = 0;
+    std::vector<LoadResult> waiting; // for their textures
+    auto submitLoads = [&]() {
+        for (; nextLoad < filenames.size() && loading + waiting.size() < threads * THUMBNAIL_LOADS_PER_THREAD; nextLoad++, loading++)
+        {
+            size_t file = nextLoad;
+            std::string filename = filenames[file];
+            loaders.submit([&loaded, file, filename, options]() {
+                LoadResult result;
+                result.mesh = file;
+                result.filename = filename;
+                try {
+                    result.object = std::make_unique<ObjectFile>(filename.c_str(), options);
+                } catch (std::exception &e) {
+                    result.error = e.what();
+                }
+                loaded.push(std::move(result));
+            });
+        }
+    };
+
+    // maps the pixels of readback, copies them out and hands them to the writers
+    auto finishReadback = [&](Readback &readback) {
+        readback.pending = false;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        const uint8_t *pixels = static_cast<const uint8_t*>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+        auto image = std::make_shared<Image>();
+        image->width = THUMBNAIL_SIZE;
+        image->height = THUMBNAIL_SIZE;
+        if (pixels)
+            image->pixels.assign(pixels, pixels + imageSize);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        const std::string &path = outputs[readback.file];
+        if (!pixels)
+        {
+            written.push("Cannot read back " + path);
+            return;
+        }
+        writers.submit([&written, image, path]() {
+            written.push(writePpm(*image, path) ? std::string() : "Cannot write " + path + ": " + strerror(errno));
+        });
+    };
+
+    // reset once per turn of the loop below, like the frames of the viewer
+    Arena frame(FRAME_ARENA_BLOCK_SIZE);
+    auto draw = [&](std::shared_ptr<ObjectFile> mesh, size_t file) {
+        mesh->uploadRenderBuffers();
+        ObjectInstance object(mesh, glm::vec3(0.0f, 0.0f, 0.0f), THUMBNAIL_SCALE);
+        object.rotate(THUMBNAIL_ANGLES[0], THUMBNAIL_ANGLES[1], THUMBNAIL_ANGLES[2]);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        object.display(frame, THUMBNAIL_SIZE);
+
+        Readback &readback = readbacks[drawn++ % THUMBNAIL_READBACKS];
+        if (readback.pending)
+            finishReadback(readback);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glReadPixels(0, 0, THUMBNAIL_SIZE, THUMBNAIL_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readback.file = file;
+        readback.pending = true;
+        // the GL keeps the buffers until the draw is done with them
+        mesh->releaseRenderBuffers();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    if (!complete)
+    {
+        std::cerr << "Cannot create an offscreen framebuffer" << std::endl;
+        finished = failures = filenames.size();
+    }
+    while (finished < filenames.size())
+    {
+        frame.reset();
+        ArenaVector<LoadResult> results{ArenaAllocator<LoadResult>(frame)};
+        loaded.popAll(results);
+        for (LoadResult &result: results)
+        {
+            loading--;
+            if (!result.object)
+            {
+                std::cerr << "Cannot parse file " << result.filename << ": " << result.error << std::endl;
+                finished++;
+                failures++;
+                continue;
+            }
+            result.object->useShaders(shaders.get());
+            result.object->acquireTextures(textures);
+            waiting.push_back(std::move(result));
+        }
+        textures.uploadDecoded(frame);
+
+        bool drew = false;
+        for (size_t i = 0; i < waiting.size();)
+        {
+            if (!waiting[i].object->texturesReady())
+            {
+                i++;
+                continue;
+            }
+            draw(std::move(waiting[i].object), waiting[i].mesh);
+            waiting.erase(waiting.begin() + i);
+            drew = true;
+        }
+        submitLoads();
 
-        double y_offset = last_ypos - ypos;
-        double x_offset = xpos - last_xpos;
+        // nothing else is coming to push the last thumbnails out of the ring
+        if (nextLoad == filenames.size() && loading == 0 && waiting.empty())
+            for (size_t i = 0; i < THUMBNAIL_READBACKS; i++)
+                if (readbacks[(drawn + i) % THUMBNAIL_READBACKS].pending)
+                    finishReadback(readbacks[(drawn + i) % THUMBNAIL_READBACKS]);
 
-        auto objs = static_cast<ObjectFile**>(glfwGetWindowUserPointer(window));
-        // idk why x axis is vertical and y axis is horizontal
-        for (size_t i = 0; objs[i] != nullptr; i++)
+        ArenaVector<std::string> errors{ArenaAllocator<std::string>(frame)};
+        written.popAll(errors);
+        for (const std::string &error: errors)
         {
-            if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_MIDDLE) == GLFW_PRESS)
-                objs[i]->translate(x_offset / 250.0, y_offset / 250.0, 0.0);
-            else if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS)
-                objs[i]->scale(1.0f + y_offset / 100.0);
-            else if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS)
-                objs[i]->rotate(y_offset * 0.5, x_offset * 0.5, 0.0);
+            finished++;
+            if (error.empty())
+                continue;
+            std::cerr << error << std::endl;
+            failures++;
         }
-        //     (objs[i])->rotate((y_offset) * 0.1f, (x_offset * 0.1f, 0.0f);
+        if (!drew)
+            std::this_thread::sleep_for(THUMBNAIL_POLL);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t thumbnails = filenames.size() - failures;
+    printf("%zu thumbnails in %.2f s, %.1f thumbnails/s\n", thumbnails, seconds, thumbnails / std::max(seconds, 1e-9));
+
+    for (Readback &readback: readbacks)
+        glDeleteBuffers(1, &readback.buffer);
+    bindFramebuffer(GL_FRAMEBUFFER_EXT, 0);
+    deleteRenderbuffers(2, renderbuffers);
+    deleteFramebuffers(1, &framebuffer);
+    shaders.reset();
+    textures.release();
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+void usage()
+{
+    std::cerr << "fuck you and use a file.obj" << std::endl;
+    std::cerr << "usage: scop [--loader=stream|mapped|parallel|progressive] [--threads=N] [--no-cache] [--no-lod] [--crease-angle=degrees]" << std::endl;
+    std::cerr << "            [--lenient] [--compress] [--profile] [--profile-csv=file.csv] [--fps=N | --vsync | --uncapped] [--instances=N]" << std::endl;
+    std::cerr << "            [--no-culling | --backface-culling] [--cpu-transform] [--fixed-function] [--hide=group,...]" << std::endl;
+    std::cerr << "            [--watch] file.obj..." << std::endl;
+    std::cerr << "       scop --bench[=repeats] [--bench-frames=N] [--fixed-function] [--loader=...] [--threads=N] [file.obj...]" << std::endl;
+    std::cerr << "       scop --render out_dir [--fixed-function] [--loader=...] [--threads=N] [--no-cache] [--compress] file.obj..." << std::endl;
+}
+
+// bench/parser_bench.cpp includes this file for the parsers and brings its own main()
+#ifndef SCOP_NO_MAIN
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    LoadOptions loadOptions;
+    std::vector<std::string> filenames;
+    bool profile = false;
+    std::string profileCsv;
+    int benchRepeats = 0;
+    int benchFrames = 0;
+    FramePacing framePacing = FramePacing::Deadline;
+    double fps = TARGET_FPS;
+    size_t instancesPerFile = 1;
+    CullingOptions culling;
+    bool cpuTransform = false;
+    bool fixedFunction = false;
+    bool watch = false;
+    std::string renderDir; // --render, thumbnails instead of the window
+    std::vector<std::string> hiddenSubMeshes; // o/g names
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--loader=stream") {
+            loadOptions.mode = LoadMode::Stream;
+            continue;
+        } else if (arg == "--loader=mapped") {
+            loadOptions.mode = LoadMode::Mapped;
+            continue;
+        } else if (arg == "--loader=parallel") {
+            loadOptions.mode = LoadMode::Parallel;
+            continue;
+        } else if (arg == "--loader=progressive") {
+            loadOptions.mode = LoadMode::Progressive;
+            continue;
+        } else if (arg == "--no-cache") {
+            loadOptions.useCache = false;
+            continue;
+        } else if (arg == "--no-lod") {
+            loadOptions.buildLods = false;
+            continue;
+        } else if (arg == "--lenient") {
+            loadOptions.lenient = true;
+            continue;
+        } else if (arg == "--compress") {
+            loadOptions.compress = true;
+            continue;
+        } else if (arg.rfind("--crease-angle=", 0) == 0) {
+            loadOptions.creaseAngle = std::atof(arg.c_str() + 15);
+            continue;
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            loadOptions.threads = std::atoi(arg.c_str() + 10);
+            continue;
+        } else if (arg == "--profile") {
+            profile = true;
+            continue;
+        } else if (arg.rfind("--profile-csv=", 0) == 0) {
+            profile = true;
+            profileCsv = arg.substr(14);
+            continue;
+        } else if (arg == "--no-culling") {
+            culling.frustum = false;
+            culling.backfaces = false;
+            continue;
+        } else if (arg == "--backface-culling") {
+            culling.backfaces = true;
+            continue;
+        } else if (arg.rfind("--hide=", 0) == 0) {
+            for (size_t start = 7, end; start <= arg.size(); start = end + 1)
+            {
+                end = std::min(arg.find(',', start), arg.size());
+                if (end > start)
+                    hiddenSubMeshes.push_back(arg.substr(start, end - start));
+            }
+            continue;
+        } else if (arg == "--cpu-transform") {
+            cpuTransform = true;
+            continue;
+        } else if (arg == "--fixed-function") {
+            fixedFunction = true;
+            continue;
+        } else if (arg == "--watch") {
+            watch = true;
+            continue;
+        } else if (arg == "--render" && i + 1 < argc) {
+            renderDir = argv[++i];
+            continue;
+        } else if (arg.rfind("--instances=", 0) == 0) {
+            instancesPerFile = std::max(1, std::atoi(arg.c_str() + 12));
+            continue;
+        } else if (arg == "--vsync") {
+            framePacing = FramePacing::Vsync;
+            continue;
+        } else if (arg == "--uncapped") {
+            framePacing = FramePacing::Uncapped;
+            continue;
+        } else if (arg.rfind("--fps=", 0) == 0) {
+            framePacing = FramePacing::Deadline;
+            fps = std::atof(arg.c_str() + 6);
+            continue;
+        } else if (arg == "--bench") {
+            benchRepeats = 5;
+            continue;
+        } else if (arg.rfind("--bench=", 0) == 0) {
+            benchRepeats = std::max(1, std::atoi(arg.c_str() + 8));
+            continue;
+        } else if (arg.rfind("--bench-frames=", 0) == 0) {
+            benchFrames = std::atoi(arg.c_str() + 15);
+            continue;
+        }
+
+        // check if .obj
+        if (arg.length() < 4 || arg.substr(arg.length() - 4) != ".obj")
+        {
+            usage();
+            return EXIT_FAILURE;
+        }
+        filenames.push_back(arg);
+    }
+
+    if (benchRepeats)
+        return runBenchmark(filenames, loadOptions, benchRepeats, benchFrames, fixedFunction);
+
+    if (filenames.empty())
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if (!renderDir.empty())
+        return renderThumbnails(renderDir, filenames, loadOptions, fixedFunction);
+
+    // Each distinct file is loaded once, a file given several times only gets more instances
+    std::vector<std::string> meshPaths;
+    std::vector<std::string> meshFilenames;
+    std::vector<size_t> meshCopies;
+    for (const std::string &filename: filenames)
+    {
+        std::string path = getRealPath(filename);
+        size_t mesh = std::find(meshPaths.begin(), meshPaths.end(), path) - meshPaths.begin();
+        if (mesh == meshPaths.size())
+        {
+            meshPaths.push_back(path);
+            meshFilenames.push_back(filename);
+            meshCopies.push_back(0);
+        }
+        meshCopies[mesh] += instancesPerFile;
+    }
+
+    // Meshes are parsed in the background, the render thread adds their instances to the scene once they are loaded
+    // (in completion order), or right away for progressive loads
+    Scene scene(instancesPerFile);
+
+    LockFreeQueue<LoadResult> loadedObjects;
+    // declared after the queue, so that it's destroyed (and its running loads finished) first
+    ThreadPool loaders(std::min<size_t>(meshFilenames.size(), std::max(1u, std::thread::hardware_concurrency())));
+    // Loads done by each file so far, a reload started before the previous one is done makes it stale
+    std::vector<size_t> loadGenerations(meshFilenames.size(), 0);
+
+    auto submitLoad = [&loaders, &loadedObjects, &meshFilenames, &loadGenerations](size_t mesh, const LoadOptions &options) {
+        std::string filename = meshFilenames[mesh];
+        size_t generation = loadGenerations[mesh];
+        loaders.submit([&loadedObjects, mesh, filename, options, generation]() {
+            LoadResult result;
+            result.mesh = mesh;
+            result.filename = filename;
+            result.generation = generation;
+            try {
+                result.object = std::make_unique<ObjectFile>(filename.c_str(), options);
+            } catch (std::exception &e) {
+                result.error = e.what();
+            }
+            loadedObjects.push(std::move(result));
+        });
+    };
+
+    for (size_t mesh = 0; mesh < meshFilenames.size(); mesh++)
+    {
+        std::string filename = meshFilenames[mesh];
+        if (loadOptions.mode == LoadMode::Progressive)
+        {
+            // parsed into a private ObjectFile, only the batches go through the one being drawn
+            auto target = std::make_shared<ObjectFile>();
+            target->_filename = filename;
+            target->startProgressive();
+            scene.addMesh(target, meshCopies[mesh], mesh);
+            loaders.submit([&loadedObjects, mesh, filename, loadOptions, target]() {
+                try {
+                    ObjectFile parser;
+                    parser._filename = filename;
+                    parser._verbose = loadOptions.verbose;
+                    parser._lenient = loadOptions.lenient;
+                    parser.loadProgressive(filename.c_str(), *target);
+                } catch (std::exception &e) {
+                    loadedObjects.push(LoadResult{mesh, filename, nullptr, e.what()});
+                }
+            });
+            continue;
+        }
+        submitLoad(mesh, loadOptions);
+    }
+
+    // Files edited while they are shown are parsed again in the background, and swapped in between two frames
+    std::unique_ptr<FileWatcher> watcher;
+    LoadOptions reloadOptions = loadOptions;
+    if (watch)
+    {
+        watcher = std::make_unique<FileWatcher>(meshFilenames);
+        // a mesh being drawn can't be cleared for a progressive load, the whole file is parsed before it is swapped
+        if (reloadOptions.mode == LoadMode::Progressive)
+            reloadOptions.mode = LoadMode::Parallel;
+    }
+
+    std::unique_ptr<FrameProfiler> profiler;
+    if (profile)
+    {
+        try {
+            profiler = std::make_unique<FrameProfiler>(profileCsv);
+        } catch (std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // create window using glfw
+    GLFWwindow* window;
+    if (!glfwInit())
+        return -1;
+
+    hintGlContext(!fixedFunction && !cpuTransform);
+    window = glfwCreateWindow(640, 640, "Hello World", NULL, NULL);
+    if (!window)
+    {
+        glfwTerminate();
+        return -1;
+    }
+
+    glfwMakeContextCurrent(window);
+    if (profiler)
+        profiler->initGpuTimer();
+    initGlState();
+    if (culling.backfaces)
+        glEnable(GL_CULL_FACE);
+
+    InputQueue input;
+    glfwSetWindowUserPointer(window, &input);
+    std::unique_ptr<ShaderLibrary> shaders;
+    if (!fixedFunction)
+        shaders = std::make_unique<ShaderLibrary>(getProgramCachePath());
+    if (shaders && !shaders->available())
+    {
+        std::cerr << "No GLSL 1.20, drawing with the fixed function pipeline" << std::endl;
+        shaders.reset();
+    }
+
+    // the calling thread takes a share of the vertices too
+    std::unique_ptr<ThreadPool> transformPool;
+    if (cpuTransform)
+        transformPool = std::make_unique<ThreadPool>(std::max(2u, std::thread::hardware_concurrency()) - 1);
+    // progressive loads already have their mesh, the CPU transform feeds the fixed function pipeline
+    scene.useShaders(shaders.get(), transformPool.get());
+
+    // half of the threads, the loaders may still be busy parsing when the first textures are asked for
+    TextureCache textures(std::max(1u, std::thread::hardware_concurrency() / 2));
+
+    // GL objects must go before the context does, progressive loads still running may keep their mesh a bit longer
+    auto shutdown = [&]() {
+        scene.release();
+        shaders.reset();
+        textures.release();
+        glfwTerminate();
+    };
+
 
-        last_xpos = xpos;
-        last_ypos = ypos;
+    // hide cursor
+    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+    // Capture the input queue to be able to use it in the callbacks, the events are applied after glfwPollEvents()
+    glfwSetCursorPosCallback(window, [](GLFWwindow* window, double xpos, double ypos) {
+        int button = -1;
+        if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_MIDDLE) == GLFW_PRESS)
+            button = GLFW_MOUSE_BUTTON_MIDDLE;
+        else if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS)
+            button = GLFW_MOUSE_BUTTON_RIGHT;
+        else if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS)
+            button = GLFW_MOUSE_BUTTON_LEFT;
+
+        static_cast<InputQueue*>(glfwGetWindowUserPointer(window))->push(InputEvent{InputEvent::Cursor, xpos, ypos, button});
     });
 
     glfwSetScrollCallback(window, [](GLFWwindow* window, double xoffset, double yoffset)
     {
-        double zoomFactor = 1.0f + (yoffset / 10.0f);
-
-        auto objs = static_cast<ObjectFile**>(glfwGetWindowUserPointer(window));
-        for (size_t i = 0; objs[i] != nullptr; i++)
-            objs[i]->scale(zoomFactor);
+        static_cast<InputQueue*>(glfwGetWindowUserPointer(window))->push(InputEvent{InputEvent::Scroll, xoffset, yoffset, -1});
     });
 
+    FrameProfiler *frameProfiler = profiler.get();
+    auto last_title_update = std::chrono::steady_clock::now();
+    FrameScheduler scheduler(framePacing, fps);
+
+    // the per frame temporaries of the whole loop, given back at the start of the next frame
+    Arena frame(FRAME_ARENA_BLOCK_SIZE);
     while (!glfwWindowShouldClose(window))
     {
-        auto frame_start = std::chrono::high_resolution_clock::now();
+        frame.reset();
+        double delta = scheduler.beginFrame();
+        if (frameProfiler)
+            frameProfiler->beginFrame();
 
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+        if (watcher)
+            for (size_t mesh: watcher->poll())
+            {
+                loadGenerations[mesh]++;
+                submitLoad(mesh, reloadOptions);
+            }
+
+        ArenaVector<LoadResult> results{ArenaAllocator<LoadResult>(frame)};
+        loadedObjects.popAll(results);
+        for (LoadResult &result: results)
+        {
+            if (result.generation != loadGenerations[result.mesh])
+                continue;
+            MeshGroup *group = scene.findFile(result.mesh);
+
+            // a failed reload keeps the mesh shown, the next save may fix it
+            if (!result.object && group && result.generation > 0)
+            {
+                std::cerr << "Cannot reload file " << result.filename << ": " << result.error << std::endl;
+                continue;
+            }
+            if (!result.object)
+            {
+                std::cerr << "Cannot parse file " << result.filename << ": " << result.error << std::endl;
+                shutdown();
+                return EXIT_FAILURE;
+            }
+
+            std::shared_ptr<ObjectFile> mesh = std::move(result.object);
+            scene.prepareMesh(*mesh);
+            mesh->acquireTextures(textures);
+            for (const std::string &name: hiddenSubMeshes)
+                mesh->setSubMeshVisible(name, false);
+            if (!group)
+            {
+                mesh->uploadRenderBuffers();
+                scene.addMesh(mesh, meshCopies[result.mesh], result.mesh);
+                continue;
+            }
+
+            size_t uploaded = mesh->updateRenderBuffers(*group->mesh);
+            scene.replaceMesh(*group, mesh);
+            if (loadOptions.verbose)
+                std::cout << "Reloaded " << result.filename << ", " << uploaded / 1024 << " KB uploaded" << std::endl;
+        }
+        textures.uploadDecoded(frame);
+        for (const MeshGroup &group: scene.groups())
+            group.mesh->uploadPendingBatches(frame);
+
+        {
+            FrameProfiler::Scope scope(frameProfiler, ProfileScope::Display);
+            if (frameProfiler)
+                frameProfiler->beginGpu();
+
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+
+            scene.draw(frame, culling);
+
+            if (frameProfiler)
+                frameProfiler->endGpu();
+        }
 
-        for (int i = 1; i < argc; i++)
         {
-            (objs[i - 1])->display();
-            (objs[i - 1])->rotate(0.0, 0.75, 0.0);
+            FrameProfiler::Scope scope(frameProfiler, ProfileScope::Transform);
+            for (const std::unique_ptr<ObjectInstance> &object: scene.instances())
+                object->rotate(0.0, SPIN_SPEED * delta, 0.0);
         }
 
-        glfwSwapBuffers(window);
+        {
+            FrameProfiler::Scope scope(frameProfiler, ProfileScope::Swap);
+            glfwSwapBuffers(window);
+        }
+
+        auto input_start = std::chrono::steady_clock::now();
 
         // close on ESC press
         if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -613,52 +8122,75 @@ int main(int argc, char** argv)
 
         glfwPollEvents();
 
-        for (int i = 1; i < argc; i++)
+        InputDelta mouse = input.coalesce(frame);
+        float move = MOVE_SPEED * delta;
+        float angle = ROTATION_SPEED * delta;
+        for (const std::unique_ptr<ObjectInstance> &object: scene.instances())
         {
+            if (mouse.translation != glm::vec2(0.0f, 0.0f))
+                object->translate(mouse.translation.x, mouse.translation.y, 0.0f);
+            if (mouse.scale != 1.0)
+                object->scale(mouse.scale);
+            if (mouse.rotation != glm::vec2(0.0f, 0.0f))
+                object->rotate(mouse.rotation.x, mouse.rotation.y, 0.0f);
+
             if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-                (objs[i - 1])->translate(0.0f, -0.025f, 0.0f);
+                object->translate(0.0f, -move, 0.0f);
             
             if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-                (objs[i - 1])->translate(0.0f, 0.025f, 0.0f);
+                object->translate(0.0f, move, 0.0f);
             
             if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-                (objs[i - 1])->translate(0.025f, 0.0f, 0.0f);
+                object->translate(move, 0.0f, 0.0f);
 
             if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-                (objs[i - 1])->translate(-0.025f, 0.0f, 0.0f);
+                object->translate(-move, 0.0f, 0.0f);
 
             // rotate on keypress (in degrees)
             if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
-                (objs[i - 1])->rotate(1.5f, 0.0f, 0.0f);
+                object->rotate(angle, 0.0f, 0.0f);
 
             if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
-                (objs[i - 1])->rotate(-1.5f, 0.0f, 0.0f);
+                object->rotate(-angle, 0.0f, 0.0f);
 
             if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
-                (objs[i - 1])->rotate(0.0f, 1.5f, 0.0f);
+                object->rotate(0.0f, angle, 0.0f);
 
             if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
-                (objs[i - 1])->rotate(0.0f, -1.5f, 0.0f);
+                object->rotate(0.0f, -angle, 0.0f);
 
             if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-                (objs[i - 1])->rotate(0.0f, 0.0f, 1.5f);
+                object->rotate(0.0f, 0.0f, angle);
 
             if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-                (objs[i - 1])->rotate(0.0f, 0.0f, -1.5f);
+                object->rotate(0.0f, 0.0f, -angle);
 
             if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
-                (objs[i - 1])->center();
+                object->center();
         }
 
-        auto frame_end = std::chrono::high_resolution_clock::now();
+        if (frameProfiler)
+            frameProfiler->add(ProfileScope::Input, std::chrono::steady_clock::now() - input_start);
 
-        auto frame_duration = std::chrono::duration_cast<std::chrono::milliseconds>(frame_end - frame_start);
+        {
+            FrameProfiler::Scope scope(frameProfiler, ProfileScope::Sleep);
+            scheduler.waitNextFrame();
+        }
 
-        // std::cout << "Frame end: " << frame_duration.count() << "ms" << std::endl;
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000 / TARGET_FPS) - frame_duration);
+        if (frameProfiler)
+        {
+            frameProfiler->endFrame();
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_title_update > std::chrono::milliseconds(500))
+            {
+                glfwSetWindowTitle(window, ("Hello World - " + frameProfiler->summary()).c_str());
+                last_title_update = now;
+            }
+        }
     }
 
 
-    glfwTerminate();
+    shutdown();
     return 0;
-}
\ No newline at end of file
+}
+#endif